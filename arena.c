@@ -0,0 +1,223 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dat.h"
+#include "fns.h"
+
+#define ARENA_MINSZ (64 * 1024)
+#define ARENA_MAXSZ (16 * 1024 * 1024)
+
+/* Strictest alignment any Node or Symbol member may need */
+union align {
+	double d;
+	long l;
+	void *p;
+};
+
+/* Start of every block, chaining it to the older ones */
+struct block {
+	struct block *next;
+	size_t size;
+};
+
+#define ALIGN(n) (((n) + sizeof(union align) - 1) & ~(sizeof(union align) - 1))
+#define HDRSZ ALIGN(sizeof(struct block))
+
+static void	arena_grow(Arena*, size_t);
+
+/* Arena amalloc carves from, NULL means plain emalloc. Per thread. */
+static __thread Arena *cur = NULL;
+
+Arena*
+arena_alloc(void)
+{
+	Arena *a;
+
+	a = emalloc(sizeof(Arena));
+	a->blocks = NULL;
+	a->pos = a->end = NULL;
+	a->blksz = ARENA_MINSZ;
+	return a;
+}
+
+Arena*
+arena_cur(void)
+{
+	return cur;
+}
+
+/*
+ * Release every block of a at once, all nodes allocated from it become
+ * invalid.
+ */
+void
+arena_free(Arena *a)
+{
+	struct block *blk, *next;
+
+	if(a == NULL)
+		return;
+	for(blk = a->blocks; blk != NULL; blk = next) {
+		next = blk->next;
+		free(blk);
+	}
+	if(cur == a)
+		cur = NULL;
+	free(a);
+}
+
+/*
+ * Bump-allocate size bytes from a
+ */
+void*
+arena_get(Arena *a, size_t size)
+{
+	void *p;
+
+	size = ALIGN(size);
+	if(a->pos == NULL || (size_t)(a->end - a->pos) < size)
+		arena_grow(a, size);
+	p = a->pos;
+	a->pos += size;
+	return p;
+}
+
+/*
+ * Chain a new block big enough for size bytes, blocks grow geometrically
+ * so that huge expressions need only a handful of them.
+ */
+static void
+arena_grow(Arena *a, size_t size)
+{
+	size_t sz;
+	struct block *blk;
+
+	sz = a->blksz;
+	if(sz < size + HDRSZ)
+		sz = size + HDRSZ;
+	blk = emalloc(sz);
+	blk->next = a->blocks;
+	blk->size = sz;
+	a->blocks = blk;
+	a->pos = (char*)blk + HDRSZ;
+	a->end = (char*)blk + sz;
+	if(a->blksz < ARENA_MAXSZ)
+		a->blksz *= 2;
+}
+
+/*
+ * Move every block of b to a and free b, what was allocated from b is
+ * released with a from now on
+ */
+void
+arena_merge(Arena *a, Arena *b)
+{
+	struct block *newest, *tail;
+
+	if(cur == b)
+		cur = NULL;
+	if(b->blocks != NULL && a->blocks == NULL) {
+		a->blocks = b->blocks;
+		a->pos = b->pos;
+		a->end = b->end;
+	} else if(b->blocks != NULL) {
+		/* a keeps allocating from its newest block */
+		for(tail = b->blocks; tail->next != NULL; tail = tail->next)
+			;
+		newest = a->blocks;
+		tail->next = newest->next;
+		newest->next = b->blocks;
+	}
+	free(b);
+}
+
+/*
+ * Return whether p was allocated from a, which may be NULL
+ */
+int
+arena_owns(Arena *a, void *p)
+{
+	struct block *blk;
+
+	if(a == NULL)
+		return 0;
+	for(blk = a->blocks; blk != NULL; blk = blk->next)
+		if((char*)p >= (char*)blk && (char*)p < (char*)blk + blk->size)
+			return 1;
+	return 0;
+}
+
+/*
+ * Release every allocation of a at once, like arena_free, but keep its
+ * newest (and biggest) block for the next ones
+ */
+void
+arena_reset(Arena *a)
+{
+	struct block *blk, *newest, *next;
+
+	if((newest = a->blocks) == NULL)
+		return;
+	for(blk = newest->next; blk != NULL; blk = next) {
+		next = blk->next;
+		free(blk);
+	}
+	newest->next = NULL;
+	a->pos = (char*)newest + HDRSZ;
+}
+
+/*
+ * Make a the arena amalloc allocates from, return the previous one so that
+ * callers can restore it. NULL goes back to the heap.
+ */
+Arena*
+arena_use(Arena *a)
+{
+	Arena *prev;
+
+	prev = cur;
+	cur = a;
+	return prev;
+}
+
+/*
+ * Free memory obtained from amalloc, a no-op while an arena is in use since
+ * the arena releases everything at once.
+ */
+void
+afree(void *p)
+{
+	if(cur == NULL)
+		free(p);
+}
+
+/*
+ * Allocate size bytes from the current arena, or from the heap when no
+ * arena is in use.
+ */
+void*
+amalloc(size_t size)
+{
+	return cur == NULL ? emalloc(size) : arena_get(cur, size);
+}
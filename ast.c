@@ -18,61 +18,132 @@
  *
  */
 
+#include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "dat.h"
 #include "fns.h"
 
-static void 	ast_print_rec(Node*, Symbol*);
-static void 	ast_to_latex_rec(Node*, Symbol*);
-static char*	bit_to_func(uint8_t);
-static char 	bit_to_op(uint8_t);
+/*
+ * Let-bindings: ast_bprint_let names the subtrees that occur more than once,
+ * and while it prints the printers write those as their name anywhere below
+ * the root of the walk. Equal subtrees are found by hash-consing a copy of
+ * the expression first, so it does not matter how the nodes were shared.
+ */
+#define LET_MINSZ 1024
+#define LET_NODES 4 /* smaller subtrees are not worth a name */
+
+struct let {
+	Node *ast;
+	size_t uses; /* parents pointing to ast */
+	size_t size; /* nodes printed for ast, a name counts as one */
+	size_t name; /* ast is printed as t<name>, 0 when it is not bound */
+	Node *shared; /* hash-consed copy of ast, see let_intern */
+};
+
+struct lets {
+	struct let *tab; /* open addressing */
+	size_t size, len;
+};
+
+static size_t	bound(Node*);
 static uint8_t 	func_to_bit(char*);
+static struct let*	let_add(struct lets*, Node*);
+static void	let_count(struct lets*, Node*);
+static struct let*	let_find(struct lets*, Node*);
+static void	let_grow(struct lets*);
+static void	let_init(struct lets*);
+static Node*	let_intern(Node*);
+static void	let_name(Buf*, size_t, int);
+static void	let_order(struct lets*, Node*, Stk*);
 static uint8_t 	op_to_bit(char);
-static Symbol*	symbol_copy(Symbol*);
+static void	push_frame(Stk*, Node*, Symbol*, int);
+static int	unref(Node*);
 
 #define MAX_FUNC_LENGTH 5
 
+/*
+ * Tree walks keep their own stack of frames: stage counts how many children
+ * of node have already been printed.
+ */
+struct frame {
+	Node *node;
+	Node *owned; /* node expanded from an S_DREF, freed once printed */
+	Symbol *previous;
+	int right; /* node is the right operand of previous */
+	int stage;
+};
+
+static __thread struct lets *lets = NULL; /* of the ast_bprint_let running */
+
+/*
+ * New leaf, from the arena in use or from the heap
+ */
 Node*
-ast_alloc(Symbol *sym)
+ast_alloc(Symbol sym)
 {
+	Arena *a;
 	Node *node;
 
-	node = ecalloc(1, sizeof(Node)); /* node->left = node->right = NULL */
+	a = arena_cur();
+	node = a == NULL ? emalloc(sizeof(Node)) : arena_get(a, sizeof(Node));
+	node->left = node->right = NULL;
 	node->sym = sym;
+	node->refs = a == NULL; /* arena nodes are never counted */
 	return node;
 }
 
+/*
+ * Drop a reference to ast, the node and its children are freed when the
+ * last one goes away. Nodes owned by an arena are released together with it.
+ */
 void
 ast_free(Node *ast)
 {
-	if(ast == NULL)
+	Node *left, *right;
+	Stk s;
+
+	if(! unref(ast))
 		return;
-	symbol_free(ast->sym);
-	ast_free(ast->right);
-	ast_free(ast->left);
-	free(ast);
+	stk_init(&s, sizeof(Node*));
+	for(;;) {
+		left = ast->left;
+		right = ast->right;
+#ifdef DEBUG
+		/* counted, so from the heap: walks every block, only in debug builds */
+		assert(! arena_owns(arena_cur(), ast));
+#endif
+		free(ast);
+		if(unref(left)) {
+			if(unref(right))
+				*(Node**)stk_push(&s) = right;
+			ast = left;
+		} else if(unref(right)) {
+			ast = right;
+		} else if(s.len > 0) {
+			ast = *(Node**)stk_pop(&s);
+		} else {
+			break;
+		}
+	}
+	stk_free(&s);
 }
 
 /*
- * Returns a pointer to a heap-allocated deep copy of src
+ * Return a new reference to src, nodes are shared and copied only when
+ * written to (see ast_unshare).
  */
 Node*
 ast_copy(Node *src)
 {
-	Node *dest;
-
-	if(src == NULL)
-		return NULL;
-	dest = ast_alloc(symbol_copy(src->sym));
-
-	dest->left = ast_copy(src->left);
-	dest->right = ast_copy(src->right);
-	return dest;
+	if(src != NULL && src->refs > 0)
+		src->refs++;
+	return src;
 }
 
 /*
@@ -85,7 +156,6 @@ ast_insert(Node *ast, Node *new)
 {
 	if(new == NULL || ast == NULL)
 		return;
-	new->parent = ast;
 	if(ast->right != NULL) {
 		ast->left = new;
 		return;
@@ -94,221 +164,660 @@ ast_insert(Node *ast, Node *new)
 }
 
 void
-ast_print(Node *node)
+ast_bprint(Buf *out, Node *ast)
 {
-	ast_print_rec(node, NULL);
-}
+	int paren;
+	size_t t;
+	Node *node;
+	struct frame *f;
+	Stk s;
 
-static void
-ast_print_rec(Node *node, Symbol *previous)
-{
-	if(node == NULL) return;
+	if(ast == NULL) return;
 
-	switch(node->sym->type) {
-	case S_VAR:
-		printf("%c", node->sym->content.var);
-		return;
-	case S_NUM:
-		if(node->sym->content.num < 0)
-			printf("(");
-		printf("%.2f", node->sym->content.num);
-		if(node->sym->content.num < 0)
-			printf(")");
-		return;
-	case S_FUNC:
-		printf("%s(", bit_to_func(node->sym->content.func));
-		ast_print_rec(node->right, node->sym);
-		printf(")");
-		return;
-	case S_OP:
-		if(previous != NULL && precedence(previous) > precedence(node->sym))
-				printf("(");
+	stk_init(&s, sizeof(struct frame));
+	push_frame(&s, ast, NULL, 0);
+	while((f = stk_top(&s)) != NULL) {
+		node = f->node;
+		if(f->stage == 0 && s.len > 1 && (t = bound(node)) > 0) {
+			let_name(out, t, 0);
+			stk_pop(&s);
+			continue;
+		}
+		if(node->sym.type == S_DREF)
+			f->node = f->owned = node = dwrt_expand(node);
+		paren = paren_needed(f->previous, &node->sym, f->right);
+		switch(node->sym.type) {
+		case S_VAR:
+			buf_puts(out, var_name(node->sym.content.var));
+			break;
+		case S_NUM:
+			if(node->sym.content.num < 0)
+				buf_putc(out, '(');
+			buf_num(out, node->sym.content.num);
+			if(node->sym.content.num < 0)
+				buf_putc(out, ')');
+			break;
+		case S_FUNC:
+			if(f->stage++ == 0) {
+				buf_puts(out, bit_to_func(node->sym.content.func));
+				buf_putc(out, '(');
+				if(node->right != NULL)
+					push_frame(&s, node->right, &node->sym, 1);
+				continue;
+			}
+			buf_putc(out, ')');
+			break;
+		case S_OP:
+			switch(f->stage++) {
+			case 0:
+				if(paren)
+					buf_putc(out, '(');
+				if(node->left != NULL)
+					push_frame(&s, node->left, &node->sym, 0);
+				continue;
+			case 1:
+				buf_putc(out, ' ');
+				buf_putc(out, bit_to_op(node->sym.content.func));
+				buf_putc(out, ' ');
+				if(node->right != NULL)
+					push_frame(&s, node->right, &node->sym, 1);
+				continue;
+			}
+			if(paren)
+				buf_putc(out, ')');
+			break;
+		default:
+			break;
+		}
+		ast_free(f->owned);
+		stk_pop(&s);
+	}
+	stk_free(&s);
+}
 
-		ast_print_rec(node->left, node->sym);
+/*
+ * Print ast to stdout, in large writes that bypass its stdio buffer
+ */
+void
+ast_print(Node *ast)
+{
+	Buf b;
 
-		printf(" %c ", bit_to_op(node->sym->content.func));
+	fflush(stdout);
+	buf_init(&b, STDOUT_FILENO);
+	ast_bprint(&b, ast);
+	buf_flush(&b);
+	buf_free(&b);
+}
 
-		ast_print_rec(node->right, node->sym);
+/*
+ * ast printed to a NUL terminated string, which the caller frees
+ */
+char*
+ast_sprint(Node *ast)
+{
+	Buf b;
 
-		if(previous != NULL && precedence(previous) > precedence(node->sym))
-				printf(")");
-		return;
-	default:
-		return;
-	}
+	buf_init(&b, -1);
+	ast_bprint(&b, ast);
+	buf_putc(&b, '\0');
+	return b.data;
 }
 
 void
-ast_to_latex(Node *ast)
+ast_bprint_latex(Buf *out, Node *ast)
 {
-	ast_to_latex_rec(ast, NULL);
-}
+	int paren;
+	char op, *name;
+	size_t t;
+	Node *node;
+	struct frame *f;
+	Stk s;
 
-static void
-ast_to_latex_rec(Node *ast, Symbol *previous)
-{
 	if(ast == NULL) return;
 
-	switch(ast->sym->type) {
-	case S_VAR:
-		printf("%c", ast->sym->content.var);
-		return;
-	case S_NUM:
-		if(ast->sym->content.num < 0)
-			printf("\\left(");
-		printf("%.2f", ast->sym->content.num);
-		if(ast->sym->content.num < 0)
-			printf("\\right)");
-		return;
-	case S_FUNC:
-		printf("\\%s\\left(", bit_to_func(ast->sym->content.func));
-		ast_to_latex(ast->right);
-		printf("\\right)");
-		return;
-	case S_OP:
-		if(precedence(previous) > precedence(ast->sym))
-				printf("\\left(");
-
-		switch(bit_to_op(ast->sym->content.func)) {
-		case '/':
-			printf("\\frac{");
-			ast_to_latex(ast->left);
-			printf("}{");
-			ast_to_latex(ast->right);
-			printf("}");
+	stk_init(&s, sizeof(struct frame));
+	push_frame(&s, ast, NULL, 0);
+	while((f = stk_top(&s)) != NULL) {
+		node = f->node;
+		if(f->stage == 0 && s.len > 1 && (t = bound(node)) > 0) {
+			let_name(out, t, 1);
+			stk_pop(&s);
+			continue;
+		}
+		if(node->sym.type == S_DREF)
+			f->node = f->owned = node = dwrt_expand(node);
+		paren = paren_needed(f->previous, &node->sym, f->right);
+		switch(node->sym.type) {
+		case S_VAR:
+			name = var_name(node->sym.content.var);
+			if(name[1] != '\0')
+				buf_puts(out, "\\mathit{");
+			buf_puts(out, name);
+			if(name[1] != '\0')
+				buf_putc(out, '}');
 			break;
-		case '^':
-			ast_to_latex(ast->left);
-			printf("^{");
-			ast_to_latex(ast->right);
-			printf("}");
+		case S_NUM:
+			if(node->sym.content.num < 0)
+				buf_puts(out, "\\left(");
+			buf_num(out, node->sym.content.num);
+			if(node->sym.content.num < 0)
+				buf_puts(out, "\\right)");
+			break;
+		case S_FUNC:
+			if(f->stage++ == 0) {
+				buf_putc(out, '\\');
+				buf_puts(out, bit_to_func(node->sym.content.func));
+				buf_puts(out, "\\left(");
+				if(node->right != NULL)
+					push_frame(&s, node->right, NULL, 0);
+				continue;
+			}
+			buf_puts(out, "\\right)");
+			break;
+		case S_OP:
+			/* \frac and ^{} group their operands, except the base */
+			op = bit_to_op(node->sym.content.func);
+			switch(f->stage++) {
+			case 0:
+				if(paren)
+					buf_puts(out, "\\left(");
+				if(op == '/')
+					buf_puts(out, "\\frac{");
+				if(node->left != NULL)
+					push_frame(&s, node->left, op == '/' ? NULL : &node->sym, 0);
+				continue;
+			case 1:
+				if(op == '/')
+					buf_puts(out, "}{");
+				else if(op == '^')
+					buf_puts(out, "^{");
+				else
+					buf_putc(out, op);
+				if(node->right != NULL)
+					push_frame(&s, node->right, op == '/' || op == '^' ? NULL : &node->sym, 1);
+				continue;
+			}
+			if(op == '/' || op == '^')
+				buf_putc(out, '}');
+			if(paren)
+				buf_puts(out, "\\right)");
 			break;
 		default:
-			ast_to_latex(ast->left);
-			printf("%c", bit_to_op(ast->sym->content.func));
-			ast_to_latex(ast->right);
 			break;
 		}
+		ast_free(f->owned);
+		stk_pop(&s);
+	}
+	stk_free(&s);
+}
 
-		if(precedence(previous) > precedence(ast->sym))
-				printf("\\left(");
-		break;
-	default:
-		return;
+void
+ast_to_latex(Node *ast)
+{
+	Buf b;
+
+	fflush(stdout);
+	buf_init(&b, STDOUT_FILENO);
+	ast_bprint_latex(&b, ast);
+	buf_flush(&b);
+	buf_free(&b);
+}
+
+/*
+ * Print ast with every subtree that occurs more than once written out only
+ * once: a binding tN = ... for each of them, ahead of the subtrees using it,
+ * then result = ast.
+ */
+void
+ast_bprint_let(Buf *out, Node *ast, int flags)
+{
+	int latex;
+	size_t i;
+	struct lets l, *prev;
+	Arena *arena;
+	Dag *d, *prevd;
+	Node *n;
+	Stk order;
+
+	if(ast == NULL) return;
+
+	latex = (flags & D_LATEX) != 0;
+	d = dag_alloc();
+	prevd = dag_use(d);
+	arena = arena_use(d->arena);
+	ast = let_intern(ast);
+	arena_use(arena);
+	dag_use(prevd);
+
+	let_init(&l);
+	stk_init(&order, sizeof(Node*));
+	let_count(&l, ast);
+	let_order(&l, ast, &order);
+
+	prev = lets;
+	lets = &l;
+	for(i = 0; i < order.len; i++) {
+		n = ((Node**)order.data)[i];
+		let_name(out, let_find(&l, n)->name, latex);
+		buf_puts(out, latex ? "=" : " = ");
+		if(latex)
+			ast_bprint_latex(out, n);
+		else
+			ast_bprint(out, n);
+		buf_puts(out, latex ? ";\\;" : "; ");
 	}
+	if(latex) {
+		buf_puts(out, "\\mathit{result}=");
+		ast_bprint_latex(out, ast);
+	} else {
+		buf_puts(out, "result = ");
+		ast_bprint(out, ast);
+	}
+	lets = prev;
+
+	stk_free(&order);
+	free(l.tab);
+	dag_free(d);
+}
+
+/*
+ * Copy on write: return a node equal to ast that the caller may modify in
+ * place. That is ast itself when nobody else holds a reference to it,
+ * otherwise a fresh node sharing the children of ast.
+ */
+Node*
+ast_unshare(Node *ast)
+{
+	Node *dest;
+
+	if(ast == NULL || ast->refs == 1)
+		return ast;
+	dest = ast_alloc(ast->sym);
+	dest->left = ast_copy(ast->left);
+	dest->right = ast_copy(ast->right);
+	ast_free(ast);
+	return dest;
 }
 
-static char*
+char*
 bit_to_func(uint8_t bit)
 {
-	size_t i;
-	for(i = 0; i < KNOWN_FUNCS; i++)
-		if(bit == known_funcs[i].bit)
-			return known_funcs[i].func;
-	return "";
+	return bit < KNOWN_FUNCS ? known_funcs[bit].func : "";
 }
 
-static char
+char
 bit_to_op(uint8_t bit)
 {
-	size_t i;
-	for(i = 0; i < KNOWN_OPERATORS; i++)
-		if(bit == known_operators[i].bit)
-			return known_operators[i].op;
-	return '\0';
+	if((bit & 0x0F) != 0 || bit >> 4 >= KNOWN_OPERATORS)
+		return '\0';
+	return known_operators[bit >> 4].op;
 }
 
-Symbol*
+Symbol
 func_alloc(char *func)
 {
-	Symbol *sym;
+	Symbol sym;
 
-	sym = emalloc(sizeof(Symbol));
-	sym->content.func = func_to_bit(func);
-	sym->type = S_FUNC;
+	sym.content.func = func_to_bit(func);
+	sym.type = S_FUNC;
 	return sym;
 }
 
+/*
+ * Name ast is printed as while ast_bprint_let runs, 0 if none
+ */
+static size_t
+bound(Node *ast)
+{
+	struct let *k;
+
+	if(lets == NULL || (ast->left == NULL && ast->right == NULL))
+		return 0;
+	k = let_find(lets, ast);
+	return k == NULL ? 0 : k->name;
+}
+
 static uint8_t
 func_to_bit(char *func)
 {
-	size_t i;
-	for(i = 0; i < KNOWN_FUNCS; i++)
-		if(strcmp(func, known_funcs[i].func) == 0)
-			return known_funcs[i].bit;
-	return 0xFF;
+	int f;
+
+	f = func_lookup(func, strlen(func));
+	return f < 0 ? 0xFF : known_funcs[f].bit;
 }
 
 int
-is_same_var(Symbol *sym, char var)
+is_same_var(Symbol *sym, uint32_t var)
 {
 	if(sym->type != S_VAR)
 		return 0;
 	return sym->content.var == var;
 }
 
-Symbol*
+static struct let*
+let_add(struct lets *l, Node *ast)
+{
+	size_t i;
+
+	if(2 * (l->len + 1) > l->size)
+		let_grow(l);
+	i = (size_t)((uintptr_t)ast >> 3) * 0x9E3779B1UL & (l->size - 1);
+	while(l->tab[i].ast != NULL)
+		i = (i + 1) & (l->size - 1);
+	l->tab[i].ast = ast;
+	l->tab[i].uses = l->tab[i].size = l->tab[i].name = 0;
+	l->tab[i].shared = NULL;
+	l->len++;
+	return &l->tab[i];
+}
+
+/*
+ * Count the parents of every inner node of ast, each node is visited once
+ */
+static void
+let_count(struct lets *l, Node *ast)
+{
+	int i;
+	Node *child[2];
+	struct let *k;
+	Stk s;
+
+	stk_init(&s, sizeof(Node*));
+	let_add(l, ast);
+	*(Node**)stk_push(&s) = ast;
+	while(s.len > 0) {
+		ast = *(Node**)stk_pop(&s);
+		child[0] = ast->left;
+		child[1] = ast->right;
+		for(i = 0; i < 2; i++) {
+			if(child[i] == NULL || (child[i]->left == NULL && child[i]->right == NULL))
+				continue;
+			if((k = let_find(l, child[i])) == NULL) {
+				k = let_add(l, child[i]);
+				*(Node**)stk_push(&s) = child[i];
+			}
+			k->uses++;
+		}
+	}
+	stk_free(&s);
+}
+
+static struct let*
+let_find(struct lets *l, Node *ast)
+{
+	size_t i;
+
+	i = (size_t)((uintptr_t)ast >> 3) * 0x9E3779B1UL & (l->size - 1);
+	for(; l->tab[i].ast != NULL; i = (i + 1) & (l->size - 1))
+		if(l->tab[i].ast == ast)
+			return &l->tab[i];
+	return NULL;
+}
+
+static void
+let_grow(struct lets *l)
+{
+	size_t i, oldsz;
+	struct let *old;
+
+	old = l->tab;
+	oldsz = l->size;
+	l->size *= 2;
+	l->tab = ecalloc(l->size, sizeof(struct let));
+	l->len = 0;
+	for(i = 0; i < oldsz; i++)
+		if(old[i].ast != NULL)
+			*let_add(l, old[i].ast) = old[i];
+	free(old);
+}
+
+static void
+let_init(struct lets *l)
+{
+	l->size = LET_MINSZ;
+	l->len = 0;
+	l->tab = ecalloc(l->size, sizeof(struct let));
+}
+
+/*
+ * Hash-consed copy of ast in the Dag in use, made of equal nodes wherever
+ * ast has equal subtrees. Each node of ast is copied once, however many
+ * parents point to it.
+ */
+static Node*
+let_intern(Node *ast)
+{
+	struct visit {
+		Node *ast;
+		int stage;
+	} *f;
+	Node *copy, *n;
+	struct lets seen;
+	Stk s;
+
+	let_init(&seen);
+	stk_init(&s, sizeof(struct visit));
+	f = stk_push(&s);
+	f->ast = ast;
+	f->stage = 0;
+	while((f = stk_top(&s)) != NULL) {
+		n = f->ast;
+		if(f->stage++ == 0) {
+			if(let_find(&seen, n) != NULL) {
+				stk_pop(&s);
+				continue;
+			}
+			if(n->right != NULL) {
+				f = stk_push(&s);
+				f->ast = n->right;
+				f->stage = 0;
+			}
+			if(n->left != NULL) {
+				f = stk_push(&s);
+				f->ast = n->left;
+				f->stage = 0;
+			}
+			continue;
+		}
+		stk_pop(&s);
+		if(let_find(&seen, n) != NULL) /* pushed twice before it was copied */
+			continue;
+		copy = ast_alloc(n->sym);
+		if(n->left != NULL)
+			copy->left = let_find(&seen, n->left)->shared;
+		if(n->right != NULL)
+			copy->right = let_find(&seen, n->right)->shared;
+		let_add(&seen, n)->shared = hcons(copy);
+	}
+	copy = let_find(&seen, ast)->shared;
+	stk_free(&s);
+	free(seen.tab);
+	return copy;
+}
+
+static void
+let_name(Buf *out, size_t name, int latex)
+{
+	char num[3 * sizeof(unsigned long) + 1];
+
+	sprintf(num, "%lu", (unsigned long)name);
+	buf_putc(out, 't');
+	if(latex)
+		buf_puts(out, "_{");
+	buf_puts(out, num);
+	if(latex)
+		buf_putc(out, '}');
+}
+
+/*
+ * Bind the shared subtrees of ast that are big enough, in post-order so that
+ * order lists every binding after the ones it uses
+ */
+static void
+let_order(struct lets *l, Node *ast, Stk *order)
+{
+	struct visit {
+		Node *ast;
+		int stage;
+	} *f;
+	int i;
+	size_t n;
+	Node *child[2];
+	struct let *c, *k;
+	Stk s;
+
+	n = 0;
+	stk_init(&s, sizeof(struct visit));
+	f = stk_push(&s);
+	f->ast = ast;
+	f->stage = 0;
+	while((f = stk_top(&s)) != NULL) {
+		ast = f->ast;
+		child[0] = ast->left;
+		child[1] = ast->right;
+		if(f->stage++ == 0) {
+			if(let_find(l, ast)->size > 0) { /* reached again */
+				stk_pop(&s);
+				continue;
+			}
+			for(i = 1; i >= 0; i--) {
+				if(child[i] == NULL || (child[i]->left == NULL && child[i]->right == NULL))
+					continue;
+				f = stk_push(&s);
+				f->ast = child[i];
+				f->stage = 0;
+			}
+			continue;
+		}
+		stk_pop(&s);
+		k = let_find(l, ast);
+		k->size = 1;
+		for(i = 0; i < 2; i++) {
+			if(child[i] == NULL)
+				continue;
+			if(child[i]->left == NULL && child[i]->right == NULL)
+				k->size++;
+			else if((c = let_find(l, child[i]))->name > 0)
+				k->size++;
+			else
+				k->size += c->size;
+		}
+		if(k->uses > 1 && k->size >= LET_NODES) {
+			k->name = ++n;
+			*(Node**)stk_push(order) = ast;
+		}
+	}
+	stk_free(&s);
+}
+
+Symbol
 lparen_alloc(void)
 {
-	Symbol *sym;
+	Symbol sym;
 
-	sym = emalloc(sizeof(Symbol));
-	sym->content.func = 0xFF;
-	sym->type = S_LPAREN;
+	sym.content.func = 0xFF;
+	sym.type = S_LPAREN;
 	return sym;
 }
 
-Symbol*
+Symbol
 num_alloc(double num)
 {
-	Symbol *sym;
+	Symbol sym;
 
-	sym = emalloc(sizeof(Symbol));
-	sym->content.num = num;
-	sym->type = S_NUM;
+	sym.content.num = num;
+	sym.type = S_NUM;
 	return sym;
 }
 
-Symbol*
+Symbol
 operator_alloc(char op)
 {
-	Symbol *sym;
+	Symbol sym;
 
-	sym = emalloc(sizeof(Symbol));
-	sym->content.func = op_to_bit(op);
-	sym->type = S_OP;
+	sym.content.func = op_to_bit(op);
+	sym.type = S_OP;
 	return sym;
 }
 
 static uint8_t
 op_to_bit(char op)
 {
-	size_t i;
-	for(i = 0; i < KNOWN_OPERATORS; i++)
-		if(op == known_operators[i].op)
-			return known_operators[i].bit;
-	return 0xFF;
+	switch(op) {
+	case '^':
+		return EXPT;
+	case '/':
+		return FRAC;
+	case '*':
+		return MUL;
+	case '-':
+		return SUB;
+	case '+':
+		return SUM;
+	default:
+		return 0xFF;
+	}
+}
+/*
+ * Whether child needs parentheses as the left or right operand of parent
+ */
+int
+paren_needed(Symbol *parent, Symbol *child, int right)
+{
+	int pp, cp;
+	char op;
+
+	if(parent == NULL || parent->type != S_OP || child->type != S_OP)
+		return 0;
+	pp = precedence(parent);
+	cp = precedence(child);
+	if(pp != cp)
+		return pp > cp;
+	/* a - (b - c), a / (b / c) and ^, which the parsers associate differently */
+	op = bit_to_op(parent->content.func);
+	return op == '^' || (right && (op == '-' || op == '/'));
+}
+
+static void
+push_frame(Stk *s, Node *node, Symbol *previous, int right)
+{
+	struct frame *f;
+
+	f = stk_push(s);
+	f->node = node;
+	f->owned = NULL;
+	f->previous = previous;
+	f->right = right;
+	f->stage = 0;
 }
 
-Symbol*
+Symbol
 rparen_alloc(void)
 {
-	Symbol *sym;
+	Symbol sym;
 
-	sym = emalloc(sizeof(Symbol));
-	sym->content.func = 0xFF;
-	sym->type = S_RPAREN;
+	sym.content.func = 0xFF;
+	sym.type = S_RPAREN;
 	return sym;
 }
 
-Symbol*
-var_alloc(char var)
+/*
+ * Drop one reference to ast, return 1 if it was the last one
+ */
+static int
+unref(Node *ast)
 {
-	Symbol *sym;
+	return ast != NULL && ast->refs > 0 && --ast->refs == 0;
+}
 
-	sym = emalloc(sizeof(Symbol));
-	sym->content.var = var;
-	sym->type = S_VAR;
+Symbol
+var_alloc(uint32_t var)
+{
+	Symbol sym;
+
+	sym.content.var = var;
+	sym.type = S_VAR;
 	return sym;
 }
 
@@ -342,43 +851,6 @@ num_equal(Symbol *sym, double num)
 	return is_num(sym) ? fabs(sym->content.num - num) < 1e-7 : 0;
 }
 
-void
-symbol_free(Symbol *sym)
-{
-	if(sym == NULL)
-		return;
-	free(sym);
-}
-
-static Symbol*
-symbol_copy(Symbol *src)
-{
-	char *func;
-	Symbol *dest;
-
-	if(src == NULL)
-		return NULL;
-
-	dest = NULL;
-	switch(src->type) {
-	case S_FUNC:
-		dest = func_alloc(bit_to_func(src->content.func));
-		break;
-	case S_OP:
-		dest = operator_alloc(bit_to_op(src->content.func));
-		break;
-	case S_VAR:
-		dest = var_alloc(src->content.var);
-		break;
-	case S_NUM:
-		dest = num_alloc(src->content.num);
-		break;
-	default:
-		break;
-	}
-	return dest;
-}
-
 void
 symbol_print(Symbol *sym)
 {
@@ -392,7 +864,7 @@ symbol_print(Symbol *sym)
 		printf("Function: %s\n", bit_to_func(sym->content.func));
 		break;
 	case S_VAR:
-		printf("Variable: %c\n", sym->content.var);
+		printf("Variable: %s\n", var_name(sym->content.var));
 		break;
 	case S_NUM:
 		printf("Number: %f\n", sym->content.num);
@@ -36,7 +36,7 @@ ast_cos(Node *x)
 
 	cos = ast_alloc(func_alloc("cos"));
 	ast_insert(cos, x);
-	return cos;
+	return hcons(cos);
 }
 
 Node*
@@ -49,7 +49,7 @@ ast_cosh(Node *x)
 
 	cosh = ast_alloc(func_alloc("cosh"));
 	ast_insert(cosh, x);
-	return cosh;
+	return hcons(cosh);
 }
 
 Node*
@@ -62,26 +62,30 @@ ast_exp(Node *x)
 
 	exp = ast_alloc(func_alloc("exp"));
 	ast_insert(exp, x);
-	return exp;
+	return hcons(exp);
 }
 
 Node*
 ast_expt(Node *x, Node *y)
 {
 	Node *expt;
-	if(x == NULL || y == NULL)
+	if(x == NULL || y == NULL) {
+		/* the derivative is undefined, drop the defined operand */
+		ast_free(x);
+		ast_free(y);
 		return NULL;
+	}
 
-	if(num_equal(x->sym, 1)
-		|| num_equal(y->sym, 0)) {
+	if(num_equal(&x->sym, 1)
+		|| num_equal(&y->sym, 0)) {
 		ast_free(x);
 		ast_free(y);
 		return ast_alloc(num_alloc(1));
-	} else if(num_equal(y->sym, 1)) {
+	} else if(num_equal(&y->sym, 1)) {
 		ast_free(y);
 		return x;
-	} else if(is_num(x->sym) && is_num(y->sym)) {
-		expt = ast_alloc(num_alloc(pow(x->sym->content.num, y->sym->content.num)));
+	} else if(is_num(&x->sym) && is_num(&y->sym)) {
+		expt = ast_alloc(num_alloc(pow(x->sym.content.num, y->sym.content.num)));
 		ast_free(x);
 		ast_free(y);
 		return expt;
@@ -89,7 +93,7 @@ ast_expt(Node *x, Node *y)
 		expt = ast_alloc(operator_alloc('^'));
 		ast_insert(expt, y);
 		ast_insert(expt, x);
-		return expt;
+		return hcons(expt);
 	}
 }
 
@@ -98,28 +102,36 @@ ast_frac(Node *x, Node *y)
 {
 	Node *ast_frac;
 
-	if(is_num(x->sym) && num_equal(x->sym, 0)) {
+	if(x == NULL || y == NULL) {
+		/* the derivative is undefined, drop the defined operand */
+		ast_free(x);
+		ast_free(y);
+		return NULL;
+	}
+
+	if(is_num(&x->sym) && num_equal(&x->sym, 0)) {
 		ast_free(y);
 		return x;
-	} else if(is_num(y->sym) && num_equal(y->sym, 1)) {
+	} else if(is_num(&y->sym) && num_equal(&y->sym, 1)) {
 		ast_free(y);
 		return x;
-	} else if(is_num(y->sym) && num_equal(y->sym, 0)) {
+	} else if(is_num(&y->sym) && num_equal(&y->sym, 0)) {
 		ast_free(y);
 		ast_free(x);
 		return NULL;
-	} else if(is_num(y->sym) && is_num(x->sym)) {
+	} else if(is_num(&y->sym) && is_num(&x->sym)) {
 		/*
 		 * Error handling when dividing by zero? How do I propagate the error?
 		 */
-		x->sym->content.num /= y->sym->content.num;
+		x = ast_unshare(x);
+		x->sym.content.num /= y->sym.content.num;
 		ast_free(y);
 		return x;
 	} else {
 		ast_frac = ast_alloc(operator_alloc('/'));
 		ast_insert(ast_frac, y);
 		ast_insert(ast_frac, x);
-		return ast_frac;
+		return hcons(ast_frac);
 	}
 }
 
@@ -133,7 +145,7 @@ ast_log(Node *x)
 
 	log = ast_alloc(func_alloc("log"));
 	ast_insert(log, x);
-	return log;
+	return hcons(log);
 }
 
 Node*
@@ -141,30 +153,36 @@ ast_mul(Node *x, Node *y)
 {
 	Node *ast_mul;
 
-	if(x == NULL || y == NULL)
+	if(x == NULL || y == NULL) {
+		/* the derivative is undefined, drop the defined operand */
+		ast_free(x);
+		ast_free(y);
 		return NULL;
+	}
 
-	if(is_num(x->sym) && num_equal(x->sym, 1)) {
+	if(is_num(&x->sym) && num_equal(&x->sym, 1)) {
 		ast_free(x);
 		return y;
-	} else if(is_num(y->sym) && num_equal(y->sym, 1)) {
+	} else if(is_num(&y->sym) && num_equal(&y->sym, 1)) {
 		ast_free(y);
 		return x;
-	} else if(is_num(x->sym) && num_equal(x->sym, 0)) {
+	} else if(is_num(&x->sym) && num_equal(&x->sym, 0)) {
 		ast_free(y);
 		return x;
-	} else if(is_num(y->sym) && num_equal(y->sym, 0)) {
+	} else if(is_num(&y->sym) && num_equal(&y->sym, 0)) {
 		ast_free(x);
 		return y;
-	} else if(is_num(y->sym) && is_num(x->sym)) {
-		x->sym->content.num *= y->sym->content.num;
+	} else if(is_num(&y->sym) && is_num(&x->sym)) {
+		/* x may be shared, fold into a private copy */
+		x = ast_unshare(x);
+		x->sym.content.num *= y->sym.content.num;
 		ast_free(y);
 		return x;
 	} else {
 		ast_mul = ast_alloc(operator_alloc('*'));
 		ast_insert(ast_mul, y);
 		ast_insert(ast_mul, x);
-		return ast_mul;
+		return hcons(ast_mul);
 	}
 }
 
@@ -178,7 +196,7 @@ ast_sin(Node *x)
 
 	sin = ast_alloc(func_alloc("sin"));
 	ast_insert(sin, x);
-	return sin;
+	return hcons(sin);
 }
 
 Node*
@@ -191,7 +209,7 @@ ast_sinh(Node *x)
 
 	sinh = ast_alloc(func_alloc("sinh"));
 	ast_insert(sinh, x);
-	return sinh;
+	return hcons(sinh);
 }
 
 Node*
@@ -199,21 +217,29 @@ ast_sub(Node *x, Node *y)
 {
 	Node *ast_sub;
 
-	if(is_num(x->sym) && num_equal(x->sym, 0)) {
+	if(x == NULL || y == NULL) {
+		/* the derivative is undefined, drop the defined operand */
+		ast_free(x);
+		ast_free(y);
+		return NULL;
+	}
+
+	if(is_num(&x->sym) && num_equal(&x->sym, 0)) {
 		ast_free(x);
 		return ast_mul(ast_alloc(num_alloc(-1)), y);
-	} else if(is_num(y->sym) && num_equal(y->sym, 0)) {
+	} else if(is_num(&y->sym) && num_equal(&y->sym, 0)) {
 		ast_free(y);
 		return x;
-	} else if(is_num(y->sym) && is_num(x->sym)) {
-		x->sym->content.num -= y->sym->content.num;
+	} else if(is_num(&y->sym) && is_num(&x->sym)) {
+		x = ast_unshare(x);
+		x->sym.content.num -= y->sym.content.num;
 		ast_free(y);
 		return x;
 	} else {
 		ast_sub = ast_alloc(operator_alloc('-'));
 		ast_insert(ast_sub, y);
 		ast_insert(ast_sub, x);
-		return ast_sub;
+		return hcons(ast_sub);
 	}
 }
 
@@ -222,21 +248,29 @@ ast_sum(Node *x, Node *y)
 {
 	Node *ast_sum;
 
-	if(is_num(x->sym) && num_equal(x->sym, 0)) {
+	if(x == NULL || y == NULL) {
+		/* the derivative is undefined, drop the defined operand */
+		ast_free(x);
+		ast_free(y);
+		return NULL;
+	}
+
+	if(is_num(&x->sym) && num_equal(&x->sym, 0)) {
 		ast_free(x);
 		return y;
-	} else if(is_num(y->sym) && num_equal(y->sym, 0)) {
+	} else if(is_num(&y->sym) && num_equal(&y->sym, 0)) {
+		ast_free(y);
+		return x;
+	} else if(is_num(&y->sym) && is_num(&x->sym)) {
+		x = ast_unshare(x);
+		x->sym.content.num += y->sym.content.num;
 		ast_free(y);
 		return x;
-	} else if(is_num(y->sym) && is_num(x->sym)) {
-		 x->sym->content.num += y->sym->content.num;
-		 ast_free(y);
-		 return x;
 	} else {
 		ast_sum = ast_alloc(operator_alloc('+'));
 		ast_insert(ast_sum, y);
 		ast_insert(ast_sum, x);
-		return ast_sum;
+		return hcons(ast_sum);
 	}
 }
 
@@ -250,7 +284,7 @@ ast_tan(Node *x)
 
 	tan = ast_alloc(func_alloc("tan"));
 	ast_insert(tan, x);
-	return tan;
+	return hcons(tan);
 }
 
 Node*
@@ -263,5 +297,5 @@ ast_tanh(Node *x)
 
 	tanh = ast_alloc(func_alloc("tanh"));
 	ast_insert(tanh, x);
-	return tanh;
+	return hcons(tanh);
 }
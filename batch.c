@@ -0,0 +1,183 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat.h"
+#include "fns.h"
+
+static int	blank(char*, char*);
+static void	failed(Parser*, int, Buf*);
+static int	undefined(Parser*);
+
+/*
+ * Differentiate every expression of p's input, expressions are separated by
+ * newlines or semicolons, or are binary records with D_BIN_IN. Print one
+ * line (or record) per expression to out, an error record for the malformed
+ * ones. Blank expressions are skipped without any output, so output line n
+ * goes with the n-th non-blank expression. Return the number of errors.
+ */
+int
+batch(Parser *p, Dag *dag, uint32_t var, int flags, Buf *out)
+{
+	int nerr;
+	char *end, *start, *stop;
+	Lexer *l;
+
+	l = p->l;
+	nerr = 0;
+	stop = l->data + l->len;
+	if(flags & D_BIN_IN) {
+		while(l->pos < stop) {
+			p_reset(p);
+			if(derive(p, dag, var, flags, out) < 0) {
+				failed(p, flags, out);
+				nerr++;
+			}
+		}
+		return nerr;
+	}
+	for(start = l->data; start < stop; start = end + 1) {
+		for(end = start; end < stop && *end != '\n' && *end != ';'; end++)
+			;
+		if(blank(start, end))
+			continue;
+		p_reset(p);
+		l_reset(l, start, end);
+		if(derive(p, dag, var, flags, out) < 0) {
+			failed(p, flags, out);
+			nerr++;
+		}
+	}
+	return nerr;
+}
+
+static int
+blank(char *start, char *end)
+{
+	for(; start < end; start++)
+		if(strchr(" \t\r\v\f", *start) == NULL)
+			return 0;
+	return 1;
+}
+
+/*
+ * Print the error of p in place of the derivative
+ */
+static void
+failed(Parser *p, int flags, Buf *out)
+{
+	if(flags & D_BIN_OUT) {
+		bin_error(out, p->err);
+		return;
+	}
+	buf_puts(out, "error: ");
+	buf_puts(out, p->err);
+}
+
+/*
+ * Parse the next expression of p and print its derivative with respect to
+ * var to out. With D_DAG it is differentiated in dag, which is emptied
+ * afterwards, so that repeated subexpressions are differentiated once.
+ */
+int
+derive(Parser *p, Dag *dag, uint32_t var, int flags, Buf *out)
+{
+	Arena *arena;
+	Dag *prev;
+	Node *diff;
+	Tape *tdiff;
+
+	if((flags & D_BIN_IN ? bin_parse(p) : parse(p)) < 0)
+		return -1;
+
+	if(flags & D_STREAM) {
+		if(ast_dwrt_print(out, p->ast, var, flags) < 0)
+			return undefined(p);
+		buf_putc(out, '\n');
+		return 0;
+	}
+
+	if(flags & D_TAPE) {
+		tdiff = tape_dwrt(p->tape, var);
+		if(tdiff->root == TAPE_NIL && p->tape->root != TAPE_NIL) {
+			tape_free(tdiff);
+			return undefined(p);
+		}
+		if(flags & D_BIN_OUT) {
+			diff = tape_to_ast(tdiff);
+			bin_write(out, diff);
+			ast_free(diff);
+		} else if(flags & D_LATEX) {
+			tape_bprint_latex(out, tdiff);
+		} else {
+			tape_bprint(out, tdiff);
+		}
+		if(!(flags & D_BIN_OUT))
+			buf_putc(out, '\n');
+		tape_free(tdiff);
+		return 0;
+	}
+
+	if(flags & D_DAG) {
+		prev = dag_use(dag);
+		arena = arena_use(dag->arena);
+		diff = ast_dwrt(dag_intern(dag, p->ast), var);
+		arena_use(arena);
+		dag_use(prev);
+	} else {
+		/* diff is released with p->ast by the next p_reset */
+		arena = arena_use(p->arena);
+		diff = ast_dwrt(p->ast, var);
+		arena_use(arena);
+	}
+	if(diff == NULL && p->ast != NULL) {
+		if(flags & D_DAG)
+			dag_reset(dag);
+		return undefined(p);
+	}
+	if(flags & D_BIN_OUT)
+		bin_write(out, diff);
+	else if(flags & D_LET)
+		ast_bprint_let(out, diff, flags);
+	else if(flags & D_LATEX)
+		ast_bprint_latex(out, diff);
+	else
+		ast_bprint(out, diff);
+	if(!(flags & D_BIN_OUT))
+		buf_putc(out, '\n');
+	if(flags & D_DAG)
+		dag_reset(dag); /* releases diff too */
+	return 0;
+}
+
+/*
+ * The derivative divides by zero, report it like a parse error
+ */
+static int
+undefined(Parser *p)
+{
+	p->err = ecalloc(strlen(p->l->filename) + 19 + 1, sizeof(char));
+	sprintf(p->err, "%s: division by zero\n", p->l->filename);
+	return -1;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../dat.h"
+#include "../fns.h"
+#include "bench.h"
+
+/*
+ * Write n terms, cycling through the nterms of terms and separated by sep,
+ * to a temporary file, return its name
+ */
+char*
+gen(long n, char **terms, size_t nterms, char *sep)
+{
+	int fd;
+	long i;
+	char *name;
+	FILE *f;
+
+	name = emalloc(sizeof("/tmp/dwrt_bench_XXXXXX"));
+	sprintf(name, "/tmp/dwrt_bench_XXXXXX");
+	if((fd = mkstemp(name)) < 0 || (f = fdopen(fd, "w")) == NULL) {
+		perror("gen");
+		exit(1);
+	}
+	for(i = 0; i < n; i++)
+		fprintf(f, "%s%s", i == 0 ? "" : sep, terms[i % nterms]);
+	fprintf(f, "\n");
+	fclose(f);
+	return name;
+}
+
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
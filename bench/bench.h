@@ -0,0 +1,24 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Helpers shared by the benchmarks */
+
+char*	gen(long, char**, size_t, char*);
+double	now(void);
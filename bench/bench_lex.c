@@ -0,0 +1,289 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Lexer throughput: tokenize a long expression with lex, for every scan
+ * implementation, and with the switch-based lexer lex replaced, kept here
+ * for reference, after checking that both see the same lexemes. The
+ * expression is lexed once as written by dwrt and once padded with long runs
+ * of blanks, the way a pretty-printer would.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../dat.h"
+#include "../fns.h"
+#include "bench.h"
+
+#define NTERMS 2000000
+#define ROUNDS 5
+
+static int	compare(char*);
+static size_t	count(Lexer*, Lexeme (*)(Lexer*));
+static void	report(char*, size_t, size_t, double);
+static void	switch_extend(Lexeme*, Lexer*);
+static char	switch_getc(Lexer*);
+static Lexeme	switch_lex(Lexer*);
+
+static char *terms[] = {"x", "sin(x)", "3.25", "y ^ 2", "cos(x) / 7", "exp(2 * x)",
+	"0.30000000000000004 * x"};
+static char *impls[] = {"lex auto", "lex plain", "lex sse2", "lex avx2"};
+static char *seps[] = {" + ", "                                \n+ "};
+
+/*
+ * Lex filename with both lexers, return the number of lexemes or -1 if they
+ * disagree
+ */
+static int
+compare(char *filename)
+{
+	int n;
+	Lexeme a, b;
+	Lexer *la, *lb;
+
+	la = l_alloc(filename);
+	lb = l_alloc(filename);
+	n = 0;
+	do {
+		a = lex(la);
+		b = switch_lex(lb);
+		if(a.type != b.type || a.len != b.len
+		   || a.lexeme - la->data != b.lexeme - lb->data) {
+			n = -1;
+			break;
+		}
+		n++;
+	} while(a.type != LE_EOF && a.type != LE_ERROR);
+	l_free(la);
+	l_free(lb);
+	return n;
+}
+
+/*
+ * Lex all of l, return the number of lexemes
+ */
+static size_t
+count(Lexer *l, Lexeme (*lexf)(Lexer*))
+{
+	size_t n;
+	Lexeme le;
+
+	l_reset(l, l->data, l->data + l->len);
+	for(n = 0; (le = lexf(l)).type != LE_EOF && le.type != LE_ERROR; n++)
+		;
+	return n;
+}
+
+static void
+report(char *what, size_t bytes, size_t lexemes, double secs)
+{
+	fprintf(stderr, "%-12s %lu lexemes: %8.3fs %6.3f GB/s\n", what,
+		(unsigned long)lexemes, secs, bytes / secs / 1e9);
+}
+
+/* The lexer as it was before the class and transition tables */
+
+static void
+switch_extend(Lexeme *le, Lexer *l)
+{
+	if(le->len++ == 0)
+		le->lexeme = l->pos - 1;
+}
+
+static char
+switch_getc(Lexer *l)
+{
+	return l->pos++ < l->end ? l->pos[-1] : '\0';
+}
+
+static Lexeme
+switch_lex(Lexer *l)
+{
+	char c;
+	Lexeme result;
+
+	result.type = LE_EOF;
+	result.lexeme = l->pos;
+	result.len = 0;
+	while((c = switch_getc(l)) != EOF) {
+		if(isspace(c)) {
+			switch(l->state) {
+			case LS_SYMBOL:
+				l->state = LS_WS;
+				return result;
+			default:
+				continue;
+			}
+		} else if(isalpha(c)) {
+			switch(l->state) {
+			case LS_WS:
+				l->state = LS_SYMBOL;
+				switch_extend(&result, l);
+				result.type = LE_SYMBOL;
+				break;
+			case LS_SYMBOL:
+				switch_extend(&result, l);
+				result.type = LE_SYMBOL;
+				break;
+			default:
+				l->pos--;
+				l->state = LS_WS;
+				return result;
+			}
+		} else if(isdigit(c)) {
+			switch(l->state) {
+			case LS_WS:
+				l->state = LS_NUMBER;
+				switch_extend(&result, l);
+				result.type = LE_NUMBER;
+				break;
+			case LS_NUMBER:
+				switch_extend(&result, l);
+				result.type = LE_NUMBER;
+				break;
+			default:
+				l->pos--;
+				l->state = LS_WS;
+				return result;
+			}
+		} else {
+			switch(c) {
+			case '+':
+			case '-':
+			case '*':
+			case '^':
+			case '/':
+				switch(l->state) {
+				case LS_WS:
+					result.type = LE_OPERATOR;
+					switch_extend(&result, l);
+					return result;
+				default:
+					l->pos--;
+					l->state = LS_WS;
+					return result;
+				}
+				break;
+			case '.':
+				switch(l->state) {
+				case LS_NUMBER:
+					switch_extend(&result, l);
+					break;
+				default:
+					l->state = LS_ERROR;
+					l->err = emalloc(strlen(l->filename) + 43 + 1);
+					sprintf(l->err, "%s: unexpected '.', not in a number literal\n", l->filename);
+					result.type = LE_ERROR;
+					return result;
+				}
+				break;
+			case '(':
+				switch(l->state) {
+				case LS_WS:
+					result.type = LE_LPAREN;
+					switch_extend(&result, l);
+					return result;
+				default:
+					l->pos--;
+					l->state = LS_WS;
+					return result;
+				}
+				break;
+			case ')':
+				switch(l->state) {
+				case LS_WS:
+					result.type = LE_RPAREN;
+					switch_extend(&result, l);
+					return result;
+				default:
+					l->pos--;
+					l->state = LS_WS;
+					return result;
+				}
+				break;
+			case '\0':
+				switch(l->state) {
+				case LS_WS:
+					result.type = LE_EOF;
+					break;
+				default:
+					l->pos--;
+					l->state = LS_WS;
+				}
+				return result;
+			default:
+				l->state = LS_ERROR;
+				l->err = emalloc(strlen(l->filename) + 16 + 1);
+				sprintf(l->err, "%s: %c is garbage\n", l->filename, c);
+				result.type = LE_ERROR;
+				return result;
+			}
+		}
+	}
+	return result;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, impl;
+	long nterms;
+	size_t j, lexemes;
+	double t;
+	char *name;
+	Lexer *l;
+
+	nterms = argc > 1 ? atol(argv[1]) : NTERMS;
+	for(j = 0; j < LEN(seps); j++) {
+		name = gen(nterms, terms, LEN(terms), seps[j]);
+		if(compare(name) < 0) {
+			fprintf(stderr, "bench_lex: lex and switch_lex disagree\n");
+			exit(1);
+		}
+		fprintf(stderr, "%s input:\n", j == 0 ? "plain" : "padded");
+		l = l_alloc(name);
+		for(impl = SCAN_PLAIN; impl <= SCAN_AVX2; impl++) {
+			if(scan_use(impl) != impl)
+				continue;
+			lexemes = 0;
+			t = now();
+			for(i = 0; i < ROUNDS; i++)
+				lexemes += count(l, lex);
+			report(impls[impl], ROUNDS * l->len, lexemes, now() - t);
+		}
+		scan_use(SCAN_AUTO);
+
+		lexemes = 0;
+		t = now();
+		for(i = 0; i < ROUNDS; i++)
+			lexemes += count(l, switch_lex);
+		report("switch lex", ROUNDS * l->len, lexemes, now() - t);
+
+		l_free(l);
+		unlink(name);
+		free(name);
+	}
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Parser microbenchmark: parse the same expression of about a million
+ * lexemes over and over, resetting the parser in between like batch mode
+ * does, and report lexemes per second. The shunting yard on linked list
+ * stacks that parse replaced is kept here for reference and timed the same
+ * way, after checking that both build the same tree. Only the stacks differ.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../dat.h"
+#include "../fns.h"
+#include "bench.h"
+
+#define NTERMS 250000
+#define ROUNDS 10
+
+typedef struct Stack Stack;
+
+struct Stack {
+	Node *data;
+	Stack *next;
+};
+
+static int	compare(Parser*);
+static size_t	count(Lexer*);
+static int	list_parse(Parser*);
+static Node*	list_pop(Stack**);
+static Stack*	list_push(Stack*, Node*);
+static void	list_reduce(Stack**, Stack**);
+static int	list_yard(Parser*);
+static void	report(char*, size_t, double);
+static double	rounds(Parser*, int (*)(Parser*));
+
+static char *terms[] = {"x", "sin(x)", "3.25", "(y ^ 2)", "cos(x) / 7", "exp(2 * x)"};
+
+/*
+ * Whether parse and list_parse give the same tree for p
+ */
+static int
+compare(Parser *p)
+{
+	int same;
+	char *a, *b;
+
+	if(parse(p) < 0)
+		return 0;
+	a = ast_sprint(p->ast);
+	p_reset(p);
+	l_reset(p->l, p->l->data, p->l->data + p->l->len);
+	b = list_parse(p) < 0 ? NULL : ast_sprint(p->ast);
+	same = b != NULL && strcmp(a, b) == 0;
+	free(a);
+	free(b);
+	return same;
+}
+
+/*
+ * Number of lexemes in l
+ */
+static size_t
+count(Lexer *l)
+{
+	size_t n;
+	Lexeme le;
+
+	for(n = 0; (le = lex(l)).type != LE_EOF && le.type != LE_ERROR; n++)
+		;
+	l_reset(l, l->data, l->data + l->len);
+	return n;
+}
+
+/* The parser as it was before the Stk stacks */
+
+static int
+list_parse(Parser *p)
+{
+	int ret;
+	Arena *prev;
+
+	prev = arena_use(p->arena);
+	ret = list_yard(p);
+	arena_use(prev);
+	return ret;
+}
+
+static Node*
+list_pop(Stack **s)
+{
+	Node *data;
+	Stack *old;
+
+	data = NULL;
+	if(*s != NULL) {
+		data = (*s)->data;
+		old = *s;
+		*s = (*s)->next;
+		free(old);
+	}
+	return data;
+}
+
+static Stack*
+list_push(Stack *s, Node *data)
+{
+	Stack *new;
+
+	new = emalloc(sizeof(Stack));
+	new->data = data;
+	new->next = s;
+	return new;
+}
+
+/*
+ * Apply the operator on top of ops to the nodes on top of nodes
+ */
+static void
+list_reduce(Stack **ops, Stack **nodes)
+{
+	Node *tmp;
+
+	tmp = list_pop(ops);
+	ast_insert(tmp, list_pop(nodes));
+	if(! is_function(&tmp->sym))
+		ast_insert(tmp, list_pop(nodes));
+	*nodes = list_push(*nodes, tmp);
+}
+
+/*
+ * Well-formed input only, the nodes are in p->arena and need no freeing
+ */
+static int
+list_yard(Parser *p)
+{
+	int f;
+	Lexeme le;
+	Node *op;
+	Stack *ops, *nodes;
+
+	ops = nodes = NULL;
+	for(le = lex(p->l); le.type != LE_EOF && le.type != LE_ERROR; le = lex(p->l)) {
+		switch(le.type) {
+		case LE_NUMBER:
+			nodes = list_push(nodes, ast_alloc(num_alloc(decimal(le.lexeme, le.len))));
+			break;
+		case LE_OPERATOR:
+			op = ast_alloc(operator_alloc(le.lexeme[0]));
+			while(ops != NULL && ! is_lparen(&ops->data->sym)
+			      && precedence(&ops->data->sym) >= precedence(&op->sym))
+				list_reduce(&ops, &nodes);
+			ops = list_push(ops, op);
+			break;
+		case LE_LPAREN:
+			ops = list_push(ops, ast_alloc(lparen_alloc()));
+			break;
+		case LE_RPAREN:
+			while(ops != NULL && ! is_lparen(&ops->data->sym))
+				list_reduce(&ops, &nodes);
+			list_pop(&ops);
+			if(ops != NULL && is_function(&ops->data->sym))
+				list_reduce(&ops, &nodes);
+			break;
+		case LE_SYMBOL:
+			if((f = func_lookup(le.lexeme, le.len)) >= 0)
+				ops = list_push(ops, ast_alloc(func_alloc(known_funcs[f].func)));
+			else
+				nodes = list_push(nodes, ast_alloc(var_alloc(var_intern(le.lexeme, le.len))));
+			break;
+		default:
+			le.type = LE_ERROR;
+		}
+		if(le.type == LE_ERROR)
+			break;
+	}
+	while(ops != NULL)
+		list_reduce(&ops, &nodes);
+	p->ast = list_pop(&nodes);
+	if(le.type == LE_ERROR || nodes != NULL) {
+		while(nodes != NULL)
+			list_pop(&nodes);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+report(char *what, size_t lexemes, double secs)
+{
+	fprintf(stderr, "%-12s %lu lexemes: %8.3fs %8.1f Mlexemes/s\n", what,
+		(unsigned long)lexemes, secs / ROUNDS, lexemes * ROUNDS / secs / 1e6);
+}
+
+/*
+ * Seconds taken by ROUNDS parses of p with parsef
+ */
+static double
+rounds(Parser *p, int (*parsef)(Parser*))
+{
+	int i;
+	double t;
+
+	t = now();
+	for(i = 0; i < ROUNDS; i++) {
+		p_reset(p);
+		l_reset(p->l, p->l->data, p->l->data + p->l->len);
+		if(parsef(p) < 0) {
+			fprintf(stderr, "bench_parse: %s", p->err != NULL ? p->err : "parse failed\n");
+			exit(1);
+		}
+	}
+	return now() - t;
+}
+
+int
+main(int argc, char *argv[])
+{
+	long n;
+	size_t lexemes;
+	char *name;
+	Parser *p;
+
+	n = argc > 1 ? atol(argv[1]) : NTERMS;
+	name = gen(n, terms, LEN(terms), " + ");
+	p = p_alloc(name);
+	lexemes = count(p->l);
+	if(! compare(p)) {
+		fprintf(stderr, "bench_parse: parse and list_parse disagree\n");
+		exit(1);
+	}
+
+	report("parse", lexemes, rounds(p, parse));
+	report("list parse", lexemes, rounds(p, list_parse));
+
+	p_free(p);
+	unlink(name);
+	free(name);
+	return 0;
+}
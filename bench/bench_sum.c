@@ -0,0 +1,123 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Regression benchmark for huge inputs: parse, differentiate and print a sum
+ * of millions of terms. Every tree walk must survive a left-deep tree as deep
+ * as the number of terms.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../dat.h"
+#include "../fns.h"
+#include "bench.h"
+
+#define NTERMS 2000000
+#define NJOBS 4
+
+static void	report(char*, long, double);
+
+static char *terms[] = {"x", "sin(x)", "3", "y", "cos(x)", "exp(2 * x)"};
+
+static void
+report(char *what, long n, double secs)
+{
+	fprintf(stderr, "%-12s %ld terms: %8.3fs\n", what, n, secs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int jobs;
+	long n;
+	double t;
+	char *name;
+	Arena *arena;
+	Dag *dag, *prev;
+	Node *diff;
+	Parser *p;
+	Tape *tdiff;
+
+	n = argc > 1 ? atol(argv[1]) : NTERMS;
+	jobs = argc > 2 ? atoi(argv[2]) : NJOBS;
+	name = gen(n, terms, LEN(terms), " + ");
+	/* Only timings are interesting */
+	if(freopen("/dev/null", "w", stdout) == NULL) {
+		perror("bench_sum");
+		exit(1);
+	}
+
+	p = p_alloc(name);
+	p->tape = tape_alloc();
+	t = now();
+	if(parse(p) < 0) {
+		fprintf(stderr, "%s", p->err);
+		exit(1);
+	}
+	report("parse", n, now() - t);
+
+	t = now();
+	diff = ast_dwrt(p->ast, 'x');
+	report("dwrt", n, now() - t);
+	t = now();
+	ast_print(diff);
+	report("print", n, now() - t);
+	t = now();
+	ast_free(diff);
+	report("free", n, now() - t);
+
+	t = now();
+	arena = arena_use(p->arena);
+	dwrt_jobs(jobs);
+	diff = ast_dwrt(p->ast, 'x');
+	dwrt_jobs(1);
+	arena_use(arena);
+	report("par dwrt", n, now() - t); /* freed with p */
+
+	t = now();
+	dag = dag_alloc();
+	prev = dag_use(dag);
+	arena = arena_use(dag->arena);
+	diff = ast_dwrt(dag_intern(dag, p->ast), 'x');
+	arena_use(arena);
+	dag_use(prev);
+	report("dag dwrt", n, now() - t);
+	t = now();
+	ast_to_latex(diff);
+	report("dag latex", n, now() - t);
+	dag_free(dag);
+
+	t = now();
+	tdiff = tape_dwrt(p->tape, 'x');
+	report("tape dwrt", n, now() - t);
+	t = now();
+	tape_print(tdiff);
+	report("tape print", n, now() - t);
+	tape_free(tdiff);
+
+	p_free(p);
+	unlink(name);
+	free(name);
+	return 0;
+}
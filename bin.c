@@ -0,0 +1,426 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Binary expressions. A file starts with BIN_MAGIC and holds records:
+ *
+ *	record	= kind, length of the rest (varint), rest
+ *	B_EXPR	= number of variables (varint), names, cells until the end
+ *	name	= length (varint), letters
+ *	B_ERROR	= message
+ *
+ * Cells are in postfix order, every one is an opcode byte and its operand:
+ * B_INT and a zigzag varint for integers, B_REAL and the 8 bytes of the
+ * double (little endian) for other numbers, B_VAR and the index of a name.
+ * B_OP + (operator >> 4) and B_FUNC + function take their operands from the
+ * cells before them. Varints are little endian groups of 7 bits, the high
+ * bit set on all but the last.
+ */
+
+#define EXACT_MAX 9007199254740992.0 /* 2^53, smaller integers are exact doubles */
+#define VARINTSZ 10 /* longest varint of 64 bits */
+#define BVAR_MINSZ 16
+
+enum bin_records {
+	B_EXPR = 0x01,
+	B_ERROR = 0x02
+};
+
+enum bin_opcodes {
+	B_INT = 0x01,
+	B_REAL = 0x02,
+	B_VAR = 0x03,
+	B_OP = 0x10,
+	B_FUNC = 0x20
+};
+
+/* Variables of the record being written, by id */
+struct bvar {
+	uint32_t var; /* 0 when free */
+	uint64_t index;
+};
+
+struct bvars {
+	struct bvar *tab; /* open addressing */
+	size_t size, len;
+	Buf names;
+};
+
+static int	bin_err(Parser*, char*);
+static uint64_t	bvar_index(struct bvars*, uint32_t);
+static void	bvar_grow(struct bvars*);
+static int	cells(Parser*, char*, char*);
+static int	getvarint(char**, char*, uint64_t*);
+static void	putvarint(Buf*, uint64_t);
+static size_t	varintsz(uint64_t);
+
+static int
+bin_err(Parser *p, char *msg)
+{
+	p->err = ecalloc(strlen(p->l->filename) + strlen(msg) + 3 + 1, sizeof(char));
+	sprintf(p->err, "%s: %s\n", p->l->filename, msg);
+	return -1;
+}
+
+/*
+ * Append the record of the error msg to out
+ */
+void
+bin_error(Buf *out, char *msg)
+{
+	buf_putc(out, B_ERROR);
+	putvarint(out, strlen(msg));
+	buf_puts(out, msg);
+}
+
+/*
+ * Skip BIN_MAGIC at the start of p's input, fail if it is something else
+ */
+int
+bin_open(Parser *p)
+{
+	Lexer *l;
+
+	l = p->l;
+	if((size_t)(l->data + l->len - l->pos) < BIN_MAGICSZ
+	   || memcmp(l->pos, BIN_MAGIC, BIN_MAGICSZ) != 0)
+		return bin_err(p, "not a version 1 dwrt binary file");
+	l->pos += BIN_MAGICSZ;
+	return 0;
+}
+
+/*
+ * Read the next record of p's input into p->ast, and p->tape if there is
+ * one, like parse. The input of an error record becomes p->err.
+ */
+int
+bin_parse(Parser *p)
+{
+	int kind, ret;
+	uint64_t len;
+	char *pos, *stop;
+	Arena *prev;
+	Lexer *l;
+
+	l = p->l;
+	pos = l->pos;
+	stop = l->data + l->len;
+	if(pos >= stop)
+		return 0; /* empty, like a blank line */
+	kind = (unsigned char)*pos++;
+	if(getvarint(&pos, stop, &len) < 0 || len > (uint64_t)(stop - pos)) {
+		l->pos = stop;
+		return bin_err(p, "truncated record");
+	}
+	l->pos = pos + len;
+	switch(kind) {
+	case B_EXPR:
+		prev = arena_use(p->arena);
+		ret = cells(p, pos, l->pos);
+		arena_use(prev);
+		return ret;
+	case B_ERROR:
+		p->err = emalloc(len + 1);
+		memcpy(p->err, pos, len);
+		p->err[len] = '\0';
+		return -1;
+	default:
+		return bin_err(p, "unknown record");
+	}
+}
+
+/*
+ * Length of the whole records at the start of the len bytes of data
+ */
+size_t
+bin_records(char *data, size_t len)
+{
+	uint64_t n;
+	char *pos, *rec, *stop;
+
+	stop = data + len;
+	for(rec = pos = data; pos < stop; rec = pos += n) {
+		pos++;
+		if(getvarint(&pos, stop, &n) < 0 || n > (uint64_t)(stop - pos))
+			break;
+	}
+	return rec - data;
+}
+
+/*
+ * Append ast to out as a B_EXPR record
+ */
+void
+bin_write(Buf *out, Node *ast)
+{
+	struct {
+		Node *node;
+		int stage;
+	} *f;
+	double num;
+	int i;
+	uint64_t bits, n;
+	Buf code;
+	struct bvars v;
+	Node *node;
+	Stk s;
+
+	v.size = BVAR_MINSZ;
+	v.len = 0;
+	v.tab = ecalloc(v.size, sizeof(struct bvar));
+	buf_init(&v.names, -1);
+	buf_init(&code, -1);
+	stk_init(&s, sizeof(*f));
+	if(ast != NULL) {
+		f = stk_push(&s);
+		f->node = ast;
+		f->stage = 0;
+	}
+	while((f = stk_top(&s)) != NULL) {
+		node = f->node;
+		if(f->stage++ == 0) {
+			if(node->right != NULL) {
+				f = stk_push(&s);
+				f->node = node->right;
+				f->stage = 0;
+			}
+			if(node->left != NULL) {
+				f = stk_push(&s);
+				f->node = node->left;
+				f->stage = 0;
+			}
+			continue;
+		}
+		stk_pop(&s);
+		switch(node->sym.type) {
+		case S_NUM:
+			num = node->sym.content.num;
+			if(num == floor(num) && fabs(num) <= EXACT_MAX && (num != 0 || 1 / num > 0)) {
+				buf_putc(&code, B_INT);
+				n = num < 0 ? 2 * (uint64_t)-num - 1 : 2 * (uint64_t)num;
+				putvarint(&code, n);
+				break;
+			}
+			buf_putc(&code, B_REAL);
+			memcpy(&bits, &num, sizeof(double));
+			for(i = 0; i < 8; i++)
+				buf_putc(&code, bits >> 8 * i & 0xFF);
+			break;
+		case S_VAR:
+			buf_putc(&code, B_VAR);
+			putvarint(&code, bvar_index(&v, node->sym.content.var));
+			break;
+		case S_OP:
+			buf_putc(&code, B_OP + (node->sym.content.func >> 4));
+			break;
+		case S_FUNC:
+			buf_putc(&code, B_FUNC + node->sym.content.func);
+			break;
+		default:
+			break;
+		}
+	}
+
+	buf_putc(out, B_EXPR);
+	putvarint(out, varintsz(v.len) + v.names.len + code.len);
+	putvarint(out, v.len);
+	buf_write(out, v.names.data, v.names.len);
+	buf_write(out, code.data, code.len);
+
+	stk_free(&s);
+	buf_free(&code);
+	buf_free(&v.names);
+	free(v.tab);
+}
+
+/*
+ * Index of var in the record's table of names, var is added to it the
+ * first time
+ */
+static uint64_t
+bvar_index(struct bvars *v, uint32_t var)
+{
+	size_t i;
+	char *name;
+
+	i = (size_t)var * 0x9E3779B1UL & (v->size - 1);
+	for(; v->tab[i].var != 0; i = (i + 1) & (v->size - 1))
+		if(v->tab[i].var == var)
+			return v->tab[i].index;
+	if(2 * (v->len + 1) > v->size) {
+		bvar_grow(v);
+		return bvar_index(v, var);
+	}
+	name = var_name(var);
+	putvarint(&v->names, strlen(name));
+	buf_puts(&v->names, name);
+	v->tab[i].var = var;
+	v->tab[i].index = v->len;
+	return v->len++;
+}
+
+static void
+bvar_grow(struct bvars *v)
+{
+	size_t i, j, oldsz;
+	struct bvar *old;
+
+	old = v->tab;
+	oldsz = v->size;
+	v->size *= 2;
+	v->tab = ecalloc(v->size, sizeof(struct bvar));
+	for(i = 0; i < oldsz; i++) {
+		if(old[i].var == 0)
+			continue;
+		j = (size_t)old[i].var * 0x9E3779B1UL & (v->size - 1);
+		while(v->tab[j].var != 0)
+			j = (j + 1) & (v->size - 1);
+		v->tab[j] = old[i];
+	}
+	free(old);
+}
+
+/*
+ * Build the expression of the B_EXPR record between pos and end
+ */
+static int
+cells(Parser *p, char *pos, char *end)
+{
+	int i, op;
+	uint32_t *vars;
+	uint64_t bits, len, n, nvars;
+	double num;
+	Node *node;
+	Symbol sym;
+	Stk *s;
+
+	s = &p->nodes;
+	s->len = 0;
+	if(getvarint(&pos, end, &nvars) < 0 || nvars > (uint64_t)(end - pos))
+		return bin_err(p, "malformed record");
+	vars = emalloc((nvars + 1) * sizeof(uint32_t));
+	for(n = 0; n < nvars; n++) {
+		if(getvarint(&pos, end, &len) < 0 || len == 0 || len > (uint64_t)(end - pos))
+			goto err;
+		for(i = 0; (uint64_t)i < len; i++)
+			if(!(pos[i] >= 'a' && pos[i] <= 'z') && !(pos[i] >= 'A' && pos[i] <= 'Z'))
+				goto err;
+		vars[n] = var_intern(pos, len);
+		pos += len;
+	}
+	while(pos < end) {
+		switch(op = (unsigned char)*pos++) {
+		case B_INT:
+			if(getvarint(&pos, end, &n) < 0)
+				goto err;
+			sym = num_alloc(n & 1 ? -(double)(n >> 1) - 1 : (double)(n >> 1));
+			break;
+		case B_REAL:
+			if(end - pos < 8)
+				goto err;
+			for(bits = 0, i = 7; i >= 0; i--)
+				bits = bits << 8 | (unsigned char)pos[i];
+			pos += 8;
+			memcpy(&num, &bits, sizeof(double));
+			sym = num_alloc(num);
+			break;
+		case B_VAR:
+			if(getvarint(&pos, end, &n) < 0 || n >= nvars)
+				goto err;
+			sym = var_alloc(vars[n]);
+			break;
+		default:
+			if(op >= B_OP && op < B_OP + KNOWN_OPERATORS && s->len >= 2)
+				sym = operator_alloc(known_operators[op - B_OP].op);
+			else if(op >= B_FUNC && op < B_FUNC + KNOWN_FUNCS && s->len >= 1)
+				sym = func_alloc(known_funcs[op - B_FUNC].func);
+			else
+				goto err;
+		}
+		node = ast_alloc(sym);
+		if(sym.type == S_OP || sym.type == S_FUNC)
+			node->right = *(Node**)stk_pop(s);
+		if(sym.type == S_OP)
+			node->left = *(Node**)stk_pop(s);
+		*(Node**)stk_push(s) = node;
+		if(p->tape != NULL)
+			tape_push(p->tape, sym, TAPE_NIL, TAPE_NIL);
+	}
+	if(s->len > 1)
+		goto err;
+	p->ast = s->len == 0 ? NULL : *(Node**)stk_pop(s);
+	if(p->tape != NULL)
+		tape_link(p->tape);
+	free(vars);
+	return 0;
+err:
+	s->len = 0;
+	free(vars);
+	return bin_err(p, "malformed record");
+}
+
+/*
+ * Read the varint at *pos, which is left after it
+ */
+static int
+getvarint(char **pos, char *end, uint64_t *v)
+{
+	int shift;
+	unsigned char c;
+	char *s;
+
+	*v = 0;
+	for(s = *pos, shift = 0; s < end && shift < 7 * VARINTSZ; shift += 7) {
+		c = *s++;
+		*v |= (uint64_t)(c & 0x7F) << shift;
+		if((c & 0x80) == 0) {
+			*pos = s;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void
+putvarint(Buf *out, uint64_t v)
+{
+	for(; v >= 0x80; v >>= 7)
+		buf_putc(out, (v & 0x7F) | 0x80);
+	buf_putc(out, v);
+}
+
+static size_t
+varintsz(uint64_t v)
+{
+	size_t n;
+
+	for(n = 1; v >= 0x80; v >>= 7)
+		n++;
+	return n;
+}
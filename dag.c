@@ -0,0 +1,361 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Hash-consing: while a Dag is in use every node built by the ast_nodes.c
+ * constructors goes through hcons, so structurally identical subtrees are
+ * a single shared node. Shared nodes are immutable and owned by the Dag's
+ * arena. ast_dwrt memoizes derivatives per shared node, which keeps time and
+ * memory proportional to the number of distinct subexpressions.
+ */
+
+#define DAG_MINSZ 1024
+
+static int	child_equal(Node*, Node*);
+static size_t	child_hash(Node*);
+static void	dag_grow(Dag*);
+static Node*	dag_find(Dag*, Symbol*, Node*, Node*);
+static void	dag_insert(Dag*, Node*);
+static void	memo_grow(Dag*);
+static size_t	node_hash(Symbol*, Node*, Node*);
+static int	sym_equal(Symbol*, Symbol*);
+static size_t	sym_hash(Symbol*);
+
+/* Dag hcons interns into, per thread like the current arena */
+static __thread Dag *cur = NULL;
+
+static int
+child_equal(Node *a, Node *b)
+{
+	if(a == b)
+		return 1;
+	if(a == NULL || b == NULL)
+		return 0;
+	/* Leaves are not always interned, compare them by value */
+	if(a->left != NULL || a->right != NULL || b->left != NULL || b->right != NULL)
+		return 0;
+	return sym_equal(&a->sym, &b->sym);
+}
+
+static size_t
+child_hash(Node *n)
+{
+	if(n == NULL)
+		return 0;
+	if(n->left == NULL && n->right == NULL)
+		return sym_hash(&n->sym);
+	return (size_t)((uintptr_t)n >> 3) * 0x9E3779B1UL;
+}
+
+Dag*
+dag_alloc(void)
+{
+	Dag *d;
+
+	d = emalloc(sizeof(Dag));
+	d->arena = arena_alloc();
+	d->nodesz = DAG_MINSZ;
+	d->nnodes = 0;
+	d->nodes = ecalloc(d->nodesz, sizeof(Node*));
+	d->memosz = DAG_MINSZ;
+	d->nmemo = 0;
+	d->memo = ecalloc(d->memosz, sizeof(Memo));
+	return d;
+}
+
+Dag*
+dag_cur(void)
+{
+	return cur;
+}
+
+static Node*
+dag_find(Dag *d, Symbol *sym, Node *left, Node *right)
+{
+	size_t i;
+	Node *n;
+
+	i = node_hash(sym, left, right) & (d->nodesz - 1);
+	for(; (n = d->nodes[i]) != NULL; i = (i + 1) & (d->nodesz - 1))
+		if(sym_equal(&n->sym, sym)
+		   && child_equal(n->left, left)
+		   && child_equal(n->right, right))
+			return n;
+	return NULL;
+}
+
+/*
+ * Release every node of d, including the derivatives computed in it
+ */
+void
+dag_free(Dag *d)
+{
+	if(d == NULL)
+		return;
+	if(cur == d)
+		dag_use(NULL);
+	arena_free(d->arena);
+	free(d->nodes);
+	free(d->memo);
+	free(d);
+}
+
+static void
+dag_grow(Dag *d)
+{
+	size_t i, oldsz;
+	Node **old;
+
+	old = d->nodes;
+	oldsz = d->nodesz;
+	d->nodesz *= 2;
+	d->nodes = ecalloc(d->nodesz, sizeof(Node*));
+	d->nnodes = 0;
+	for(i = 0; i < oldsz; i++)
+		if(old[i] != NULL)
+			dag_insert(d, old[i]);
+	free(old);
+}
+
+static void
+dag_insert(Dag *d, Node *n)
+{
+	size_t i;
+
+	if(2 * (d->nnodes + 1) > d->nodesz)
+		dag_grow(d);
+	i = node_hash(&n->sym, n->left, n->right) & (d->nodesz - 1);
+	while(d->nodes[i] != NULL)
+		i = (i + 1) & (d->nodesz - 1);
+	d->nodes[i] = n;
+	d->nnodes++;
+}
+
+/*
+ * Return the shared copy of ast in d, nodes are copied into d's arena the
+ * first time they are seen.
+ */
+Node*
+dag_intern(Dag *d, Node *ast)
+{
+	struct frame {
+		Node *ast;
+		int stage;
+	} *f;
+	Node *left, *right, *n;
+	Stk done, s;
+
+	if(ast == NULL)
+		return NULL;
+	stk_init(&s, sizeof(struct frame));
+	stk_init(&done, sizeof(Node*));
+	f = stk_push(&s);
+	f->ast = ast;
+	f->stage = 0;
+	while((f = stk_top(&s)) != NULL) {
+		ast = f->ast;
+		if(f->stage++ == 0) {
+			if(ast->right != NULL) {
+				f = stk_push(&s);
+				f->ast = ast->right;
+				f->stage = 0;
+			}
+			if(ast->left != NULL) {
+				f = stk_push(&s);
+				f->ast = ast->left;
+				f->stage = 0;
+			}
+			continue;
+		}
+		stk_pop(&s);
+		right = ast->right == NULL ? NULL : *(Node**)stk_pop(&done);
+		left = ast->left == NULL ? NULL : *(Node**)stk_pop(&done);
+		if((n = dag_find(d, &ast->sym, left, right)) == NULL) {
+			n = arena_get(d->arena, sizeof(Node));
+			n->left = left;
+			n->right = right;
+			n->sym = ast->sym;
+			n->refs = 0;
+			dag_insert(d, n);
+		}
+		*(Node**)stk_push(&done) = n;
+	}
+	n = *(Node**)stk_pop(&done);
+	stk_free(&s);
+	stk_free(&done);
+	return n;
+}
+
+/*
+ * Derivative of the shared node ast with respect to var, if it was already
+ * computed
+ */
+Node*
+dag_lookup(Dag *d, Node *ast, uint32_t var)
+{
+	size_t i;
+
+	i = child_hash(ast) ^ var * 0x9E3779B1UL;
+	for(i &= d->memosz - 1; d->memo[i].ast != NULL; i = (i + 1) & (d->memosz - 1))
+		if(d->memo[i].ast == ast && d->memo[i].var == var)
+			return d->memo[i].diff;
+	return NULL;
+}
+
+void
+dag_remember(Dag *d, Node *ast, uint32_t var, Node *diff)
+{
+	size_t i;
+
+	if(ast == NULL || diff == NULL)
+		return;
+	if(2 * (d->nmemo + 1) > d->memosz)
+		memo_grow(d);
+	i = child_hash(ast) ^ var * 0x9E3779B1UL;
+	for(i &= d->memosz - 1; d->memo[i].ast != NULL; i = (i + 1) & (d->memosz - 1))
+		if(d->memo[i].ast == ast && d->memo[i].var == var)
+			break;
+	if(d->memo[i].ast == NULL)
+		d->nmemo++;
+	d->memo[i].ast = ast;
+	d->memo[i].var = var;
+	d->memo[i].diff = diff;
+}
+
+/*
+ * Empty d for the next expression, the nodes and derivatives in it become
+ * invalid
+ */
+void
+dag_reset(Dag *d)
+{
+	arena_reset(d->arena);
+	memset(d->nodes, 0, d->nodesz * sizeof(Node*));
+	d->nnodes = 0;
+	memset(d->memo, 0, d->memosz * sizeof(Memo));
+	d->nmemo = 0;
+}
+
+/*
+ * Make d the Dag hcons and ast_dwrt work in, return the previous one. NULL
+ * goes back to plain trees. The caller also makes d->arena the arena in use
+ * for as long as d is.
+ */
+Dag*
+dag_use(Dag *d)
+{
+	Dag *prev;
+
+	prev = cur;
+	cur = d;
+	return prev;
+}
+
+/*
+ * Replace the freshly built node n with its shared copy when a Dag is in
+ * use. The children of n must already be shared.
+ */
+Node*
+hcons(Node *n)
+{
+	Node *shared;
+
+	if(cur == NULL || n == NULL)
+		return n;
+	assert(arena_cur() == cur->arena); /* or n would outlive dag_reset */
+	if((shared = dag_find(cur, &n->sym, n->left, n->right)) != NULL)
+		return shared; /* n is garbage in cur->arena */
+	dag_insert(cur, n);
+	return n;
+}
+
+static void
+memo_grow(Dag *d)
+{
+	size_t i, oldsz;
+	Memo *old;
+
+	old = d->memo;
+	oldsz = d->memosz;
+	d->memosz *= 2;
+	d->memo = ecalloc(d->memosz, sizeof(Memo));
+	d->nmemo = 0;
+	for(i = 0; i < oldsz; i++)
+		if(old[i].ast != NULL)
+			dag_remember(d, old[i].ast, old[i].var, old[i].diff);
+	free(old);
+}
+
+static size_t
+node_hash(Symbol *sym, Node *left, Node *right)
+{
+	size_t h;
+
+	h = sym_hash(sym);
+	h = h * 31 + child_hash(left);
+	h = h * 31 + child_hash(right);
+	return h ^ (h >> 16);
+}
+
+static int
+sym_equal(Symbol *a, Symbol *b)
+{
+	if(a->type != b->type)
+		return 0;
+	switch(a->type) {
+	case S_NUM:
+		return a->content.num == b->content.num;
+	case S_VAR:
+		return a->content.var == b->content.var;
+	default:
+		return a->content.func == b->content.func;
+	}
+}
+
+static size_t
+sym_hash(Symbol *sym)
+{
+	size_t h, i;
+	double num;
+	unsigned char bytes[sizeof(double)];
+
+	h = (size_t)sym->type * 0x01000193UL;
+	switch(sym->type) {
+	case S_NUM:
+		num = sym->content.num == 0 ? 0 : sym->content.num; /* -0 == 0 */
+		memcpy(bytes, &num, sizeof(double));
+		for(i = 0; i < sizeof(double); i++)
+			h = (h ^ bytes[i]) * 0x01000193UL;
+		return h;
+	case S_VAR:
+		return h ^ sym->content.var;
+	default:
+		return h ^ sym->content.func;
+	}
+}
@@ -19,11 +19,42 @@
  */
 
 #define LEN(x) (sizeof((x)) / sizeof((x)[0]))
+#define NUMSZ 32 /* longest number numfmt writes, and its NUL */
 #define KNOWN_FUNCS 8
 #define KNOWN_OPERATORS 5
+#define BIN_MAGIC "dwrt\001" /* starts binary files, the last byte is the version */
+#define BIN_MAGICSZ 5
+
+/* What derive, batch and pool_batch print */
+enum derive_flags {
+	D_LATEX = 1 << 0, /* LaTeX instead of plain text */
+	D_TAPE = 1 << 1, /* differentiate on a tape instead of a tree */
+	D_PRATT = 1 << 2, /* parse with the Pratt parser */
+	D_STREAM = 1 << 3, /* print the derivative without building it */
+	D_LET = 1 << 4, /* print shared subtrees once, as let-bindings */
+	D_BIN_IN = 1 << 5, /* read binary records instead of text, see bin.c */
+	D_BIN_OUT = 1 << 6, /* write binary records instead of text */
+	D_DAG = 1 << 7 /* differentiate on the Dag instead of a tree */
+};
+
+/* Runs of characters scan skips at once */
+enum scan_runs {
+	SCAN_WS,
+	SCAN_NUMBER, /* digits and dots */
+	SCAN_SYMBOL /* letters */
+};
+
+/* Implementations of scan, see scan_use */
+enum scan_impls {
+	SCAN_AUTO,
+	SCAN_PLAIN,
+	SCAN_SSE2,
+	SCAN_AVX2
+};
 
 enum lex_states {
 	LS_ERROR,
+	LS_EXPONENT, /* digits of a number's exponent */
 	LS_NUMBER,
 	LS_PAREN,
 	LS_SYMBOL,
@@ -41,6 +72,7 @@ enum lexeme_types {
 };
 
 enum symbol_type {
+	S_DREF, /* derivative of left, expanded while printed, see ast_dwrt_print */
 	S_FUNC,
 	S_LPAREN,
 	S_NUM,
@@ -60,6 +92,7 @@ enum funcs {
 	TANH
 };
 
+/* Indexed by enum funcs */
 static struct func_to_bit {
 	char *func;
 	uint8_t bit;
@@ -82,6 +115,7 @@ enum operators {
 	SUM = 0x40
 };
 
+/* Indexed by enum operators >> 4 */
 static struct op_to_bit {
 	char op;
 	uint8_t bit;
@@ -96,45 +130,113 @@ static struct op_to_bit {
 #define IS_FUNC 0x0F;
 #define IS_OP 0xF0;
 
+#define TAPE_NIL ((uint32_t)-1)
+
+typedef struct Arena Arena;
+typedef struct Buf Buf;
+typedef struct Cell Cell;
+typedef struct Dag Dag;
 typedef struct Lexeme Lexeme;
 typedef struct Lexer Lexer;
+typedef struct Memo Memo;
 typedef struct Node Node;
 typedef struct Parser Parser;
+typedef struct Stk Stk;
 typedef struct Symbol Symbol;
+typedef struct Tape Tape;
+
+typedef Node* (*Derivative)(Node*, Node*, Node*);
 
-typedef Node* (*Derivative)(Node*, char);
+struct Arena {
+	size_t blksz; /* size of the next block */
+	char *pos, *end; /* free space left in the current block */
+	void *blocks; /* newest block first, chained through their headers */
+};
+
+/* Output buffer, see buf_flush */
+struct Buf {
+	char *data;
+	size_t len, size;
+	int fd; /* where data goes when full, -1 to keep it in memory */
+	int err; /* a write to fd failed */
+};
+
+struct Dag {
+	Arena *arena; /* owns every shared node, in use with the Dag */
+	Node **nodes; /* hash-consing table, open addressing */
+	size_t nodesz, nnodes;
+	Memo *memo; /* derivatives of shared nodes */
+	size_t memosz, nmemo;
+};
 
 struct Lexer {
-	size_t len; /* data length */
+	size_t len; /* data length, or buffer size while streaming */
 	enum lex_states state; /* where was I? */
 	char *filename, *err;
 	char *data, *pos; /* contents of filename, current position */
+	char *end; /* end of the expression being lexed, or of what was read */
+	FILE *in; /* streamed into data as lexing goes, NULL once exhausted */
+	int mapped; /* data is mapped by mapall */
 };
 
+/* Span of the lexer's data, not NUL terminated */
 struct Lexeme {
 	enum lexeme_types type;
 	size_t len;
 	char *lexeme;
 };
 
+/* Stored inline in Node, so defined first */
+struct Symbol {
+	union {
+		uint8_t func;
+		double num;
+		uint32_t var; /* see var_intern */
+	} content;
+	uint8_t type; /* enum symbol_type */
+};
+
+/* Tape entry, children are indices of earlier cells or TAPE_NIL */
+struct Cell {
+	Symbol sym;
+	uint32_t left, right;
+};
+
+struct Memo {
+	Node *ast, *diff;
+	uint32_t var;
+};
+
 struct Node {
-	Node *parent;
 	Node *left, *right;
-	Symbol *sym;
+	Symbol sym;
+	unsigned int refs; /* 0 when owned by an arena */
+};
+
+struct Stk {
+	char *data;
+	size_t elsz; /* size of one element */
+	size_t len, size;
 };
 
 struct Parser {
 	char *err;
+	Arena *arena; /* owns every node of the parse and its derivative */
 	Lexer *l;
 	Node *ast;
+	Tape *tape; /* if not NULL, parse also emits the expression here */
+	int pratt; /* parse with pratt rather than shunting_yard */
+	int jobs; /* threads parse_split may use */
+	Node *seed; /* left operand the input continues, see parse_split */
+	Stk ops, nodes; /* shunting yard stacks, kept from one parse to the next */
 };
 
-struct Symbol {
-	enum symbol_type type;
-	union {
-		uint8_t func;
-		double num;
-		char var;
-	} content;
+/*
+ * Expression stored in postfix order: every cell comes after its children,
+ * so one forward pass over cells visits children before their parents.
+ */
+struct Tape {
+	Cell *cells;
+	uint32_t len, size;
+	uint32_t root; /* TAPE_NIL when empty */
 };
-
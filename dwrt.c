@@ -18,7 +18,9 @@
  *
  */
 
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -27,73 +29,271 @@
 #include "dat.h"
 #include "fns.h"
 
+/*
+ * Parallel ast_dwrt: split cuts the expression into regions of about
+ * DWRT_GRAIN nodes. The regions are differentiated independently, each one
+ * standing a placeholder node for the derivatives of the regions below it
+ * (its holes). Then the regions are joined bottom-up, overwriting every
+ * placeholder with the derivative it stands for. The simplifications of
+ * ast_nodes.c only look at whether a node is a number, so the result is the
+ * same as ast_dwrt's unless a hole's derivative is a number or undefined: the
+ * region is then differentiated again with the actual derivatives.
+ */
+
+#define DWRT_GRAIN 4096
+
+/*
+ * Streaming ast_dwrt_print: classify first records the nodes whose derivative
+ * is a number or undefined. Any other derivative is an S_DREF placeholder
+ * that the printers expand when they reach it, one level deep with new
+ * placeholders for the children, and free once printed. Like for the holes
+ * above, the simplifications cannot tell a placeholder from the derivative
+ * it stands for.
+ */
 
-static Node*	ast_dwrt_cos(Node*, char);
-static Node*	ast_dwrt_cosh(Node*, char);
-static Node*	ast_dwrt_exp(Node*, char);
-static Node*	ast_dwrt_expt(Node*, char);
-static Node*	ast_dwrt_frac(Node*, char);
-static Node*	ast_dwrt_func(Node*, char);
-static Node*	ast_dwrt_log(Node*, char);
-static Node*	ast_dwrt_mul(Node*, char);
-static Node*	ast_dwrt_op(Node*, char);
-static Node*	ast_dwrt_sin(Node*, char);
-static Node*	ast_dwrt_sinh(Node*, char);
-static Node*	ast_dwrt_sub(Node*, char);
-static Node*	ast_dwrt_sum(Node*, char);
-static Node*	ast_dwrt_tan(Node*, char);
-static Node*	ast_dwrt_tanh(Node*, char);
-
-/* TODO: Make this a hash map */
-static struct derivative {
-	uint8_t func;
-	Derivative derivative;
-} func_derivatives[] = {
-	{COS, ast_dwrt_cos},
-	{COSH, ast_dwrt_cosh},
-	{EXP, ast_dwrt_exp},
-	{LOG, ast_dwrt_log},
-	{SIN, ast_dwrt_sin},
-	{SINH, ast_dwrt_sinh},
-	{TAN, ast_dwrt_tan},
-	{TANH, ast_dwrt_tanh},
+#define KNOWN_MINSZ 1024
+
+struct region {
+	Node *ast;
+	size_t nsub; /* regions in the subtree of ast, this one included */
+	Node *diff;
+	Node *hole; /* placeholder for diff in the enclosing region */
 };
 
-static struct op_derivative {
-	uint8_t op;
-	Derivative derivative;
-} op_derivatives[] = {
-	{EXPT, ast_dwrt_expt},
-	{SUB, ast_dwrt_sub},
-	{SUM, ast_dwrt_sum},
-	{FRAC, ast_dwrt_frac},
-	{MUL, ast_dwrt_mul},
+struct fork {
+	pthread_mutex_t lock;
+	struct region *regions;
+	size_t nregions, next; /* next region to differentiate */
+	uint32_t var;
+};
+
+/* Input node whose derivative is a number, or undefined */
+struct known {
+	Node *ast;
+	double num;
+	int defined;
+};
+
+struct stream {
+	uint32_t var;
+	struct known *known; /* open addressing */
+	size_t size, len;
+};
+
+struct worker {
+	pthread_t thread;
+	struct fork *fork;
+	Arena *arena; /* where its regions are differentiated */
+};
+
+/*
+ * Every rule gets the node to differentiate and the derivatives of its
+ * children (NULL if the rule does not need them), which it consumes.
+ */
+
+static Node*	ast_dwrt_cos(Node*, Node*, Node*);
+static Node*	ast_dwrt_cosh(Node*, Node*, Node*);
+static Node*	ast_dwrt_exp(Node*, Node*, Node*);
+static Node*	ast_dwrt_expt(Node*, Node*, Node*);
+static Node*	ast_dwrt_frac(Node*, Node*, Node*);
+static Node*	ast_dwrt_func(Node*, Node*, Node*);
+static Node*	ast_dwrt_log(Node*, Node*, Node*);
+static Node*	ast_dwrt_mul(Node*, Node*, Node*);
+static Node*	ast_dwrt_op(Node*, Node*, Node*);
+static Node*	ast_dwrt_sin(Node*, Node*, Node*);
+static Node*	ast_dwrt_sinh(Node*, Node*, Node*);
+static Node*	ast_dwrt_sub(Node*, Node*, Node*);
+static Node*	ast_dwrt_sum(Node*, Node*, Node*);
+static Node*	ast_dwrt_tan(Node*, Node*, Node*);
+static Node*	ast_dwrt_tanh(Node*, Node*, Node*);
+static void	classify(struct stream*, Node*);
+static Node*	dwrt(Node*, Node*, Node*, uint32_t);
+static Node*	expand(struct stream*, Node*);
+static Node*	fork_dwrt(Arena*, struct region*, size_t, uint32_t);
+static void*	fork_work(void*);
+static void	holes(struct region*, size_t, Stk*);
+static void	known_add(struct stream*, Node*, double, int);
+static struct known*	known_find(struct stream*, Node*);
+static void	known_grow(struct stream*);
+static int	needs_dwrt(Node*);
+static Node*	placeholder(struct stream*, Node*);
+static size_t	split(Node*, Stk*);
+static Node*	walk(Node*, uint32_t, Dag*, struct region*, Stk*, int);
+
+/* Threads ast_dwrt may use */
+static int jobs = 1;
+
+/* Expansions dwrt_expand makes, per thread */
+static __thread struct stream *streaming = NULL;
+
+/* Indexed by enum funcs */
+static Derivative func_derivatives[KNOWN_FUNCS] = {
+	ast_dwrt_cos,
+	ast_dwrt_cosh,
+	ast_dwrt_exp,
+	ast_dwrt_log,
+	ast_dwrt_sin,
+	ast_dwrt_sinh,
+	ast_dwrt_tan,
+	ast_dwrt_tanh
+};
+
+/* Indexed by enum operators >> 4 */
+static Derivative op_derivatives[KNOWN_OPERATORS] = {
+	ast_dwrt_expt,
+	ast_dwrt_frac,
+	ast_dwrt_mul,
+	ast_dwrt_sub,
+	ast_dwrt_sum
 };
 
 static Node*
-ast_dwrt_cos(Node *arg, char var)
+ast_dwrt_cos(Node *ast, Node *dl, Node *dr)
 {
-	return ast_mul(ast_dwrt(arg, var),
-	 ast_mul(ast_alloc(num_alloc(-1)), ast_sin(ast_copy(arg))));
+	(void)dl;
+	return ast_mul(dr,
+	 ast_mul(ast_alloc(num_alloc(-1)), ast_sin(ast_copy(ast->right))));
 }
 
 static Node*
-ast_dwrt_cosh(Node *arg, char var)
+ast_dwrt_cosh(Node *ast, Node *dl, Node *dr)
 {
-	return ast_mul(ast_dwrt(arg, var), ast_sinh(ast_copy(arg)));
+	(void)dl;
+	return ast_mul(dr, ast_sinh(ast_copy(ast->right)));
 }
 
 /*
- * TODO: symplify numerical expressions
+ * Differentiate ast with respect to var. Children are differentiated before
+ * their parents using an explicit stack, so that the depth of ast is only
+ * bounded by memory. Inside a Dag the derivative of every shared node is
+ * computed only once. See dwrt_jobs for the parallel version.
  */
 Node*
-ast_dwrt(Node *ast, char var)
+ast_dwrt(Node *ast, uint32_t var)
 {
+	Arena *arena;
+	Node *diff;
+	Stk regions;
+
 	if(ast == NULL)
 		return NULL;
-	switch(ast->sym->type) {
+	if(jobs > 1 && (arena = arena_cur()) != NULL) {
+		stk_init(&regions, sizeof(struct region));
+		if(split(ast, &regions) > 1) {
+			diff = fork_dwrt(arena, (struct region*)regions.data, regions.len, var);
+			stk_free(&regions);
+			return diff;
+		}
+		stk_free(&regions);
+	}
+	return walk(ast, var, dag_cur(), NULL, NULL, 0);
+}
+
+/*
+ * Print the derivative of ast with respect to var to out, as LaTeX if flags
+ * has D_LATEX, without building it: only the parts being printed exist at
+ * any time. The text is the same as ast_dwrt's. Return -1 if the derivative
+ * is undefined. ast must be a tree, shared nodes would be classified again
+ * for each of their parents.
+ */
+int
+ast_dwrt_print(Buf *out, Node *ast, uint32_t var, int flags)
+{
+	int ret;
+	Arena *arena;
+	Dag *dag;
+	Node *diff;
+	struct stream st, *prev;
+
+	if(ast == NULL)
+		return 0;
+	st.var = var;
+	st.size = KNOWN_MINSZ;
+	st.len = 0;
+	st.known = ecalloc(st.size, sizeof(struct known));
+	/* Expansions go to the heap, so that they can be freed one by one */
+	dag = dag_use(NULL);
+	arena = arena_use(NULL);
+	prev = streaming;
+	streaming = &st;
+
+	classify(&st, ast);
+	ret = -1;
+	if((diff = placeholder(&st, ast)) != NULL) {
+		if(flags & D_LATEX)
+			ast_bprint_latex(out, diff);
+		else
+			ast_bprint(out, diff);
+		ast_free(diff);
+		ret = 0;
+	}
+
+	streaming = prev;
+	arena_use(arena);
+	dag_use(dag);
+	free(st.known);
+	return ret;
+}
+
+/*
+ * Record the nodes of ast whose derivative is a number or undefined,
+ * children before their parents. Leaves are quick to differentiate again.
+ */
+static void
+classify(struct stream *st, Node *ast)
+{
+	struct frame {
+		Node *ast;
+		int stage;
+	} *f;
+	Node *diff;
+	Stk s;
+
+	stk_init(&s, sizeof(struct frame));
+	f = stk_push(&s);
+	f->ast = ast;
+	f->stage = 0;
+	while((f = stk_top(&s)) != NULL) {
+		ast = f->ast;
+		if(ast->left == NULL && ast->right == NULL) {
+			stk_pop(&s);
+			continue;
+		}
+		if(f->stage++ == 0) {
+			if(needs_dwrt(ast)) {
+				if(ast->right != NULL) {
+					f = stk_push(&s);
+					f->ast = ast->right;
+					f->stage = 0;
+				}
+				if(ast->left != NULL) {
+					f = stk_push(&s);
+					f->ast = ast->left;
+					f->stage = 0;
+				}
+			}
+			continue;
+		}
+		stk_pop(&s);
+		diff = expand(st, ast);
+		if(diff == NULL)
+			known_add(st, ast, 0, 0);
+		else if(is_num(&diff->sym))
+			known_add(st, ast, diff->sym.content.num, 1);
+		ast_free(diff);
+	}
+	stk_free(&s);
+}
+
+/*
+ * TODO: symplify numerical expressions
+ */
+static Node*
+dwrt(Node *ast, Node *dl, Node *dr, uint32_t var)
+{
+	switch(ast->sym.type) {
 	case S_VAR:
-		if(is_same_var(ast->sym, var))
+		if(is_same_var(&ast->sym, var))
 			return ast_alloc(num_alloc(1));
 		else
 			return ast_alloc(num_alloc(0));
@@ -102,172 +302,541 @@ ast_dwrt(Node *ast, char var)
 		return ast_alloc(num_alloc(0));
 		break;
 	case S_OP:
-		return ast_dwrt_op(ast, var);
+		return ast_dwrt_op(ast, dl, dr);
 		break;
 	case S_FUNC:
-		return ast_dwrt_func(ast, var);
+		return ast_dwrt_func(ast, dl, dr);
 	default:
 		break;
 	}
 	return NULL;
 }
 
+/*
+ * Derivative the S_DREF node dref stands for, one level deep, which the
+ * caller frees once printed. Only valid while ast_dwrt_print runs.
+ */
+Node*
+dwrt_expand(Node *dref)
+{
+	Node *diff;
+
+	diff = expand(streaming, dref->left);
+	while(diff->sym.type == S_DREF) {
+		/* The derivative of a child, as is */
+		dref = diff;
+		diff = expand(streaming, dref->left);
+		ast_free(dref);
+	}
+	return diff;
+}
+
+/*
+ * Let ast_dwrt differentiate big expressions with n threads, return the
+ * previous number. Only expressions allocated from an arena qualify, so that
+ * ast_copy never writes to them, and their derivatives are allocated from
+ * the current arena.
+ */
+int
+dwrt_jobs(int n)
+{
+	int prev;
+
+	prev = jobs;
+	jobs = n;
+	return prev;
+}
+
+/*
+ * Differentiate the n regions split found, the last one is the root. The
+ * derivative ends up in into.
+ */
+static Node*
+fork_dwrt(Arena *into, struct region *regions, size_t n, uint32_t var)
+{
+	int i, nthreads;
+	size_t j, k;
+	Arena *saved;
+	Dag *dag;
+	Node *diff;
+	struct fork f;
+	struct worker *w;
+	Stk s;
+
+	nthreads = (size_t)jobs < n ? jobs : (int)n;
+	pthread_mutex_init(&f.lock, NULL);
+	f.regions = regions;
+	f.nregions = n;
+	f.next = 0;
+	f.var = var;
+	w = ecalloc(nthreads, sizeof(struct worker));
+	for(i = 0; i < nthreads; i++) {
+		w[i].fork = &f;
+		w[i].arena = arena_alloc();
+	}
+
+	/* Placeholders must not be hash-consed, work outside of the Dag */
+	dag = dag_use(NULL);
+	for(i = 1; i < nthreads; i++)
+		if((errno = pthread_create(&w[i].thread, NULL, fork_work, &w[i])) != 0)
+			die("pthread_create");
+	fork_work(&w[0]);
+	for(i = 1; i < nthreads; i++)
+		pthread_join(w[i].thread, NULL);
+
+	/* Join bottom-up, holes come before the regions around them */
+	saved = arena_use(w[0].arena);
+	stk_init(&s, sizeof(size_t));
+	for(k = 0; k < n; k++) {
+		holes(regions, k, &s);
+		for(j = 0; j < s.len; j++) {
+			diff = regions[((size_t*)s.data)[j]].diff;
+			if(diff == NULL || is_num(&diff->sym))
+				break;
+		}
+		if(j < s.len) {
+			regions[k].diff = walk(regions[k].ast, var, NULL, regions, &s, 0);
+			continue;
+		}
+		for(j = 0; j < s.len; j++) {
+			diff = regions[((size_t*)s.data)[j]].diff;
+			*regions[((size_t*)s.data)[j]].hole = *diff;
+		}
+	}
+	stk_free(&s);
+	arena_use(saved);
+	dag_use(dag);
+
+	for(i = 0; i < nthreads; i++)
+		arena_merge(into, w[i].arena);
+	free(w);
+	pthread_mutex_destroy(&f.lock);
+	return regions[n - 1].diff;
+}
+
+/*
+ * Differentiate regions until there are none left, placeholders standing
+ * for their holes
+ */
+static void*
+fork_work(void *arg)
+{
+	size_t k;
+	Arena *prev;
+	struct fork *f;
+	struct region *r;
+	Stk s;
+
+	f = ((struct worker*)arg)->fork;
+	prev = arena_use(((struct worker*)arg)->arena);
+	stk_init(&s, sizeof(size_t));
+	for(;;) {
+		pthread_mutex_lock(&f->lock);
+		k = f->next++;
+		pthread_mutex_unlock(&f->lock);
+		if(k >= f->nregions)
+			break;
+		r = &f->regions[k];
+		holes(f->regions, k, &s);
+		r->diff = walk(r->ast, f->var, NULL, f->regions, &s, 1);
+	}
+	stk_free(&s);
+	arena_use(prev);
+	return NULL;
+}
+
+/*
+ * Push the indices of the holes of region k on s, the leftmost one on top
+ */
+static void
+holes(struct region *regions, size_t k, Stk *s)
+{
+	size_t j, lo;
+
+	s->len = 0;
+	lo = k + 1 - regions[k].nsub;
+	for(j = k; j > lo; j -= regions[j - 1].nsub)
+		*(size_t*)stk_push(s) = j - 1;
+}
+
+/*
+ * Derivative of ast with placeholders for those of its children
+ */
 static Node*
-ast_dwrt_exp(Node *arg, char var)
+expand(struct stream *st, Node *ast)
 {
-	return ast_mul(ast_dwrt(arg, var), ast_exp(ast_copy(arg)));
+	Node *dl, *dr;
+
+	dl = dr = NULL;
+	if(needs_dwrt(ast)) {
+		dl = placeholder(st, ast->left);
+		dr = placeholder(st, ast->right);
+		/* Every rule would give NULL back */
+		if((ast->left != NULL && dl == NULL) || (ast->right != NULL && dr == NULL)) {
+			ast_free(dl);
+			ast_free(dr);
+			return NULL;
+		}
+	}
+	return dwrt(ast, dl, dr, st->var);
 }
 
 static Node*
-ast_dwrt_expt(Node *ast, char var)
+ast_dwrt_exp(Node *ast, Node *dl, Node *dr)
 {
-	Node *diff, *expr;
-	if(is_num(ast->right->sym) && is_num(ast->left->sym)) {
+	(void)dl;
+	return ast_mul(dr, ast_exp(ast_copy(ast->right)));
+}
+
+static Node*
+ast_dwrt_expt(Node *ast, Node *dl, Node *dr)
+{
+	Node *expr;
+
+	if(is_num(&ast->right->sym) && is_num(&ast->left->sym)) {
 		/* d/dx n^m = 0 */
 		return ast_alloc(num_alloc(0));
-	} else if(is_num(ast->right->sym)) {
+	} else if(is_num(&ast->right->sym)) {
 		/* d/dx x ^ n = n * x ^ (n - 1) */
 		return ast_mul(ast_copy(ast->right),
-		 ast_expt(ast_copy(ast->left), ast_alloc(num_alloc(ast->right->sym->content.num - 1))));
+		 ast_expt(ast_copy(ast->left), ast_alloc(num_alloc(ast->right->sym.content.num - 1))));
 	} else {
-		/* d/dx x ^ f(x) = d/dx exp(f(x) * log(x)) */
-		/* Workaround not to lose memory */
-		expr = ast_exp(ast_mul(ast_copy(ast->right), ast_log(ast_copy(ast->left))));
-		diff = ast_dwrt(expr, var);
-		ast_free(expr);
-		return diff;
+		/*
+		 * d/dx x ^ f(x) = d/dx exp(f(x) * log(x))
+		 *  = [log(x) * d/dx f(x) + f(x) * (d/dx x) / x] * exp(f(x) * log(x))
+		 */
+		expr = ast_mul(ast_copy(ast->right), ast_log(ast_copy(ast->left)));
+		return ast_mul(ast_sum(ast_mul(ast_log(ast_copy(ast->left)), dr),
+			ast_mul(ast_copy(ast->right),
+			 ast_mul(dl, ast_frac(ast_alloc(num_alloc(1)), ast_copy(ast->left))))),
+		 ast_exp(expr));
 	}
 }
 
 static Node*
-ast_dwrt_frac(Node *ast, char var)
+ast_dwrt_frac(Node *ast, Node *dl, Node *dr)
 {
 	/* d/dx x / y = [(d/dx x) * y - (d/dx y) * x] / y ^ 2 */
-	return ast_frac(ast_sub(ast_mul(ast_copy(ast->right), ast_dwrt(ast->left, var)),
-		  ast_mul(ast_copy(ast->left), ast_dwrt(ast->right, var))),
+	return ast_frac(ast_sub(ast_mul(ast_copy(ast->right), dl),
+		  ast_mul(ast_copy(ast->left), dr)),
 	  ast_expt(ast_copy(ast->right), ast_alloc(num_alloc(2))));
 
 }
 
-/* TODO: Make some kind of table to store function -> derivative association
+/*
  * Differentiate function nodes with respect to var
  */
 static Node*
-ast_dwrt_func(Node *ast, char var)
+ast_dwrt_func(Node *ast, Node *dl, Node *dr)
 {
-	size_t i;
-	Node *arg;
-
-	arg = ast->right;
-
-	for(i = 0; i < LEN(func_derivatives); i++)
-		if(func_derivatives[i].func == ast->sym->content.func)
-			return func_derivatives[i].derivative(arg, var);
-
-	return NULL;
+	if(ast->sym.content.func >= KNOWN_FUNCS) {
+		ast_free(dl);
+		ast_free(dr);
+		return NULL;
+	}
+	return func_derivatives[ast->sym.content.func](ast, dl, dr);
 }
 
 static Node*
-ast_dwrt_log(Node *arg, char var)
+ast_dwrt_log(Node *ast, Node *dl, Node *dr)
 {
-	return ast_mul(ast_dwrt(arg, var),
-	 ast_frac(ast_alloc(num_alloc(1)), ast_copy(arg)));
+	(void)dl;
+	return ast_mul(dr,
+	 ast_frac(ast_alloc(num_alloc(1)), ast_copy(ast->right)));
 }
 
 static Node*
-ast_dwrt_mul(Node *ast, char var)
+ast_dwrt_mul(Node *ast, Node *dl, Node *dr)
 {
 	/* d/dx x * y = (d/dx x) * y + (d/dx y) * x */
-	return ast_sum(ast_mul(ast_copy(ast->right), ast_dwrt(ast->left, var)),
-	 ast_mul(ast_copy(ast->left), ast_dwrt(ast->right, var)));
+	return ast_sum(ast_mul(ast_copy(ast->right), dl),
+	 ast_mul(ast_copy(ast->left), dr));
 }
 
 /*
  * Differentiate operator nodes (+, -, *, /, ^) with respect to var
  */
 static Node*
-ast_dwrt_op(Node *ast, char var)
+ast_dwrt_op(Node *ast, Node *dl, Node *dr)
 {
-	size_t i;
-	Node *diff, *expr;
-
-	for(i = 0; i < LEN(op_derivatives); i++)
-		if(op_derivatives[i].op == ast->sym->content.func)
-			return op_derivatives[i].derivative(ast, var);
-
-	if(ast->sym->content.func == SUM) {
-		/* d/dx x + y = (d/dx x) + (d/dx y) */
-		return ast_sum(ast_dwrt(ast->left, var), ast_dwrt(ast->right, var));;
-	} else if(ast->sym->content.func == SUB) {
-		/* d/dx x - y = (d/dx x) - (d/dx y) */
-		return ast_sub(ast_dwrt(ast->left, var), ast_dwrt(ast->right, var));
-	} else if(ast->sym->content.func == MUL) {
-		/* d/dx x * y = (d/dx x) * y + (d/dx y) * x */
-		return ast_sum(ast_mul(ast_copy(ast->right), ast_dwrt(ast->left, var)),
-		 ast_mul(ast_copy(ast->left), ast_dwrt(ast->right, var)));
-	} else if(ast->sym->content.func == FRAC) {
-		/* d/dx x / y = [(d/dx x) * y - (d/dx y) * x] / y ^ 2 */
-		return ast_frac(ast_sub(ast_mul(ast_copy(ast->right), ast_dwrt(ast->left, var)),
-			  ast_mul(ast_copy(ast->left), ast_dwrt(ast->right, var))),
-		  ast_expt(ast_copy(ast->right), ast_alloc(num_alloc(2))));
-	} else if(ast->sym->content.func == EXPT) {
-		if(is_num(ast->right->sym) && is_num(ast->left->sym)) {
-			/* d/dx n^m = 0 */
-			return ast_alloc(num_alloc(0));
-		} else if(is_num(ast->right->sym)) {
-			/* d/dx x ^ n = n * x ^ (n - 1) */
-			return ast_mul(ast_copy(ast->right),
-		  ast_expt(ast_copy(ast->left), ast_alloc(num_alloc(ast->right->sym->content.num - 1))));
-		} else {
-			/* d/dx x ^ f(x) = d/dx exp(f(x) * log(x)) */
-			/* Workaround not to lose memory */
-			expr = ast_exp(ast_mul(ast_copy(ast->right), ast_log(ast_copy(ast->left))));
-			diff = ast_dwrt(expr, var);
-			ast_free(expr);
-			return diff;
-		}
+	uint8_t op;
+
+	op = ast->sym.content.func;
+	if((op & 0x0F) != 0 || op >> 4 >= KNOWN_OPERATORS) {
+		ast_free(dl);
+		ast_free(dr);
+		return NULL;
 	}
-	return NULL;
+	return op_derivatives[op >> 4](ast, dl, dr);
 }
 
 static Node*
-ast_dwrt_sin(Node *arg, char var)
+ast_dwrt_sin(Node *ast, Node *dl, Node *dr)
 {
-	return ast_mul(ast_dwrt(arg, var), ast_cos(ast_copy(arg)));
+	(void)dl;
+	return ast_mul(dr, ast_cos(ast_copy(ast->right)));
 }
 
 static Node*
-ast_dwrt_sinh(Node *arg, char var)
+ast_dwrt_sinh(Node *ast, Node *dl, Node *dr)
 {
-	return ast_mul(ast_dwrt(arg, var), ast_cosh(ast_copy(arg)));
+	(void)dl;
+	return ast_mul(dr, ast_cosh(ast_copy(ast->right)));
 }
 
 static Node*
-ast_dwrt_sub(Node *ast, char var)
+ast_dwrt_sub(Node *ast, Node *dl, Node *dr)
 {
 	/* d/dx x - y = (d/dx x) - (d/dx y) */
-	return ast_sub(ast_dwrt(ast->left, var), ast_dwrt(ast->right, var));
+	(void)ast;
+	return ast_sub(dl, dr);
 }
 
 static Node*
-ast_dwrt_sum(Node *ast, char var)
+ast_dwrt_sum(Node *ast, Node *dl, Node *dr)
 {
 	/* d/dx x + y = (d/dx x) + (d/dx y) */
-	return ast_sum(ast_dwrt(ast->left, var), ast_dwrt(ast->right, var));
+	(void)ast;
+	return ast_sum(dl, dr);
 }
 
 static Node*
-ast_dwrt_tan(Node *arg, char var)
+ast_dwrt_tan(Node *ast, Node *dl, Node *dr)
 {
-	return ast_mul(ast_dwrt(arg, var),
-		ast_sum(ast_alloc(num_alloc(1)), ast_expt(ast_tan(ast_copy(arg)),
+	(void)dl;
+	return ast_mul(dr,
+		ast_sum(ast_alloc(num_alloc(1)), ast_expt(ast_tan(ast_copy(ast->right)),
 	ast_alloc(num_alloc(2)))));
 }
 
 static Node*
-ast_dwrt_tanh(Node *arg, char var)
+ast_dwrt_tanh(Node *ast, Node *dl, Node *dr)
 {
-	return ast_mul(ast_dwrt(arg, var),
-		ast_sub(ast_expt(ast_tanh(ast_copy(arg)), ast_alloc(num_alloc(2))),
+	(void)dl;
+	return ast_mul(dr,
+		ast_sub(ast_expt(ast_tanh(ast_copy(ast->right)), ast_alloc(num_alloc(2))),
 	  ast_alloc(num_alloc(1))));
 }
+
+static void
+known_add(struct stream *st, Node *ast, double num, int defined)
+{
+	size_t i;
+
+	if(2 * (st->len + 1) > st->size)
+		known_grow(st);
+	i = (size_t)((uintptr_t)ast >> 3) * 0x9E3779B1UL & (st->size - 1);
+	while(st->known[i].ast != NULL)
+		i = (i + 1) & (st->size - 1);
+	st->known[i].ast = ast;
+	st->known[i].num = num;
+	st->known[i].defined = defined;
+	st->len++;
+}
+
+static struct known*
+known_find(struct stream *st, Node *ast)
+{
+	size_t i;
+
+	i = (size_t)((uintptr_t)ast >> 3) * 0x9E3779B1UL & (st->size - 1);
+	for(; st->known[i].ast != NULL; i = (i + 1) & (st->size - 1))
+		if(st->known[i].ast == ast)
+			return &st->known[i];
+	return NULL;
+}
+
+static void
+known_grow(struct stream *st)
+{
+	size_t i, oldsz;
+	struct known *old;
+
+	old = st->known;
+	oldsz = st->size;
+	st->size *= 2;
+	st->known = ecalloc(st->size, sizeof(struct known));
+	st->len = 0;
+	for(i = 0; i < oldsz; i++)
+		if(old[i].ast != NULL)
+			known_add(st, old[i].ast, old[i].num, old[i].defined);
+	free(old);
+}
+
+/*
+ * Whether the rule for ast uses the derivatives of its children, x ^ n does
+ * not.
+ */
+static int
+needs_dwrt(Node *ast)
+{
+	if(ast->sym.type != S_OP || ast->sym.content.func != EXPT)
+		return 1;
+	return ast->right == NULL || ! is_num(&ast->right->sym);
+}
+
+/*
+ * What stands for the derivative of ast in the rule of its parent: the
+ * derivative itself if it is a number or undefined, an S_DREF otherwise
+ */
+static Node*
+placeholder(struct stream *st, Node *ast)
+{
+	struct known *k;
+	Node *dref;
+	Symbol sym;
+
+	if(ast == NULL)
+		return NULL;
+	if(ast->left == NULL && ast->right == NULL)
+		return dwrt(ast, NULL, NULL, st->var);
+	if((k = known_find(st, ast)) != NULL)
+		return k->defined ? ast_alloc(num_alloc(k->num)) : NULL;
+	sym.content.var = 0;
+	sym.type = S_DREF;
+	dref = ast_alloc(sym);
+	dref->left = ast_copy(ast);
+	return dref;
+}
+
+/*
+ * Cut ast into regions of about DWRT_GRAIN nodes, pushed on regions in
+ * post-order. Return how many, 0 if some node of ast is reference counted.
+ * Whether a node starts a region only depends on its subtree, so all the
+ * occurrences of a node shared by a Dag agree on it.
+ */
+static size_t
+split(Node *ast, Stk *regions)
+{
+	struct frame {
+		Node *ast;
+		size_t first; /* regions before those in the subtree */
+		int stage;
+	} *f;
+	size_t rem;
+	struct region *r;
+	Stk s, sizes;
+
+	stk_init(&s, sizeof(struct frame));
+	stk_init(&sizes, sizeof(size_t));
+	f = stk_push(&s);
+	f->ast = ast;
+	f->stage = 0;
+	while((f = stk_top(&s)) != NULL) {
+		ast = f->ast;
+		if(ast->refs > 0) {
+			regions->len = 0;
+			break;
+		}
+		if(f->stage++ == 0) {
+			f->first = regions->len;
+			if(needs_dwrt(ast)) {
+				if(ast->right != NULL) {
+					f = stk_push(&s);
+					f->ast = ast->right;
+					f->stage = 0;
+				}
+				if(ast->left != NULL) {
+					f = stk_push(&s);
+					f->ast = ast->left;
+					f->stage = 0;
+				}
+			}
+			continue;
+		}
+		/* Nodes of the subtree not in a region yet */
+		rem = 1;
+		if(needs_dwrt(ast)) {
+			if(ast->right != NULL)
+				rem += *(size_t*)stk_pop(&sizes);
+			if(ast->left != NULL)
+				rem += *(size_t*)stk_pop(&sizes);
+		}
+		if(rem >= DWRT_GRAIN || s.len == 1) {
+			r = stk_push(regions);
+			r->ast = ast;
+			r->nsub = regions->len - f->first;
+			r->diff = r->hole = NULL;
+			rem = 0;
+		}
+		stk_pop(&s);
+		*(size_t*)stk_push(&sizes) = rem;
+	}
+	stk_free(&s);
+	stk_free(&sizes);
+	return regions->len;
+}
+
+/*
+ * Post-order walk of ast_dwrt. With regions, the walk stops at the holes on
+ * top of s: their derivative is a new placeholder if fill is set, the one
+ * in regions otherwise.
+ */
+static Node*
+walk(Node *ast, uint32_t var, Dag *d, struct region *regions, Stk *holes, int fill)
+{
+	struct frame {
+		Node *ast;
+		int stage;
+	} *f;
+	struct region *r;
+	Node *diff, *dl, *dr;
+	Stk diffs, s;
+
+	stk_init(&s, sizeof(struct frame));
+	stk_init(&diffs, sizeof(Node*));
+	f = stk_push(&s);
+	f->ast = ast;
+	f->stage = 0;
+	while((f = stk_top(&s)) != NULL) {
+		ast = f->ast;
+		if(f->stage == 0) {
+			if(d != NULL && (diff = dag_lookup(d, ast, var)) != NULL) {
+				stk_pop(&s);
+				*(Node**)stk_push(&diffs) = diff;
+				continue;
+			}
+			if(regions != NULL && holes->len > 0
+			   && (r = &regions[*(size_t*)stk_top(holes)])->ast == ast) {
+				stk_pop(holes);
+				if(fill)
+					r->hole = ast_alloc(var_alloc('\0'));
+				stk_pop(&s);
+				*(Node**)stk_push(&diffs) = fill ? r->hole : r->diff;
+				continue;
+			}
+			f->stage = 1;
+			if(needs_dwrt(ast)) {
+				/* Left first, its derivative ends up below the right one */
+				if(ast->right != NULL) {
+					f = stk_push(&s);
+					f->ast = ast->right;
+					f->stage = 0;
+				}
+				if(ast->left != NULL) {
+					f = stk_push(&s);
+					f->ast = ast->left;
+					f->stage = 0;
+				}
+			}
+			continue;
+		}
+
+		dl = dr = NULL;
+		if(needs_dwrt(ast)) {
+			if(ast->right != NULL)
+				dr = *(Node**)stk_pop(&diffs);
+			if(ast->left != NULL)
+				dl = *(Node**)stk_pop(&diffs);
+		}
+		diff = dwrt(ast, dl, dr, var);
+		if(d != NULL)
+			dag_remember(d, ast, var, diff);
+		stk_pop(&s);
+		*(Node**)stk_push(&diffs) = diff;
+	}
+	diff = *(Node**)stk_pop(&diffs);
+	stk_free(&s);
+	stk_free(&diffs);
+	return diff;
+}
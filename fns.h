@@ -18,11 +18,25 @@
  *
  */
 
-Node*	ast_alloc(Symbol*);
+void	afree(void*);
+void*	amalloc(size_t);
+Arena*	arena_alloc(void);
+Arena*	arena_cur(void);
+void	arena_free(Arena*);
+void*	arena_get(Arena*, size_t);
+void	arena_merge(Arena*, Arena*);
+int	arena_owns(Arena*, void*);
+void	arena_reset(Arena*);
+Arena*	arena_use(Arena*);
+Node*	ast_alloc(Symbol);
+void	ast_bprint(Buf*, Node*);
+void	ast_bprint_latex(Buf*, Node*);
+void	ast_bprint_let(Buf*, Node*, int);
 Node*	ast_copy(Node*);
 Node*	ast_cos(Node*);
 Node*	ast_cosh(Node*);
-Node*	ast_dwrt(Node*, char);
+Node*	ast_dwrt(Node*, uint32_t);
+int	ast_dwrt_print(Buf*, Node*, uint32_t, int);
 Node*	ast_exp(Node*);
 Node*	ast_expt(Node*, Node*);
 Node*	ast_frac(Node*, Node*);
@@ -32,34 +46,101 @@ Node*	ast_mul(Node*, Node*);
 void 	ast_insert(Node*, Node*);
 void	ast_print(Node*);
 Node*	ast_sin(Node*);
+char*	ast_sprint(Node*);
 Node*	ast_sinh(Node*);
 Node*	ast_sub(Node*, Node*);
 Node*	ast_sum(Node*, Node*);
 Node*	ast_tan(Node*);
 Node*	ast_tanh(Node*);
 void	ast_to_latex(Node*);
+Tape*	ast_to_tape(Node*);
+Node*	ast_unshare(Node*);
+int	batch(Parser*, Dag*, uint32_t, int, Buf*);
+void	bin_error(Buf*, char*);
+int	bin_open(Parser*);
+int	bin_parse(Parser*);
+size_t	bin_records(char*, size_t);
+void	bin_write(Buf*, Node*);
+char*	bit_to_func(uint8_t);
+char	bit_to_op(uint8_t);
+int	buf_digits(int);
+int	buf_flush(Buf*);
+void	buf_free(Buf*);
+void	buf_init(Buf*, int);
+void	buf_num(Buf*, double);
+void	buf_putc(Buf*, char);
+void	buf_puts(Buf*, char*);
+void	buf_write(Buf*, char*, size_t);
+Dag*	dag_alloc(void);
+Dag*	dag_cur(void);
+void	dag_free(Dag*);
+Node*	dag_intern(Dag*, Node*);
+Node*	dag_lookup(Dag*, Node*, uint32_t);
+void	dag_remember(Dag*, Node*, uint32_t, Node*);
+void	dag_reset(Dag*);
+Dag*	dag_use(Dag*);
+double	decimal(char*, size_t);
+int	derive(Parser*, Dag*, uint32_t, int, Buf*);
+void	die(char*);
+Node*	dwrt_expand(Node*);
+int	dwrt_jobs(int);
 void*	ecalloc(long, size_t);
 void*	emalloc(size_t);
-Symbol*	func_alloc(char*);
+void*	erealloc(void*, size_t);
+Symbol	func_alloc(char*);
+int	func_lookup(char*, size_t);
+Node*	hcons(Node*);
 int	is_function(Symbol*);
 int	is_lparen(Symbol*);
 int	is_operator(Symbol*);
 int	is_num(Symbol*);
-int	is_same_var(Symbol*, char);
+int	is_same_var(Symbol*, uint32_t);
 Lexer*	l_alloc(char*);
+Lexer*	l_alloc_data(char*, char*, size_t);
+Lexer*	l_alloc_stream(char*);
 void	l_free(Lexer*);
-Lexeme*	lex(Lexer*);
-Symbol*	lparen_alloc(void);
-Symbol*	num_alloc(double);
+int	l_lparen(Lexer*, Lexeme*);
+void	l_reset(Lexer*, char*, char*);
+Lexeme	lex(Lexer*);
+Symbol	lparen_alloc(void);
+char*	mapall(FILE*, size_t*);
+Symbol	num_alloc(double);
 int	num_equal(Symbol*, double);
-Symbol*	operator_alloc(char);
+int	numfmt(char*, double, int);
+Symbol	operator_alloc(char);
 Parser*	p_alloc(char*);
+Parser*	p_alloc_data(char*, char*, size_t);
+Parser*	p_alloc_stream(char*);
 void	p_free(Parser*);
+void	p_reset(Parser*);
+int	paren_needed(Symbol*, Symbol*, int);
 int	parse(Parser*);
+int	parse_split(Parser*);
+int	pool_batch(char*, FILE*, FILE*, int, uint32_t, int);
+int	pratt(Parser*);
 int	precedence(Symbol*);
-char*	readall(FILE*);
-Symbol*	rparen_alloc(void);
-size_t	strappend(char*, char, size_t, size_t);
-void	symbol_free(Symbol*);
+char*	readall(FILE*, size_t*);
+char*	scan(char*, char*, int);
+void	scan_once(void);
+int	scan_use(int);
+Symbol	rparen_alloc(void);
+void	stk_free(Stk*);
+void	stk_init(Stk*, size_t);
+void*	stk_pop(Stk*);
+void*	stk_push(Stk*);
+void*	stk_top(Stk*);
+size_t	strappend(char**, char, size_t, size_t);
 void	symbol_print(Symbol*);
-Symbol*	var_alloc(char);
+Tape*	tape_alloc(void);
+void	tape_bprint(Buf*, Tape*);
+void	tape_bprint_latex(Buf*, Tape*);
+Tape*	tape_dwrt(Tape*, uint32_t);
+void	tape_free(Tape*);
+void	tape_link(Tape*);
+void	tape_print(Tape*);
+uint32_t	tape_push(Tape*, Symbol, uint32_t, uint32_t);
+Node*	tape_to_ast(Tape*);
+void	tape_to_latex(Tape*);
+Symbol	var_alloc(uint32_t);
+uint32_t	var_intern(char*, size_t);
+char*	var_name(uint32_t);
@@ -21,31 +21,112 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "dat.h"
 #include "fns.h"
 
+static int	format(char*, int);
 static void	usage(char*);
+static int	valid_var(char*);
+
+/*
+ * Flag the -I or -O format name stands for, -1 if it is unknown
+ */
+static int
+format(char *name, int bin)
+{
+	if(strcmp(name, "bin") == 0)
+		return bin;
+	if(strcmp(name, "text") == 0)
+		return 0;
+	return -1;
+}
 
 static void
 usage(char *arg0)
 {
-	fprintf(stderr, "usage: %s [-l] variable\n", arg0);
+	fprintf(stderr, "usage: %s [-bclmPst] [-d digits] [-I format] [-j jobs]"
+		" [-O format] variable\n", arg0);
+}
+
+/*
+ * Whether name can be written as a variable in an expression
+ */
+static int
+valid_var(char *name)
+{
+	char *c;
+
+	if(*name == '\0' || func_lookup(name, strlen(name)) >= 0)
+		return 0;
+	for(c = name; *c != '\0'; c++)
+		if(!(*c >= 'a' && *c <= 'z') && !(*c >= 'A' && *c <= 'Z'))
+			return 0;
+	return 1;
 }
 
 int
 main(int argc, char *argv[])
 {
-	int lflag, opt;
+	int bflag, digits, flags, infmt, jobs, opt, outfmt, ret;
+	uint32_t var;
+	char *end;
+	Buf out;
+	Dag *dag;
 	Parser *p;
-	Node *diff;
 
-	opterr = lflag = 0;
-	while((opt = getopt(argc, argv, "l")) != -1) {
+	opterr = bflag = digits = flags = infmt = outfmt = 0;
+	jobs = 1;
+	while((opt = getopt(argc, argv, "bcd:I:j:lmO:Pst")) != -1) {
 		switch(opt) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'c':
+			flags |= D_LET;
+			break;
+		case 'd':
+			digits = strtol(optarg, &end, 10);
+			if(*end != '\0' || digits < 1 || digits > 17) {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'I':
+			if((infmt = format(optarg, D_BIN_IN)) < 0) {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 10);
+			if(*end != '\0' || jobs < 1) {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
 		case 'l':
-			lflag = 1;
+			flags |= D_LATEX;
+			break;
+		case 'm':
+			flags |= D_DAG;
+			break;
+		case 'O':
+			if((outfmt = format(optarg, D_BIN_OUT)) < 0) {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'P':
+			flags |= D_PRATT;
+			break;
+		case 's':
+			flags |= D_STREAM;
+			break;
+		case 't':
+			flags |= D_TAPE;
 			break;
 		default:
 			usage(argv[0]);
@@ -53,30 +134,54 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if(argc < (lflag ? 3 : 2)) {
+	flags |= infmt | outfmt;
+	if(optind >= argc || !valid_var(argv[optind])
+	   || ((flags & D_STREAM) && (flags & D_TAPE))
+	   || ((flags & (D_DAG | D_LET)) && (flags & (D_STREAM | D_TAPE)))
+	   || ((flags & D_BIN_OUT) && (flags & (D_LATEX | D_LET | D_STREAM)))) {
 		usage(argv[0]);
 		exit(1);
 	}
+	var = var_intern(argv[optind], strlen(argv[optind]));
+	buf_digits(digits);
+
+	if(bflag && jobs > 1)
+		return pool_batch(NULL, stdin, stdout, jobs, var, flags) > 0;
 
-	p = p_alloc(NULL);
-	diff = NULL;
+	/* -j parses a single expression in parallel, which needs all of it */
+	p = bflag || jobs > 1 || (flags & D_BIN_IN) ? p_alloc(NULL) : p_alloc_stream(NULL);
+	p->pratt = (flags & D_PRATT) != 0;
+	p->jobs = jobs;
+	if(flags & D_TAPE)
+		p->tape = tape_alloc();
+	dag = dag_alloc();
 
-	if(parse(p) < 0) {
+	ret = 0;
+	buf_init(&out, STDOUT_FILENO);
+	if((flags & D_BIN_IN) && bin_open(p) < 0) {
 		fprintf(stderr, "%s", p->err);
-		p_free(p);
-		exit(1);
+		ret = 1;
+	} else {
+		/* no header without input, the output would not be a record stream */
+		if(flags & D_BIN_OUT)
+			buf_write(&out, BIN_MAGIC, BIN_MAGICSZ);
+		if(bflag) {
+			ret = batch(p, dag, var, flags, &out) > 0;
+		} else {
+			dwrt_jobs(jobs);
+			if(derive(p, dag, var, flags, &out) < 0) {
+				fprintf(stderr, "%s", p->err);
+				ret = 1;
+			}
+		}
 	}
+	if(buf_flush(&out) < 0) {
+		perror("write");
+		ret = 1;
+	}
+	buf_free(&out);
 
-	/* Fix: check there's an argument at the end of parameter list */
-	diff = ast_dwrt(p->ast, argv[optind][0]);
-	if(lflag)
-		ast_to_latex(diff);
-	else
-		ast_print(diff);
-
-	printf("\n");
-	ast_free(diff);
+	dag_free(dag);
 	p_free(p);
-
-	return 0;
+	return ret;
 }
@@ -18,217 +18,437 @@
  *
  */
 
-#include <ctype.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "dat.h"
 #include "fns.h"
 
-#define KNOWN_FUNCS 8
-#define LEXEME_MINSZ 10
+#define FUNC_HASHSZ 32
+#define FUNC_MAXLEN 5
+#define FUNC_MINLEN 3
+#define LEX_BUFSZ (64 * 1024) /* initial buffer of a streaming lexer */
+#define LONGRUN 2 /* characters, see longrun */
+
+/* Character classes of the lexer, anything not in cclass is garbage */
+enum {
+	CGARB,
+	CWS,
+	CALPHA,
+	CEXP, /* letters that may start an exponent */
+	CDIGIT,
+	COP,
+	CDOT,
+	CLPAR,
+	CRPAR,
+	CNUL,
+	NCLASS
+};
 
-enum stack_type {
-	NODE,
-	SYM
+/* What lex does with a character, given its class and the lexer state */
+enum {
+	A_GARBAGE,
+	A_SKIP, /* blank between lexemes */
+	A_SHIFT, /* extend the lexeme and go to next */
+	A_TOKEN, /* single character lexeme */
+	A_BACK, /* the lexeme ended before this character */
+	A_END, /* the lexeme ended with this character */
+	A_STOP, /* end of input */
+	A_EXP, /* exponent of a number, if followed by digits */
+	A_DOT
 };
 
-typedef struct Stack Stack;
-struct Stack {
-	void *data;
-	enum stack_type type;
-	Stack *next;
+struct trans {
+	unsigned char act, next;
 };
 
+static void	extend(Lexeme*, Lexer*);
+static unsigned	func_hash(char*, size_t);
 static char	l_getc(Lexer*);
-static void*	peek(Stack*);
-static void*	pop(Stack**);
-static Stack*	push(Stack*, void*, enum stack_type);
-static Stack*	stack_alloc(void*, enum stack_type);
-static void	stack_free(Stack*);
-static int	stack_len(Stack*);
+static int	longrun(Lexer*, const struct trans*);
+static void	output(Parser*, Stk*, Node*);
+static Parser*	p_new(Lexer*);
+static Node*	peek(Stk*);
+static Symbol*	peek_sym(Stk*);
+static Node*	pop(Stk*);
+static void	push(Stk*, Node*);
+static int	refill(Lexer*, char**);
+static int	shunting_yard(Parser*);
+static void	stack_clear(Stk*);
+
+/* Class of every character, bytes past ASCII are garbage */
+static const unsigned char cclass[256] = {
+	CNUL, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB,
+	CGARB, CWS, CWS, CWS, CWS, CWS, CGARB, CGARB,
+	CGARB, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB,
+	CGARB, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB,
+	CWS, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB,
+	CLPAR, CRPAR, COP, COP, CGARB, COP, CDOT, COP,
+	CDIGIT, CDIGIT, CDIGIT, CDIGIT, CDIGIT, CDIGIT, CDIGIT, CDIGIT,
+	CDIGIT, CDIGIT, CGARB, CGARB, CGARB, CGARB, CGARB, CGARB,
+	CGARB, CALPHA, CALPHA, CALPHA, CALPHA, CEXP, CALPHA, CALPHA,
+	CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA,
+	CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA,
+	CALPHA, CALPHA, CALPHA, CGARB, CGARB, CGARB, COP, CGARB,
+	CGARB, CALPHA, CALPHA, CALPHA, CALPHA, CEXP, CALPHA, CALPHA,
+	CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA,
+	CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA, CALPHA,
+	CALPHA, CALPHA, CALPHA, CGARB, CGARB, CGARB, CGARB, CGARB
+};
+
+/* Type of the lexeme a character of each class starts */
+static const enum lexeme_types ctoken[NCLASS] = {
+	LE_ERROR, LE_EOF, LE_SYMBOL, LE_SYMBOL, LE_NUMBER, LE_OPERATOR,
+	LE_NUMBER, LE_LPAREN, LE_RPAREN, LE_EOF
+};
+
+/* lex's transitions, indexed by state and class */
+static const struct trans trans[LS_WS + 1][NCLASS] = {
+	{ /* LS_ERROR */
+		{A_GARBAGE, LS_ERROR}, {A_SKIP, LS_ERROR}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_DOT, LS_ERROR}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}
+	},
+	{ /* LS_EXPONENT */
+		{A_GARBAGE, LS_ERROR}, {A_END, LS_WS}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}, {A_SHIFT, LS_EXPONENT}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}
+	},
+	{ /* LS_NUMBER */
+		{A_GARBAGE, LS_ERROR}, {A_END, LS_WS}, {A_BACK, LS_WS},
+		{A_EXP, LS_EXPONENT}, {A_SHIFT, LS_NUMBER}, {A_BACK, LS_WS},
+		{A_SHIFT, LS_NUMBER}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}
+	},
+	{ /* LS_PAREN, unused */
+		{A_GARBAGE, LS_ERROR}, {A_SKIP, LS_PAREN}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_DOT, LS_ERROR}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}
+	},
+	{ /* LS_SYMBOL */
+		{A_GARBAGE, LS_ERROR}, {A_END, LS_WS}, {A_SHIFT, LS_SYMBOL},
+		{A_SHIFT, LS_SYMBOL}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_DOT, LS_ERROR}, {A_BACK, LS_WS}, {A_BACK, LS_WS},
+		{A_BACK, LS_WS}
+	},
+	{ /* LS_WS */
+		{A_GARBAGE, LS_ERROR}, {A_SKIP, LS_WS}, {A_SHIFT, LS_SYMBOL},
+		{A_SHIFT, LS_SYMBOL}, {A_SHIFT, LS_NUMBER}, {A_TOKEN, LS_WS},
+		{A_DOT, LS_ERROR}, {A_TOKEN, LS_WS}, {A_TOKEN, LS_WS},
+		{A_STOP, LS_WS}
+	}
+};
 
+/*
+ * known_funcs index of the function hashing to each slot, -1 for none. The
+ * constants in func_hash also keep sqrt, asin, acos, atan, asinh, acosh,
+ * atanh and erf apart from these, pick new ones if a name collides.
+ */
+static const signed char func_slots[FUNC_HASHSZ] = {
+	EXP, -1, -1, TANH, -1, -1, -1, -1,
+	TAN, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, LOG, -1, -1, COS, -1,
+	-1, -1, SINH, -1, COSH, -1, -1, SIN,
+};
+
+/*
+ * Extend le over the character l_getc just returned
+ */
+static void
+extend(Lexeme *le, Lexer *l)
+{
+	if(le->len++ == 0)
+		le->lexeme = l->pos - 1;
+}
+
+/*
+ * Index in known_funcs of the function named by the len bytes at name, -1
+ * if there is none
+ */
+int
+func_lookup(char *name, size_t len)
+{
+	int f;
+
+	if(len < FUNC_MINLEN || len > FUNC_MAXLEN)
+		return -1;
+	f = func_slots[func_hash(name, len)];
+	if(f < 0 || strncmp(name, known_funcs[f].func, len) != 0
+	   || known_funcs[f].func[len] != '\0')
+		return -1;
+	return f;
+}
+
+/*
+ * Perfect hash of the names in known_funcs, see func_slots. It only looks
+ * at the first, second and last character and the length.
+ */
+static unsigned
+func_hash(char *name, size_t len)
+{
+	unsigned char *u;
+
+	u = (unsigned char*)name;
+	return (u[0] + 3 * u[1] + 17 * u[len - 1] + len) & (FUNC_HASHSZ - 1);
+}
+
+/*
+ * Next character of the current expression, '\0' past its end
+ */
 static char
 l_getc(Lexer *l)
 {
-	return *(l->pos++);
+	return l->pos++ < l->end ? l->pos[-1] : '\0';
+}
+
+/*
+ * Whether the next lexeme of l is a left parenthesis, which makes le, the
+ * name just lexed, a function. le stays valid.
+ */
+int
+l_lparen(Lexer *l, Lexeme *le)
+{
+	size_t i;
+
+	for(i = 0;; i++) {
+		if(l->pos + i == l->end && (l->in == NULL || ! refill(l, &le->lexeme)))
+			return 0;
+		if(cclass[(unsigned char)l->pos[i]] != CWS)
+			return l->pos[i] == '(';
+	}
+}
+
+/*
+ * Whether the next LONGRUN characters of l take transition t as well, so
+ * that the run is worth handing to scan
+ */
+static int
+longrun(Lexer *l, const struct trans *t)
+{
+	int i;
+	const struct trans *u;
+
+	if(l->end - l->pos < LONGRUN)
+		return 0;
+	for(i = 0; i < LONGRUN; i++) {
+		u = &trans[t->next][cclass[(unsigned char)l->pos[i]]];
+		if(u->act != t->act)
+			return 0;
+	}
+	return 1;
 }
 
 void
 l_free(Lexer *lex)
 {
-	free(lex->data);
+	if(lex->mapped)
+		munmap(lex->data, lex->len);
+	else
+		free(lex->data);
+	if(lex->in != NULL && lex->in != stdin)
+		fclose(lex->in);
 	free(lex->err);
 	free(lex);
 }
 
+/*
+ * Allocate a lexer for file filename, or stdin if filename is NULL. Regular
+ * files are mapped rather than copied.
+ */
 Lexer*
 l_alloc(char *filename)
 {
 	FILE *f;
 	Lexer *l;
 
+	if(filename == NULL)
+		f = stdin;
+	else if((f = fopen(filename, "r")) == NULL)
+		return NULL;
+
+	scan_once();
 	l = emalloc(sizeof(Lexer));
+	l->filename = filename == NULL ? "stdin" : filename;
+	l->err = NULL;
+	l->state = LS_WS;
+	l->mapped = (l->data = mapall(f, &l->len)) != NULL;
+	if(! l->mapped)
+		l->data = readall(f, &l->len);
+	l->pos = l->data;
+	l->end = l->data + l->len;
+	l->in = NULL;
 
-	if(filename == NULL) {
-		l->filename = "stdin";
+	if(f != stdin)
+		fclose(f);
 
-		f = stdin;
-	} else {
-		l->filename = filename;
-		if((f = fopen(filename, "r")) == NULL) {
-			free(l);
-			return NULL;
-		}
-	}
+	return l;
+}
 
+/*
+ * Allocate a lexer over the len bytes of data, which the lexer then owns.
+ * data may be NULL for a lexer only fed through l_reset.
+ */
+Lexer*
+l_alloc_data(char *filename, char *data, size_t len)
+{
+	Lexer *l;
+
+	scan_once();
+	l = emalloc(sizeof(Lexer));
+	l->filename = filename;
 	l->err = NULL;
 	l->state = LS_WS;
-	l->pos = l->data = readall(f);
+	l->pos = l->data = data;
+	l->len = len;
+	l->end = data + len;
+	l->in = NULL;
+	l->mapped = 0;
+	return l;
+}
 
-	if(filename == NULL) fclose(f);
+/*
+ * Like l_alloc, but unless filename can be mapped read it a buffer at a time
+ * while lexing, so that a single huge expression needs bounded memory and
+ * can be lexed as it is written
+ */
+Lexer*
+l_alloc_stream(char *filename)
+{
+	FILE *f;
+	Lexer *l;
+
+	if(filename == NULL)
+		f = stdin;
+	else if((f = fopen(filename, "r")) == NULL)
+		return NULL;
 
+	scan_once();
+	l = emalloc(sizeof(Lexer));
+	l->filename = filename == NULL ? "stdin" : filename;
+	l->err = NULL;
+	l->state = LS_WS;
+	l->in = NULL;
+	if((l->mapped = (l->data = mapall(f, &l->len)) != NULL)) {
+		l->end = l->data + l->len;
+		if(f != stdin)
+			fclose(f);
+	} else {
+		l->len = LEX_BUFSZ;
+		l->data = l->end = emalloc(l->len);
+		l->in = f;
+	}
+	l->pos = l->data;
 	return l;
 }
 
-Lexeme*
+/*
+ * Lex the expression between start and end, both pointing into l->data
+ */
+void
+l_reset(Lexer *l, char *start, char *end)
+{
+	l->pos = start;
+	l->end = end;
+	l->state = LS_WS;
+	free(l->err);
+	l->err = NULL;
+}
+
+/*
+ * Return the next lexeme of l, a span of l->data that is only valid as long
+ * as l->data is, or until the next call when streaming
+ */
+Lexeme
 lex(Lexer *l)
 {
-	char c;
-	size_t offset;
-	Lexeme *result;
-
-	result = emalloc(sizeof(Lexeme));
-	result->len = LEXEME_MINSZ;
-	result->lexeme = ecalloc(result->len, sizeof(char));
-	result->type = LE_EOF;
-	offset = 0;
-	while((c = l_getc(l)) != EOF) {
-		if(isspace(c)) {
-			switch(l->state) {
-			case LS_SYMBOL:
-				l->state = LS_WS;
-				return result;
-			default:
-				continue;
+	char c, *run;
+	const struct trans *t;
+	Lexeme result;
+
+	result.type = LE_EOF;
+	result.lexeme = l->pos;
+	result.len = 0;
+	for(;;) {
+		if(l->pos == l->end && l->in != NULL)
+			refill(l, result.len > 0 ? &result.lexeme : NULL);
+		c = l_getc(l);
+		t = &trans[l->state][cclass[(unsigned char)c]];
+		switch(t->act) {
+		case A_SKIP:
+			if(longrun(l, t))
+				l->pos = scan(l->pos, l->end, SCAN_WS);
+			continue;
+		case A_SHIFT:
+			extend(&result, l);
+			result.type = ctoken[cclass[(unsigned char)c]];
+			l->state = t->next;
+			if(t->next != LS_EXPONENT && longrun(l, t)) {
+				run = scan(l->pos, l->end, t->next == LS_NUMBER ? SCAN_NUMBER : SCAN_SYMBOL);
+				result.len += run - l->pos;
+				l->pos = run;
 			}
-		} else if(isalpha(c)) {
-			switch(l->state) {
-			case LS_WS:
-				l->state = LS_SYMBOL;
-				result->len = strappend(result->lexeme, c, offset++, result->len);
-				result->type = LE_SYMBOL;
-				break;
-			case LS_SYMBOL:
-				result->len = strappend(result->lexeme, c, offset++, result->len);
-				result->type = LE_SYMBOL;
-				break;
-			default:
-				l->pos--;
+			continue;
+		case A_TOKEN:
+			extend(&result, l);
+			result.type = ctoken[cclass[(unsigned char)c]];
+			return result;
+		case A_BACK:
+			l->pos--;
+			/* fallthrough */
+		case A_END:
+			l->state = t->next;
+			return result;
+		case A_STOP:
+			return result;
+		case A_EXP:
+			/* the sign and first digit may be in the next buffer */
+			while(l->end - l->pos < 2 && l->in != NULL)
+				refill(l, &result.lexeme);
+			run = l->pos < l->end && (*l->pos == '+' || *l->pos == '-') ? l->pos + 1 : l->pos;
+			if(run >= l->end || *run < '0' || *run > '9') {
+				l->pos--; /* a symbol after the number */
 				l->state = LS_WS;
 				return result;
 			}
-		} else if(isdigit(c)) {
-			switch(l->state) {
-			case LS_WS:
-				l->state = LS_NUMBER;
-				result->len = strappend(result->lexeme, c, offset++, result->len);
-				result->type = LE_NUMBER;
-				break;
-			case LS_NUMBER:
-				result->len = strappend(result->lexeme, c, offset++, result->len);
-				result->type = LE_NUMBER;
-				break;
-			default:
-				l->pos--;
-				l->state = LS_WS;
-				return result;
-			}
-		} else {
-			switch(c) {
-			case '+':
-			case '-':
-			case '*':
-			case '^':
-			case '/':
-				switch(l->state) {
-				case LS_WS:
-					result->type = LE_OPERATOR;
-					result->len = strappend(result->lexeme, c, offset++, result->len);
-					return result;
-				default:
-					l->pos--;
-					l->state = LS_WS;
-					return result;
-				}
-				break;
-			case '.':
-				switch(l->state) {
-				case LS_NUMBER:
-					result->len = strappend(result->lexeme, c, offset++, result->len);
-					break;
-				default:
-					l->state = LS_ERROR;
-					l->err = emalloc(strlen(l->filename) + 43 + 1);
-					sprintf(l->err, "%s: unexpected '.', not in a number literal\n", l->filename);
-					result->type = LE_ERROR;
-					return result;
-				}
-				break;
-			case '(':
-				switch(l->state) {
-				case LS_WS:
-					result->type = LE_LPAREN;
-					result->len = strappend(result->lexeme, c, offset++, result->len);
-					return result;
-				default:
-					l->pos--;
-					l->state = LS_WS;
-					return result;
-				}
-				break;
-			case ')':
-				switch(l->state) {
-				case LS_WS:
-					result->type = LE_RPAREN;
-					result->len = strappend(result->lexeme, c, offset++, result->len);
-					return result;
-				default:
-					l->pos--;
-					l->state = LS_WS;
-					return result;
-				}
-				break;
-			case '\0':
-				switch(l->state) {
-				case LS_WS:
-					free(result->lexeme);
-					result->type = LE_EOF;
-					break;
-				default:
-					l->pos--;
-					l->state = LS_WS;
-				}
-				return result;
-			default:
-				l->state = LS_ERROR;
-				l->err = emalloc(strlen(l->filename) + 16 + 1);
-				sprintf(l->err, "%s: %c is garbage\n", l->filename, c);
-				result->type = LE_ERROR;
-				return result;
-			}
+			extend(&result, l);
+			result.len += run - l->pos;
+			l->pos = run;
+			l->state = t->next;
+			continue;
+		case A_DOT:
+			l->state = t->next;
+			l->err = emalloc(strlen(l->filename) + 43 + 1);
+			sprintf(l->err, "%s: unexpected '.', not in a number literal\n", l->filename);
+			result.type = LE_ERROR;
+			return result;
+		default:
+			l->state = t->next;
+			l->err = emalloc(strlen(l->filename) + 16 + 1);
+			sprintf(l->err, "%s: %c is garbage\n", l->filename, c);
+			result.type = LE_ERROR;
+			return result;
 		}
 	}
-	return result;
 }
 
 void
 p_free(Parser *p)
 {
 	l_free(p->l);
-	ast_free(p->ast);
+	arena_free(p->arena); /* p->ast lives in the arena */
+	tape_free(p->tape);
+	stk_free(&p->ops);
+	stk_free(&p->nodes);
 	free(p->err);
 	free(p);
 }
@@ -238,239 +458,329 @@ p_free(Parser *p)
  */
 Parser*
 p_alloc(char *filename)
+{
+	return p_new(l_alloc(filename));
+}
+
+/*
+ * Allocate a parser over the len bytes of data, see l_alloc_data
+ */
+Parser*
+p_alloc_data(char *filename, char *data, size_t len)
+{
+	return p_new(l_alloc_data(filename, data, len));
+}
+
+/*
+ * Allocate a parser that reads filename as it parses, see l_alloc_stream
+ */
+Parser*
+p_alloc_stream(char *filename)
+{
+	return p_new(l_alloc_stream(filename));
+}
+
+static Parser*
+p_new(Lexer *l)
 {
 	Parser *p;
 
 	p = emalloc(sizeof(Parser));
 	p->ast = NULL;
 	p->err = NULL;
-	p->l = l_alloc(filename);
+	p->arena = arena_alloc();
+	p->tape = NULL;
+	p->pratt = 0;
+	p->jobs = 1;
+	p->seed = NULL;
+	stk_init(&p->ops, sizeof(Node*));
+	stk_init(&p->nodes, sizeof(Node*));
+	p->l = l;
 	return p;
 }
 
 /*
- * Shunting yard algorithm
+ * Forget the last expression parsed by p, its nodes are released and
+ * p->arena is ready for the next one
+ */
+void
+p_reset(Parser *p)
+{
+	arena_reset(p->arena);
+	p->ast = NULL;
+	free(p->err);
+	p->err = NULL;
+	if(p->tape != NULL) {
+		p->tape->len = 0;
+		p->tape->root = TAPE_NIL;
+	}
+}
+
+/*
+ * Parse p->l into p->ast, allocating nodes from p->arena
  */
 int
 parse(Parser *p)
 {
-	size_t i;
-	int found;
-	Lexeme *le;
-	Node *tmp;
-	Stack *op_stack, *node_stack;
-	Symbol *sym, *head;
-
-	op_stack = node_stack = NULL;
-	for(le = lex(p->l); le->type != LE_EOF && le->type != LE_ERROR; free(le->lexeme), free(le), le = lex(p->l)) {
-		switch(le->type){
+	int ret;
+	Arena *prev;
+
+	if(p->jobs > 1 && p->seed == NULL && p->l->in == NULL && parse_split(p) == 0)
+		return 0;
+	prev = arena_use(p->arena);
+	ret = p->pratt ? pratt(p) : shunting_yard(p);
+	arena_use(prev);
+	return ret;
+}
+
+/*
+ * Push n on the output stack. Nodes reach it in postfix order, so they are
+ * also appended to p->tape when the caller asked for one.
+ */
+static void
+output(Parser *p, Stk *s, Node *n)
+{
+	if(p->tape != NULL)
+		tape_push(p->tape, n->sym, TAPE_NIL, TAPE_NIL);
+	push(s, n);
+}
+
+static Node*
+peek(Stk *s)
+{
+	Node **top;
+
+	top = stk_top(s);
+	return top == NULL ? NULL : *top;
+}
+
+static Symbol*
+peek_sym(Stk *s)
+{
+	Node *top;
+
+	top = peek(s);
+	return top == NULL ? NULL : &top->sym;
+}
+
+static Node*
+pop(Stk *s)
+{
+	Node **top;
+
+	top = stk_pop(s);
+	return top == NULL ? NULL : *top;
+}
+
+int
+precedence(Symbol *s)
+{
+	if(s == NULL)
+		return -1;
+	switch(s->type) {
+	case S_OP:
+		switch(bit_to_op(s->content.func)) {
+		case '-':
+		case '+':
+			return 0;
+		case '*':
+		case '/':
+			return 1;
+		case '^':
+			return 2;
+		}
+		break;
+	case S_FUNC:
+		return 2;
+	default:
+		return -1;
+	}
+	return -1;
+}
+
+static void
+push(Stk *s, Node *n)
+{
+	*(Node**)stk_push(s) = n;
+}
+
+/*
+ * Move the bytes of l->data from *keep, or from l->pos if keep is NULL, to
+ * its start and read more after them, growing l->data only when what is
+ * kept fills it. Pointers into l->data are adjusted, return 0 at the end of
+ * the input.
+ */
+static int
+refill(Lexer *l, char **keep)
+{
+	ssize_t n;
+	size_t kept, pos;
+	char *from, *data;
+
+	from = keep != NULL ? *keep : l->pos;
+	kept = l->end - from;
+	pos = l->pos - from;
+	if(kept == l->len) {
+		data = emalloc(2 * l->len);
+		memcpy(data, from, kept);
+		free(l->data);
+		l->data = data;
+		l->len *= 2;
+	} else {
+		memmove(l->data, from, kept);
+	}
+	if(keep != NULL)
+		*keep = l->data;
+	l->pos = l->data + pos;
+	while((n = read(fileno(l->in), l->data + kept, l->len - kept)) < 0)
+		if(errno != EINTR)
+			die("read");
+	l->end = l->data + kept + n;
+	if(n == 0) {
+		if(l->in != stdin)
+			fclose(l->in);
+		l->in = NULL;
+	}
+	return n > 0;
+}
+
+/*
+ * Shunting yard algorithm
+ */
+static int
+shunting_yard(Parser *p)
+{
+	int f;
+	Lexeme le;
+	Node *op, *tmp;
+	Stk *op_stack, *node_stack;
+	Symbol *head;
+
+	op_stack = &p->ops;
+	node_stack = &p->nodes;
+	if(p->seed != NULL)
+		output(p, node_stack, p->seed);
+	for(le = lex(p->l); le.type != LE_EOF && le.type != LE_ERROR; le = lex(p->l)) {
+		switch(le.type){
 		case LE_NUMBER:
-			sym = num_alloc(atof(le->lexeme));
-			node_stack = push(node_stack, ast_alloc(sym), NODE);
+			output(p, node_stack, ast_alloc(num_alloc(decimal(le.lexeme, le.len))));
 			break;
 		case LE_OPERATOR:
-			sym = operator_alloc(le->lexeme[0]);
-			head = peek(op_stack);
+			op = ast_alloc(operator_alloc(le.lexeme[0]));
+			head = peek_sym(op_stack);
 			while(head != NULL &&
 			      ! is_lparen(head) &&
-			      precedence(head) >= precedence(sym)) {
+			      precedence(head) >= precedence(&op->sym)) {
 				if(peek(op_stack) == NULL) goto err;
-				tmp = ast_alloc(pop(&op_stack));
+				tmp = pop(op_stack);
 
 				/* Needs error checking */
 				if(peek(node_stack) == NULL) goto err;
-				ast_insert(tmp, pop(&node_stack));
+				ast_insert(tmp, pop(node_stack));
 				if(peek(node_stack) == NULL) goto err;
-				ast_insert(tmp, pop(&node_stack));
-				node_stack = push(node_stack, tmp, NODE);
-				head = peek(op_stack);
+				ast_insert(tmp, pop(node_stack));
+				output(p, node_stack, tmp);
+				head = peek_sym(op_stack);
 			}
-			op_stack = push(op_stack, sym, SYM);
+			push(op_stack, op);
 			break;
 		case LE_LPAREN:
-			sym = lparen_alloc();
-			op_stack = push(op_stack, sym, SYM);
+			push(op_stack, ast_alloc(lparen_alloc()));
 			break;
 		case LE_RPAREN:
-			while(! is_lparen(peek(op_stack))) {
-				if(op_stack == NULL) {
+			while(! is_lparen(peek_sym(op_stack))) {
+				if(op_stack->len == 0) {
 					p->err = ecalloc(strlen(p->l->filename) + 26 + 1, sizeof(char));
 					sprintf(p->err, "%s: unbalanced parenthesis\n", p->l->filename);
+					stack_clear(node_stack);
 					return -1;
 				}
 				/* Error handling */
 				if(peek(op_stack) == NULL) goto err;
-				tmp = ast_alloc(pop(&op_stack));
+				tmp = pop(op_stack);
 				if(peek(node_stack) == NULL) goto err;
-				ast_insert(tmp, pop(&node_stack));
+				ast_insert(tmp, pop(node_stack));
 				if(peek(node_stack) == NULL) goto err;
-				ast_insert(tmp, pop(&node_stack));
-				node_stack = push(node_stack, tmp, NODE);
+				ast_insert(tmp, pop(node_stack));
+				output(p, node_stack, tmp);
 			}
-			symbol_free(pop(&op_stack)); /* Left paren, discarded */
-			if(peek(op_stack) != NULL && is_function(peek(op_stack))) {
-				tmp = ast_alloc(pop(&op_stack));
-				ast_insert(tmp, pop(&node_stack));
-				node_stack = push(node_stack, tmp, NODE);
+			ast_free(pop(op_stack)); /* Left paren, discarded */
+			if(peek(op_stack) != NULL && is_function(peek_sym(op_stack))) {
+				tmp = pop(op_stack);
+				ast_insert(tmp, pop(node_stack));
+				output(p, node_stack, tmp);
 			}
 			break;
 		case LE_SYMBOL:
-			if(strlen(le->lexeme) == 1) {
-				sym = var_alloc(le->lexeme[0]);
-				node_stack = push(node_stack, ast_alloc(sym), NODE);
-			} else {
-				/* Throw error on unknown functions */
-				found = 0;
-				for(i = 0; i < KNOWN_FUNCS; i++) {
-					if(strcmp(le->lexeme, known_funcs[i].func) == 0) {
-						sym = func_alloc(le->lexeme);
-						op_stack = push(op_stack, sym, SYM);
-						found = 1;
-						break;
-					}
-				}
-				if(! found) {
-					stack_free(op_stack);
-					stack_free(node_stack);
-					p->err = ecalloc(strlen(p->l->filename) + strlen(le->lexeme) + 21 + 1, sizeof(char));
-					sprintf(p->err, "%s: unknown function %s\n", p->l->filename, le->lexeme);
-					free(le->lexeme);
-					free(le);
-					return -1;
-				}
-				found = 0;
+			if((f = func_lookup(le.lexeme, le.len)) >= 0) {
+				push(op_stack, ast_alloc(func_alloc(known_funcs[f].func)));
+				break;
+			}
+			/* Throw error on unknown functions */
+			if(le.len > 1 && l_lparen(p->l, &le)) {
+				stack_clear(op_stack);
+				stack_clear(node_stack);
+				p->err = ecalloc(strlen(p->l->filename) + le.len + 21 + 1, sizeof(char));
+				sprintf(p->err, "%s: unknown function %.*s\n", p->l->filename, (int)le.len, le.lexeme);
+				return -1;
 			}
+			output(p, node_stack, ast_alloc(var_alloc(var_intern(le.lexeme, le.len))));
 			break;
 		default:
-			stack_free(op_stack);
-			stack_free(node_stack);
-			p->err = ecalloc(strlen(p->l->filename) + strlen(le->lexeme) + 18 + 1, sizeof(char));
-			sprintf(p->err, "%s: unknown symbol %s\n", p->l->filename, le->lexeme);
-			free(le->lexeme);
-			free(le);
+			stack_clear(op_stack);
+			stack_clear(node_stack);
+			p->err = ecalloc(strlen(p->l->filename) + le.len + 18 + 1, sizeof(char));
+			sprintf(p->err, "%s: unknown symbol %.*s\n", p->l->filename, (int)le.len, le.lexeme);
 			return -1;
 		}
 	}
-	free(le);
-	while(op_stack != NULL) {
-		if(is_lparen(peek(op_stack))) {
+	if(le.type == LE_ERROR) {
+		p->err = p->l->err; /* now owned by p */
+		p->l->err = NULL;
+		stack_clear(op_stack);
+		stack_clear(node_stack);
+		return -1;
+	}
+	while(op_stack->len > 0) {
+		if(is_lparen(peek_sym(op_stack))) {
 			p->err = ecalloc(strlen(p->l->filename) + 26 + 1, sizeof(char));
 			sprintf(p->err, "%s: unbalanced parenthesis\n", p->l->filename);
-			stack_free(op_stack);
-			stack_free(node_stack);
+			stack_clear(op_stack);
+			stack_clear(node_stack);
 			return -1;
 		}
-		tmp = ast_alloc(pop(&op_stack));
-		ast_insert(tmp, pop(&node_stack));
-		ast_insert(tmp, pop(&node_stack));
-		node_stack = push(node_stack, tmp, NODE);
+		tmp = pop(op_stack);
+		if(peek(node_stack) == NULL) goto err;
+		ast_insert(tmp, pop(node_stack));
+		if(! is_function(&tmp->sym)) {
+			if(peek(node_stack) == NULL) goto err;
+			ast_insert(tmp, pop(node_stack));
+		}
+		output(p, node_stack, tmp);
 	}
-	p->ast = pop(&node_stack);
-	if(stack_len(op_stack) > 0)
+	p->ast = pop(node_stack);
+	if(op_stack->len > 0)
 		goto err;
-	else if(stack_len(node_stack) > 0)
+	else if(node_stack->len > 0)
 		goto err;
+	if(p->tape != NULL)
+		tape_link(p->tape);
 	return 0;
 err:
 	p->err = ecalloc(strlen(p->l->filename) + 24 + 1, sizeof(char));
 	sprintf(p->err, "%s: malformed expression\n", p->l->filename);
-	stack_free(op_stack);
-	stack_free(node_stack);
+	stack_clear(op_stack);
+	stack_clear(node_stack);
 
 	return -1;
 }
 
-static void*
-peek(Stack *s)
-{
-	return s == NULL ? NULL : s->data;
-}
-
-static void*
-pop(Stack **s)
-{
-	void *data;
-	Stack *old;
-
-	data = NULL;
-	if(*s != NULL) {
-		data = (*s)->data;
-		old = *s;
-		*s = (*s)->next;
-		free(old);
-	}
-	return data;
-}
-
-int
-precedence(Symbol *s)
-{
-	if(s == NULL)
-		return -1;
-	switch(s->type) {
-	case S_OP:
-		switch(s->content.func){
-		case '-':
-		case '+':
-			return 0;
-		case '*':
-		case '/':
-			return 1;
-		case '^':
-			return 2;
-		}
-		break;
-	case S_FUNC:
-		return 2;
-	default:
-		return -1;
-	}
-	return -1;
-}
-
-static Stack*
-push(Stack *s, void *data, enum stack_type type)
-{
-	Stack *new;
-
-	new = stack_alloc(data, type);
-	new->next = s;
-	return new;
-}
-
-static Stack*
-stack_alloc(void *data, enum stack_type type)
-{
-	Stack *s;
-
-	s = emalloc(sizeof(Stack));
-	s->data = data;
-	s->type = type;
-	s->next = NULL;
-	return s;
-}
-
+/*
+ * Free the nodes left on s, its memory is kept for the next parse
+ */
 static void
-stack_free(Stack *s)
+stack_clear(Stk *s)
 {
-	if(s == NULL)
-		return;
-	while(s->next != NULL)
-		if(s->type == SYM)
-			symbol_free(pop(&s));
-		else
-			ast_free(pop(&s));
-	if(s->type == SYM)
-		symbol_free(s->data);
-	else
-		ast_free(pop(&s));
-	free(s);
-}
-
-static int
-stack_len(Stack *s)
-{
-	if(s == NULL)
-		return 0;
-	return 1 + stack_len(s->next);
+	while(s->len > 0)
+		ast_free(pop(s));
 }
@@ -0,0 +1,441 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Parallel batch mode. The calling thread reads the input in chunks of whole
+ * records and deals them round-robin to the workers' deques. A worker takes
+ * the oldest chunk of its own deque and, when that is empty, steals the
+ * newest one of another worker. The deques are plain arrays behind a mutex
+ * each, contention is low with one task per POOL_CHUNK bytes. Workers
+ * parse, differentiate and render a chunk into memory with their own parser
+ * and Dag, then a writer thread prints the chunks in input order. At most
+ * window chunks are in flight, so memory stays bounded however large the
+ * input is.
+ */
+
+#define POOL_CHUNK (64 * 1024) /* input bytes per task, at least */
+#define POOL_WINDOW 4 /* tasks in flight per worker */
+#define DEQUE_MINSZ 16
+
+typedef struct Deque Deque;
+typedef struct Pool Pool;
+typedef struct Task Task;
+typedef struct Worker Worker;
+
+struct Deque {
+	pthread_mutex_t lock;
+	Task **tasks; /* circular, oldest at head */
+	size_t head, len, size;
+};
+
+struct Task {
+	size_t seq; /* position in the input */
+	char *data; /* whole records, owned by the worker's parser */
+	size_t len;
+	char *out; /* rendered derivatives */
+	size_t outlen;
+	int nerr;
+};
+
+struct Worker {
+	pthread_t thread;
+	Pool *pool;
+	Deque deque;
+	size_t id;
+};
+
+struct Pool {
+	pthread_mutex_t lock; /* protects everything below but the workers */
+	pthread_cond_t work, done, room;
+	Worker *workers;
+	size_t nworkers;
+	Task **ring; /* finished tasks, by seq % window */
+	size_t window;
+	size_t ntasks, nwritten, nflight, nqueued;
+	int closed; /* no more tasks will come */
+	int nerr;
+	int werr; /* errno of the first failed write to out */
+	char *filename;
+	uint32_t var;
+	int flags;
+	FILE *out;
+	char *rest; /* partial record carried to the next task */
+	size_t nrest;
+	int eof;
+};
+
+static void	deque_free(Deque*);
+static void	deque_init(Deque*);
+static Task*	deque_pop(Deque*);
+static void	deque_push(Deque*, Task*);
+static Task*	deque_steal(Deque*);
+static void	finish(Pool*, Task*);
+static void	run(Pool*, Dag*, Task*);
+static void	submit(Pool*, Task*);
+static Task*	take(Worker*);
+static Task*	task_read(Pool*, FILE*);
+static void*	work(void*);
+static void*	write_out(void*);
+
+static void
+deque_free(Deque *d)
+{
+	pthread_mutex_destroy(&d->lock);
+	free(d->tasks);
+}
+
+static void
+deque_init(Deque *d)
+{
+	pthread_mutex_init(&d->lock, NULL);
+	d->size = DEQUE_MINSZ;
+	d->tasks = ecalloc(d->size, sizeof(Task*));
+	d->head = d->len = 0;
+}
+
+/*
+ * Take the oldest task of d, only its owner does this
+ */
+static Task*
+deque_pop(Deque *d)
+{
+	Task *t;
+
+	t = NULL;
+	pthread_mutex_lock(&d->lock);
+	if(d->len > 0) {
+		t = d->tasks[d->head];
+		d->head = (d->head + 1) % d->size;
+		d->len--;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return t;
+}
+
+static void
+deque_push(Deque *d, Task *t)
+{
+	size_t i;
+	Task **tasks;
+
+	pthread_mutex_lock(&d->lock);
+	if(d->len == d->size) {
+		tasks = ecalloc(2 * d->size, sizeof(Task*));
+		for(i = 0; i < d->len; i++)
+			tasks[i] = d->tasks[(d->head + i) % d->size];
+		free(d->tasks);
+		d->tasks = tasks;
+		d->head = 0;
+		d->size *= 2;
+	}
+	d->tasks[(d->head + d->len++) % d->size] = t;
+	pthread_mutex_unlock(&d->lock);
+}
+
+/*
+ * Take the newest task of d, from the end its owner does not touch
+ */
+static Task*
+deque_steal(Deque *d)
+{
+	Task *t;
+
+	t = NULL;
+	pthread_mutex_lock(&d->lock);
+	if(d->len > 0)
+		t = d->tasks[(d->head + --d->len) % d->size];
+	pthread_mutex_unlock(&d->lock);
+	return t;
+}
+
+/*
+ * Hand the rendered task t to the writer
+ */
+static void
+finish(Pool *pool, Task *t)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->ring[t->seq % pool->window] = t;
+	if(t->seq == pool->nwritten)
+		pthread_cond_signal(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Differentiate the expressions read from in with nworkers threads and print
+ * them to out in input order, like batch. Return the number of errors, a
+ * failed write to out counts as one.
+ */
+int
+pool_batch(char *filename, FILE *in, FILE *out, int nworkers, uint32_t var, int flags)
+{
+	size_t i;
+	char magic[BIN_MAGICSZ];
+	pthread_t writer;
+	Pool pool;
+	Task *t;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pthread_cond_init(&pool.room, NULL);
+	pool.nworkers = nworkers;
+	pool.window = POOL_WINDOW * pool.nworkers;
+	pool.ring = ecalloc(pool.window, sizeof(Task*));
+	pool.ntasks = pool.nwritten = pool.nflight = pool.nqueued = 0;
+	pool.closed = pool.nerr = pool.werr = 0;
+	pool.filename = filename == NULL ? "stdin" : filename;
+	pool.var = var;
+	pool.flags = flags;
+	pool.out = out;
+	pool.rest = NULL;
+	pool.nrest = 0;
+	pool.eof = 0;
+	if((flags & D_BIN_IN) && (fread(magic, sizeof(char), BIN_MAGICSZ, in) != BIN_MAGICSZ
+	   || memcmp(magic, BIN_MAGIC, BIN_MAGICSZ) != 0)) {
+		fprintf(stderr, "%s: not a version 1 dwrt binary file\n", pool.filename);
+		pool.nerr++;
+		pool.eof = 1;
+	} else if(flags & D_BIN_OUT) {
+		fwrite(BIN_MAGIC, sizeof(char), BIN_MAGICSZ, out);
+	}
+
+	pool.workers = ecalloc(pool.nworkers, sizeof(Worker));
+	for(i = 0; i < pool.nworkers; i++) {
+		pool.workers[i].pool = &pool;
+		pool.workers[i].id = i;
+		deque_init(&pool.workers[i].deque);
+	}
+	for(i = 0; i < pool.nworkers; i++)
+		if((errno = pthread_create(&pool.workers[i].thread, NULL, work, &pool.workers[i])) != 0)
+			die("pthread_create");
+	if((errno = pthread_create(&writer, NULL, write_out, &pool)) != 0)
+		die("pthread_create");
+
+	while((t = task_read(&pool, in)) != NULL)
+		submit(&pool, t);
+
+	pthread_mutex_lock(&pool.lock);
+	pool.closed = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_cond_signal(&pool.done);
+	pthread_mutex_unlock(&pool.lock);
+	for(i = 0; i < pool.nworkers; i++)
+		pthread_join(pool.workers[i].thread, NULL);
+	pthread_join(writer, NULL);
+	if(fflush(out) == EOF && pool.werr == 0)
+		pool.werr = errno;
+	if(pool.werr != 0 || ferror(out)) {
+		errno = pool.werr != 0 ? pool.werr : EIO;
+		perror("write");
+		pool.nerr++;
+	}
+
+	for(i = 0; i < pool.nworkers; i++)
+		deque_free(&pool.workers[i].deque);
+	free(pool.workers);
+	free(pool.ring);
+	free(pool.rest);
+	pthread_cond_destroy(&pool.room);
+	pthread_cond_destroy(&pool.done);
+	pthread_cond_destroy(&pool.work);
+	pthread_mutex_destroy(&pool.lock);
+	return pool.nerr;
+}
+
+/*
+ * Render the derivatives of t into t->out
+ */
+static void
+run(Pool *pool, Dag *dag, Task *t)
+{
+	Buf out;
+	Parser *p;
+
+	buf_init(&out, -1);
+	p = p_alloc_data(pool->filename, t->data, t->len);
+	p->pratt = (pool->flags & D_PRATT) != 0;
+	if(pool->flags & D_TAPE)
+		p->tape = tape_alloc();
+	t->nerr = batch(p, dag, pool->var, pool->flags, &out);
+	p_free(p); /* and t->data */
+	t->data = NULL;
+	t->out = out.data;
+	t->outlen = out.len;
+}
+
+/*
+ * Queue t on a worker's deque, waiting while the window is full
+ */
+static void
+submit(Pool *pool, Task *t)
+{
+	pthread_mutex_lock(&pool->lock);
+	while(pool->nflight == pool->window)
+		pthread_cond_wait(&pool->room, &pool->lock);
+	t->seq = pool->ntasks++;
+	pool->nflight++;
+	pthread_mutex_unlock(&pool->lock);
+	deque_push(&pool->workers[t->seq % pool->nworkers].deque, t);
+	pthread_mutex_lock(&pool->lock);
+	pool->nqueued++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Next task for w, its own or a stolen one. NULL once the input is over.
+ */
+static Task*
+take(Worker *w)
+{
+	size_t i;
+	Pool *pool;
+	Task *t;
+
+	pool = w->pool;
+	pthread_mutex_lock(&pool->lock);
+	while(pool->nqueued == 0 && !pool->closed)
+		pthread_cond_wait(&pool->work, &pool->lock);
+	if(pool->nqueued == 0) {
+		pthread_mutex_unlock(&pool->lock);
+		return NULL;
+	}
+	pool->nqueued--;
+	pthread_mutex_unlock(&pool->lock);
+	/* nqueued only counts pushed tasks, so there is one left for w */
+	for(t = NULL; t == NULL;) {
+		t = deque_pop(&w->deque);
+		for(i = 1; t == NULL && i < pool->nworkers; i++)
+			t = deque_steal(&pool->workers[(w->id + i) % pool->nworkers].deque);
+	}
+	return t;
+}
+
+/*
+ * Read the next task from in: at least POOL_CHUNK bytes ending at a record
+ * separator (or a whole binary record), or whatever is left of in. NULL at
+ * the end of in.
+ */
+static Task*
+task_read(Pool *pool, FILE *in)
+{
+	size_t n, size;
+	char *end;
+	Task *t;
+
+	if(pool->eof && pool->nrest == 0)
+		return NULL;
+	t = emalloc(sizeof(Task));
+	t->out = NULL;
+	t->outlen = 0;
+	t->nerr = 0;
+	size = pool->nrest + POOL_CHUNK;
+	t->data = emalloc(size);
+	if(pool->nrest > 0)
+		memcpy(t->data, pool->rest, pool->nrest);
+	t->len = pool->nrest;
+	pool->nrest = 0;
+	while(!pool->eof) {
+		n = fread(t->data + t->len, sizeof(char), size - t->len, in);
+		t->len += n;
+		if(t->len < size) {
+			pool->eof = 1; /* or a read error, like readall */
+			break;
+		}
+		if(pool->flags & D_BIN_IN)
+			end = t->data + bin_records(t->data, t->len);
+		else
+			for(end = t->data + t->len; end > t->data; end--)
+				if(end[-1] == '\n' || end[-1] == ';')
+					break;
+		if(end > t->data) {
+			pool->nrest = t->data + t->len - end;
+			pool->rest = erealloc(pool->rest, pool->nrest + 1);
+			memcpy(pool->rest, end, pool->nrest);
+			t->len = end - t->data;
+			break;
+		}
+		size *= 2; /* one record longer than the chunk */
+		t->data = erealloc(t->data, size);
+	}
+	return t;
+}
+
+static void*
+work(void *arg)
+{
+	Dag *dag;
+	Task *t;
+	Worker *w;
+
+	w = arg;
+	dag = dag_alloc();
+	while((t = take(w)) != NULL) {
+		run(w->pool, dag, t);
+		finish(w->pool, t);
+	}
+	dag_free(dag);
+	return NULL;
+}
+
+/*
+ * Print the finished tasks in input order
+ */
+static void*
+write_out(void *arg)
+{
+	Pool *pool;
+	Task *t;
+
+	pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	for(;;) {
+		while((t = pool->ring[pool->nwritten % pool->window]) == NULL
+		      && !(pool->closed && pool->nwritten == pool->ntasks))
+			pthread_cond_wait(&pool->done, &pool->lock);
+		if(t == NULL)
+			break;
+		pool->ring[pool->nwritten % pool->window] = NULL;
+		pthread_mutex_unlock(&pool->lock);
+		if(t->outlen > 0 && fwrite(t->out, sizeof(char), t->outlen, pool->out) != t->outlen
+		   && pool->werr == 0)
+			pool->werr = errno; /* only the writer sets it */
+		free(t->out);
+		pthread_mutex_lock(&pool->lock);
+		pool->nerr += t->nerr;
+		pool->nwritten++;
+		pool->nflight--;
+		pthread_cond_signal(&pool->room);
+		free(t);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Pratt parser, the alternative to shunting_yard selected with p->pratt. It
+ * builds nodes directly while descending, with the usual precedences: + and
+ * - bind loosest, then * and /, then unary minus, then ^ which is right
+ * associative. A function applies to a parenthesized argument, f(x) ^ 2 is
+ * (f(x)) ^ 2, or to the operand that follows it: f x ^ 2 is f(x ^ 2) while
+ * f x * 2 is f(x) * 2. Nodes are emitted to p->tape in postfix order as they
+ * are built.
+ */
+
+#define PRATT_DEPTH 10000 /* nesting levels, each one is a C call */
+
+/* Binding powers */
+enum {
+	BP_NONE,
+	BP_SUM = 10,
+	BP_MUL = 20,
+	BP_UNARY = 25,
+	BP_EXPT = 30
+};
+
+typedef struct Pratt Pratt;
+
+struct Pratt {
+	Parser *p;
+	Lexeme tok; /* lookahead */
+	int depth;
+};
+
+static void	advance(Pratt*);
+static Node*	climb(Pratt*, Node*, int);
+static Node*	emit(Pratt*, Symbol, Node*, Node*);
+static int	error(Pratt*, char*);
+static Node*	expr(Pratt*, int);
+static int	infix(Lexeme*, int*, int*);
+static Node*	negate(Pratt*);
+static Node*	prefix(Pratt*);
+
+static void
+advance(Pratt *pr)
+{
+	pr->tok = lex(pr->p->l);
+}
+
+/*
+ * Extend left with the operators binding tighter than minbp that follow it
+ */
+static Node*
+climb(Pratt *pr, Node *left, int minbp)
+{
+	int lbp, rbp;
+	Node *right;
+	Symbol sym;
+
+	while(left != NULL && infix(&pr->tok, &lbp, &rbp) && lbp > minbp) {
+		sym = operator_alloc(pr->tok.lexeme[0]);
+		advance(pr);
+		if((right = expr(pr, rbp)) == NULL)
+			return NULL;
+		left = emit(pr, sym, left, right);
+	}
+	return left;
+}
+
+/*
+ * Allocate the node sym with children left and right, which were emitted
+ * before it
+ */
+static Node*
+emit(Pratt *pr, Symbol sym, Node *left, Node *right)
+{
+	Node *n;
+
+	n = ast_alloc(sym);
+	n->left = left;
+	n->right = right;
+	if(pr->p->tape != NULL)
+		tape_push(pr->p->tape, sym, TAPE_NIL, TAPE_NIL);
+	return n;
+}
+
+/*
+ * Set p->err to what, followed by the current lexeme if what ends with a
+ * space, unless the lexer already failed
+ */
+static int
+error(Pratt *pr, char *what)
+{
+	int len;
+	Parser *p;
+
+	p = pr->p;
+	if(pr->tok.type == LE_ERROR) {
+		p->err = p->l->err; /* now owned by p */
+		p->l->err = NULL;
+		return -1;
+	}
+	len = what[strlen(what) - 1] == ' ' ? (int)pr->tok.len : 0;
+	p->err = emalloc(strlen(p->l->filename) + strlen(what) + len + 3 + 1);
+	sprintf(p->err, "%s: %s%.*s\n", p->l->filename, what, len, pr->tok.lexeme);
+	return -1;
+}
+
+/*
+ * Parse an expression of operators binding tighter than minbp, NULL on
+ * errors
+ */
+static Node*
+expr(Pratt *pr, int minbp)
+{
+	Node *n;
+
+	if(++pr->depth > PRATT_DEPTH) {
+		error(pr, "expression nested too deeply");
+		return NULL;
+	}
+	n = climb(pr, prefix(pr), minbp);
+	pr->depth--;
+	return n;
+}
+
+/*
+ * Binding powers of the binary operator le, if it is one
+ */
+static int
+infix(Lexeme *le, int *lbp, int *rbp)
+{
+	if(le->type != LE_OPERATOR)
+		return 0;
+	switch(le->lexeme[0]) {
+	case '+':
+	case '-':
+		*lbp = *rbp = BP_SUM;
+		break;
+	case '*':
+	case '/':
+		*lbp = *rbp = BP_MUL;
+		break;
+	default: /* ^ */
+		*lbp = BP_EXPT;
+		*rbp = BP_EXPT - 1;
+	}
+	return 1;
+}
+
+/*
+ * Parse the operand of a unary minus, which is -1 times the operand except
+ * for number literals that stand alone: -2 * x has a -2, -2 ^ x is -(2 ^ x)
+ */
+static Node*
+negate(Pratt *pr)
+{
+	int lbp, rbp;
+	double num;
+	Node *minus, *n;
+
+	minus = NULL;
+	if(pr->tok.type == LE_NUMBER) {
+		num = decimal(pr->tok.lexeme, pr->tok.len);
+		advance(pr);
+		if(! infix(&pr->tok, &lbp, &rbp) || lbp <= BP_UNARY)
+			return emit(pr, num_alloc(-num), NULL, NULL);
+		minus = emit(pr, num_alloc(-1), NULL, NULL);
+		n = climb(pr, emit(pr, num_alloc(num), NULL, NULL), BP_UNARY);
+	} else {
+		minus = emit(pr, num_alloc(-1), NULL, NULL); /* first in postfix order */
+		n = expr(pr, BP_UNARY);
+	}
+	return n == NULL ? NULL : emit(pr, operator_alloc('*'), minus, n);
+}
+
+/*
+ * Parse a number, a variable, a parenthesized expression, a function
+ * application or a sign
+ */
+static Node*
+prefix(Pratt *pr)
+{
+	int f;
+	Node *n;
+	Symbol sym;
+
+	switch(pr->tok.type) {
+	case LE_NUMBER:
+		n = emit(pr, num_alloc(decimal(pr->tok.lexeme, pr->tok.len)), NULL, NULL);
+		advance(pr);
+		return n;
+	case LE_SYMBOL:
+		if((f = func_lookup(pr->tok.lexeme, pr->tok.len)) < 0) {
+			if(pr->tok.len > 1 && l_lparen(pr->p->l, &pr->tok)) {
+				error(pr, "unknown function ");
+				return NULL;
+			}
+			n = emit(pr, var_alloc(var_intern(pr->tok.lexeme, pr->tok.len)), NULL, NULL);
+			advance(pr);
+			return n;
+		}
+		sym.type = S_FUNC;
+		sym.content.func = known_funcs[f].bit;
+		advance(pr);
+		/* f(x) ^ 2 is (f(x)) ^ 2 but f x ^ 2 is f(x ^ 2) */
+		n = pr->tok.type == LE_LPAREN ? prefix(pr) : expr(pr, BP_UNARY);
+		return n == NULL ? NULL : emit(pr, sym, NULL, n);
+	case LE_LPAREN:
+		advance(pr);
+		if((n = expr(pr, BP_NONE)) == NULL)
+			return NULL;
+		if(pr->tok.type != LE_RPAREN) {
+			error(pr, pr->tok.type == LE_EOF ? "unbalanced parenthesis"
+				: "malformed expression");
+			return NULL;
+		}
+		advance(pr);
+		return n;
+	case LE_OPERATOR:
+		if(pr->tok.lexeme[0] == '+') {
+			advance(pr);
+			return expr(pr, BP_UNARY);
+		}
+		if(pr->tok.lexeme[0] == '-') {
+			advance(pr);
+			return negate(pr);
+		}
+		break;
+	default:
+		break;
+	}
+	error(pr, pr->tok.type == LE_RPAREN ? "unbalanced parenthesis" : "malformed expression");
+	return NULL;
+}
+
+/*
+ * Parse the expression of p with the Pratt parser, see parse
+ */
+int
+pratt(Parser *p)
+{
+	Pratt pr;
+
+	pr.p = p;
+	pr.depth = 0;
+	advance(&pr);
+	if(p->seed != NULL) {
+		/* the input carries on after p->seed, see parse_split */
+		if(p->tape != NULL)
+			tape_push(p->tape, p->seed->sym, TAPE_NIL, TAPE_NIL);
+		if((p->ast = climb(&pr, p->seed, BP_NONE)) == NULL)
+			return -1;
+	} else if(pr.tok.type == LE_EOF) {
+		p->ast = NULL;
+		return 0;
+	} else if((p->ast = expr(&pr, BP_NONE)) == NULL)
+		return -1;
+	if(pr.tok.type != LE_EOF) {
+		p->ast = NULL;
+		return error(&pr, pr.tok.type == LE_RPAREN ? "unbalanced parenthesis"
+			: "malformed expression");
+	}
+	if(p->tape != NULL)
+		tape_link(p->tape);
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Run scanning for the lexer: find the end of a run of whitespace, number or
+ * symbol characters. On x86 the runs are classified 16 (SSE2) or 32 (AVX2)
+ * bytes at a time, picked at run time by what the CPU supports, with a plain
+ * byte loop everywhere else and for the tail of the input. Bytes past end
+ * are never read.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Unoptimized, every vector goes through the stack and the byte loop is
+ * faster, so SCAN_AUTO only picks a vector scanner with -O, which the
+ * Makefile builds with
+ */
+#ifdef __OPTIMIZE__
+#define SCAN_VECTOR 1
+#else
+#define SCAN_VECTOR 0
+#endif
+
+typedef char* (*Scanner)(char*, char*, int);
+
+static int	in_run(unsigned char, int);
+#ifdef SCAN_X86
+static char*	scan_avx2(char*, char*, int);
+#endif
+static void	scan_init(void);
+static char*	scan_plain(char*, char*, int);
+#ifdef SCAN_X86
+static char*	scan_sse2(char*, char*, int);
+#endif
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static Scanner scanner = scan_plain;
+
+static int
+in_run(unsigned char c, int run)
+{
+	switch(run) {
+	case SCAN_WS:
+		return c == ' ' || (c >= '\t' && c <= '\r');
+	case SCAN_NUMBER:
+		return (c >= '0' && c <= '9') || c == '.';
+	default:
+		return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+	}
+}
+
+/*
+ * Return the first byte from p on that is not part of a run of kind run,
+ * or end
+ */
+char*
+scan(char *p, char *end, int run)
+{
+	return scanner(p, end, run);
+}
+
+#ifdef SCAN_X86
+/*
+ * Bytes of x in the run are 0xff, the others 0. Bytes past ASCII are
+ * negative and fall out of every range.
+ */
+__attribute__((target("avx2")))
+static char*
+scan_avx2(char *p, char *end, int run)
+{
+	__m256i x, y, m;
+	uint32_t out;
+
+	for(; end - p >= 32; p += 32) {
+		x = _mm256_loadu_si256((__m256i*)p);
+		switch(run) {
+		case SCAN_WS:
+			m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+				_mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('\t' - 1)),
+					_mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), x)));
+			break;
+		case SCAN_NUMBER:
+			m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('.')),
+				_mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+					_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x)));
+			break;
+		default:
+			y = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+			m = _mm256_and_si256(_mm256_cmpgt_epi8(y, _mm256_set1_epi8('a' - 1)),
+				_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), y));
+		}
+		if((out = ~(uint32_t)_mm256_movemask_epi8(m)) != 0)
+			return p + __builtin_ctz(out);
+	}
+	return scan_plain(p, end, run);
+}
+#endif
+
+static void
+scan_init(void)
+{
+	scan_use(SCAN_AUTO);
+}
+
+/*
+ * Pick the scanner once for the whole process, lexers call this before
+ * they scan
+ */
+void
+scan_once(void)
+{
+	pthread_once(&once, scan_init);
+}
+
+static char*
+scan_plain(char *p, char *end, int run)
+{
+	while(p < end && in_run(*p, run))
+		p++;
+	return p;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static char*
+scan_sse2(char *p, char *end, int run)
+{
+	__m128i x, y, m;
+	unsigned out;
+
+	for(; end - p >= 16; p += 16) {
+		x = _mm_loadu_si128((__m128i*)p);
+		switch(run) {
+		case SCAN_WS:
+			m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+				_mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('\t' - 1)),
+					_mm_cmplt_epi8(x, _mm_set1_epi8('\r' + 1))));
+			break;
+		case SCAN_NUMBER:
+			m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('.')),
+				_mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+					_mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1))));
+			break;
+		default:
+			y = _mm_or_si128(x, _mm_set1_epi8(0x20));
+			m = _mm_and_si128(_mm_cmpgt_epi8(y, _mm_set1_epi8('a' - 1)),
+				_mm_cmplt_epi8(y, _mm_set1_epi8('z' + 1)));
+		}
+		if((out = ~(unsigned)_mm_movemask_epi8(m) & 0xffff) != 0)
+			return p + __builtin_ctz(out);
+	}
+	return scan_plain(p, end, run);
+}
+#endif
+
+/*
+ * Scan with impl from now on, or with the fastest one the CPU supports for
+ * SCAN_AUTO, see SCAN_VECTOR. Return the one actually used, which is
+ * SCAN_PLAIN when impl is not available.
+ */
+int
+scan_use(int impl)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if(impl == SCAN_AUTO)
+		impl = !SCAN_VECTOR ? SCAN_PLAIN
+			: __builtin_cpu_supports("avx2") ? SCAN_AVX2
+			: __builtin_cpu_supports("sse2") ? SCAN_SSE2 : SCAN_PLAIN;
+	if(impl == SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+		scanner = scan_avx2;
+		return SCAN_AVX2;
+	}
+	if(impl == SCAN_SSE2 && __builtin_cpu_supports("sse2")) {
+		scanner = scan_sse2;
+		return SCAN_SSE2;
+	}
+#endif
+	scanner = scan_plain;
+	return SCAN_PLAIN;
+}
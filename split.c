@@ -0,0 +1,297 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Parallel parsing of a single expression. The input is cut into ranges,
+ * one per thread. A first pass counts the parentheses of every range, their
+ * prefix sum gives the depth each range starts at, and a second pass finds
+ * the first binary + or - at depth 0 in every range. The pieces between
+ * these cuts are parsed on their own threads, each one but the first
+ * starting from a placeholder for everything before it, so that
+ * a - b + c cut before + parses as (hole) + c. Filling the holes in order
+ * gives the same tree and tape as parsing the whole input at once.
+ *
+ * Anything unusual, like unbalanced parentheses, a piece that does not
+ * parse or, for the shunting yard, a function applied without
+ * parentheses, makes parse_split give up and parse go sequential, which
+ * also reports the error the same way.
+ */
+
+#define SPLIT_MINSZ (64 * 1024) /* input bytes per range, at least */
+
+struct range {
+	pthread_t thread;
+	char *data, *stop; /* whole input, for looking around the range */
+	char *start, *end;
+	long delta; /* parentheses opened minus closed */
+	long depth; /* at start */
+	char *cut; /* first top-level binary + or -, NULL if none */
+	int bare; /* a function name is not followed by a parenthesis */
+	int pratt;
+	Parser *p; /* parses from the cut of this range to the next one */
+	int ret;
+};
+
+static int	binary(char*, char*);
+static int	blank(char);
+static void*	count(void*);
+static void*	cut(void*);
+static void	fork_ranges(struct range*, int, void*(*)(void*));
+static int	letter(char);
+static void*	parse_piece(void*);
+
+/*
+ * Whether the sign at s is a binary operator, rather than unary or in the
+ * exponent of a number. When in doubt it is not.
+ */
+static int
+binary(char *data, char *s)
+{
+	char *q, *r;
+
+	for(q = s - 1; q >= data && blank(*q); q--)
+		;
+	if(q < data)
+		return 0;
+	if(*q == ')' || *q == '.' || (*q >= '0' && *q <= '9'))
+		return 1;
+	if(! letter(*q))
+		return 0;
+	if(q == s - 1 && (*q == 'e' || *q == 'E') && q > data
+	   && (q[-1] == '.' || (q[-1] >= '0' && q[-1] <= '9')))
+		return 0;
+	for(r = q; r > data && letter(r[-1]); r--)
+		;
+	return func_lookup(r, q + 1 - r) < 0; /* sin -x */
+}
+
+static int
+blank(char c)
+{
+	return c != '\0' && strchr(" \t\n\v\f\r", c) != NULL;
+}
+
+/*
+ * Count the parentheses of a range and look for functions without them
+ */
+static void*
+count(void *arg)
+{
+	char *c, *name;
+	struct range *r;
+
+	r = arg;
+	r->delta = 0;
+	r->bare = 0;
+	c = r->start;
+	if(c > r->data && letter(c[-1])) /* the previous range's name */
+		while(c < r->end && letter(*c))
+			c++;
+	while(c < r->end) {
+		if(*c == '(')
+			r->delta++;
+		else if(*c == ')')
+			r->delta--;
+		if(! letter(*c)) {
+			c++;
+			continue;
+		}
+		for(name = c; c < r->stop && letter(*c); c++) /* may go past r->end */
+			;
+		if(r->pratt || func_lookup(name, c - name) < 0)
+			continue;
+		for(name = c; name < r->stop && blank(*name); name++)
+			;
+		r->bare |= name == r->stop || *name != '(';
+	}
+	return NULL;
+}
+
+/*
+ * Find the first binary + or - of a range outside of any parenthesis
+ */
+static void*
+cut(void *arg)
+{
+	long depth;
+	char *c;
+	struct range *r;
+
+	r = arg;
+	r->cut = NULL;
+	if(r->start == r->data)
+		return NULL; /* the first piece starts there anyway */
+	depth = r->depth;
+	for(c = r->start; c < r->end; c++) {
+		if(*c == '(')
+			depth++;
+		else if(*c == ')')
+			depth--;
+		else if(depth == 0 && (*c == '+' || *c == '-') && binary(r->data, c)) {
+			r->cut = c;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Run fn on every range, the first one on the calling thread
+ */
+static void
+fork_ranges(struct range *r, int n, void*(*fn)(void*))
+{
+	int i;
+
+	for(i = 1; i < n; i++)
+		if((errno = pthread_create(&r[i].thread, NULL, fn, &r[i])) != 0)
+			die("pthread_create");
+	fn(&r[0]);
+	for(i = 1; i < n; i++)
+		pthread_join(r[i].thread, NULL);
+}
+
+static int
+letter(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/*
+ * Parse p's input on up to p->jobs threads and join the pieces into p->ast
+ * and p->tape. Return -1, leaving p as it was, if the input is too small
+ * or cannot be split safely.
+ */
+int
+parse_split(Parser *p)
+{
+	int i, last, n, ok;
+	long depth;
+	size_t len;
+	uint32_t c;
+	char *data;
+	Node *hole;
+	Tape *t;
+	struct range *r;
+
+	data = p->l->pos;
+	len = p->l->end - data;
+	n = len / SPLIT_MINSZ < (size_t)p->jobs ? (int)(len / SPLIT_MINSZ) : p->jobs;
+	if(n < 2)
+		return -1;
+	r = ecalloc(n, sizeof(struct range));
+	for(i = 0; i < n; i++) {
+		r[i].data = data;
+		r[i].stop = data + len;
+		r[i].start = data + len / n * i;
+		r[i].end = i == n - 1 ? data + len : data + len / n * (i + 1);
+		r[i].pratt = p->pratt;
+	}
+
+	fork_ranges(r, n, count);
+	ok = 1;
+	for(i = 0, depth = 0; i < n; depth += r[i++].delta) {
+		r[i].depth = depth;
+		ok &= ! r[i].bare;
+	}
+	if(! ok || depth != 0) {
+		free(r);
+		return -1;
+	}
+	fork_ranges(r, n, cut);
+	for(i = 1, ok = 0; i < n; i++)
+		ok |= r[i].cut != NULL;
+	if(! ok) {
+		free(r);
+		return -1;
+	}
+
+	/* Pieces go from cut to cut, ranges without one are left empty */
+	r[0].cut = data;
+	for(i = 0, last = 0; i < n; i++) {
+		if(r[i].cut == NULL)
+			continue;
+		r[i].p = p_alloc_data(p->l->filename, NULL, 0);
+		r[i].p->pratt = p->pratt;
+		if(p->tape != NULL)
+			r[i].p->tape = tape_alloc();
+		r[last].end = r[i].cut;
+		last = i;
+	}
+	r[last].end = data + len;
+	fork_ranges(r, n, parse_piece);
+
+	ok = 1;
+	for(i = 0; i < n; i++)
+		ok &= r[i].p == NULL || r[i].ret == 0;
+	if(ok) {
+		for(i = 0; i < n; i++) {
+			if(r[i].p == NULL)
+				continue;
+			if((hole = r[i].p->seed) != NULL)
+				*hole = *p->ast;
+			p->ast = r[i].p->ast;
+			if((t = r[i].p->tape) != NULL)
+				for(c = hole != NULL; c < t->len; c++)
+					tape_push(p->tape, t->cells[c].sym, TAPE_NIL, TAPE_NIL);
+			arena_merge(p->arena, r[i].p->arena);
+			r[i].p->arena = NULL;
+		}
+		if(p->tape != NULL)
+			tape_link(p->tape);
+	}
+	for(i = 0; i < n; i++)
+		if(r[i].p != NULL)
+			p_free(r[i].p);
+	free(r);
+	return ok ? 0 : -1;
+}
+
+/*
+ * Parse the piece of a range, after a hole for the pieces before it
+ */
+static void*
+parse_piece(void *arg)
+{
+	Arena *prev;
+	struct range *r;
+
+	r = arg;
+	if(r->p == NULL)
+		return NULL;
+	l_reset(r->p->l, r->cut, r->end);
+	if(r->cut != r->data) {
+		prev = arena_use(r->p->arena);
+		r->p->seed = ast_alloc(var_alloc(0));
+		arena_use(prev);
+	}
+	r->ret = parse(r->p);
+	return NULL;
+}
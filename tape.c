@@ -0,0 +1,612 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Tapes are the flat counterpart of Node trees: cells live in one array in
+ * postfix order and point to their children by index. A derivative is built
+ * by appending to a copy of the input tape in a single forward pass, cells of
+ * the input are referenced instead of copied, exactly like ast_copy shares
+ * subtrees.
+ */
+
+#define TAPE_MINSZ 64
+
+static uint32_t	t_dwrt(Tape*, uint32_t, uint32_t*, uint32_t);
+static uint32_t	t_expt(Tape*, uint32_t, uint32_t);
+static uint32_t	t_frac(Tape*, uint32_t, uint32_t);
+static uint32_t	t_func(Tape*, char*, uint32_t);
+static uint32_t	t_mul(Tape*, uint32_t, uint32_t);
+static uint32_t	t_num(Tape*, double);
+static uint32_t	t_op(Tape*, char, uint32_t, uint32_t);
+static uint32_t	t_sub(Tape*, uint32_t, uint32_t);
+static uint32_t	t_sum(Tape*, uint32_t, uint32_t);
+static void	push_frame(Stk*, uint32_t, Symbol*, int);
+
+/* Symbol of cell i, only valid until the next tape_push */
+#define SYM(t, i) (&(t)->cells[(i)].sym)
+
+/* Walks over a tape, stage counts the children of cell i already visited */
+struct frame {
+	uint32_t i;
+	Symbol *previous;
+	int right; /* node is the right operand of previous */
+	int stage;
+};
+
+Tape*
+ast_to_tape(Node *ast)
+{
+	struct {
+		Node *ast;
+		int stage;
+	} *f;
+	uint32_t left, right, *top;
+	Stk cells, s;
+	Tape *t;
+
+	t = tape_alloc();
+	if(ast == NULL)
+		return t;
+	stk_init(&s, sizeof(*f));
+	stk_init(&cells, sizeof(uint32_t));
+	f = stk_push(&s);
+	f->ast = ast;
+	f->stage = 0;
+	while((f = stk_top(&s)) != NULL) {
+		ast = f->ast;
+		if(f->stage++ == 0) {
+			if(ast->right != NULL) {
+				f = stk_push(&s);
+				f->ast = ast->right;
+				f->stage = 0;
+			}
+			if(ast->left != NULL) {
+				f = stk_push(&s);
+				f->ast = ast->left;
+				f->stage = 0;
+			}
+			continue;
+		}
+		stk_pop(&s);
+		right = ast->right == NULL ? TAPE_NIL : *(uint32_t*)stk_pop(&cells);
+		left = ast->left == NULL ? TAPE_NIL : *(uint32_t*)stk_pop(&cells);
+		top = stk_push(&cells);
+		*top = tape_push(t, ast->sym, left, right);
+	}
+	t->root = t->len - 1;
+	stk_free(&s);
+	stk_free(&cells);
+	return t;
+}
+
+static void
+push_frame(Stk *s, uint32_t i, Symbol *previous, int right)
+{
+	struct frame *f;
+
+	f = stk_push(s);
+	f->i = i;
+	f->previous = previous;
+	f->right = right;
+	f->stage = 0;
+}
+
+/*
+ * Derivative of cell i, the derivatives of every cell before i are in d.
+ * Same rules and simplifications as dwrt.c, so that both print the same
+ * result.
+ */
+static uint32_t
+t_dwrt(Tape *t, uint32_t i, uint32_t *d, uint32_t var)
+{
+	uint32_t l, r, dl, dr, inner, dinner;
+	double n;
+	Cell c;
+
+	c = t->cells[i];
+	l = c.left;
+	r = c.right;
+	dl = l == TAPE_NIL ? TAPE_NIL : d[l];
+	dr = r == TAPE_NIL ? TAPE_NIL : d[r];
+
+	switch(c.sym.type) {
+	case S_VAR:
+		return t_num(t, is_same_var(&c.sym, var) ? 1 : 0);
+	case S_NUM:
+		return t_num(t, 0);
+	case S_FUNC:
+		switch(c.sym.content.func) {
+		case COS:
+			return t_mul(t, dr, t_mul(t, t_num(t, -1), t_func(t, "sin", r)));
+		case COSH:
+			return t_mul(t, dr, t_func(t, "sinh", r));
+		case EXP:
+			return t_mul(t, dr, t_func(t, "exp", r));
+		case LOG:
+			return t_mul(t, dr, t_frac(t, t_num(t, 1), r));
+		case SIN:
+			return t_mul(t, dr, t_func(t, "cos", r));
+		case SINH:
+			return t_mul(t, dr, t_func(t, "cosh", r));
+		case TAN:
+			return t_mul(t, dr, t_sum(t, t_num(t, 1),
+				t_expt(t, t_func(t, "tan", r), t_num(t, 2))));
+		case TANH:
+			return t_mul(t, dr, t_sub(t,
+				t_expt(t, t_func(t, "tanh", r), t_num(t, 2)), t_num(t, 1)));
+		}
+		break;
+	case S_OP:
+		switch(c.sym.content.func) {
+		case SUM:
+			return t_sum(t, dl, dr);
+		case SUB:
+			return t_sub(t, dl, dr);
+		case MUL:
+			return t_sum(t, t_mul(t, r, dl), t_mul(t, l, dr));
+		case FRAC:
+			return t_frac(t, t_sub(t, t_mul(t, r, dl), t_mul(t, l, dr)),
+				t_expt(t, r, t_num(t, 2)));
+		case EXPT:
+			if(l == TAPE_NIL || r == TAPE_NIL)
+				return TAPE_NIL;
+			if(is_num(SYM(t, r)) && is_num(SYM(t, l)))
+				return t_num(t, 0);
+			if(is_num(SYM(t, r))) {
+				n = SYM(t, r)->content.num;
+				return t_mul(t, r, t_expt(t, l, t_num(t, n - 1)));
+			}
+			/*
+			 * d/dx x ^ f(x) = d/dx exp(f(x) * log(x)), expanded
+			 * here since the new cells have no entry in d
+			 */
+			inner = t_mul(t, r, t_func(t, "log", l));
+			dinner = t_sum(t, t_mul(t, t_func(t, "log", l), dr),
+				t_mul(t, r, t_mul(t, dl, t_frac(t, t_num(t, 1), l))));
+			return t_mul(t, dinner, t_func(t, "exp", inner));
+		}
+		break;
+	default:
+		break;
+	}
+	return TAPE_NIL;
+}
+
+static uint32_t
+t_expt(Tape *t, uint32_t x, uint32_t y)
+{
+	if(x == TAPE_NIL || y == TAPE_NIL)
+		return TAPE_NIL;
+
+	if(num_equal(SYM(t, x), 1) || num_equal(SYM(t, y), 0))
+		return t_num(t, 1);
+	else if(num_equal(SYM(t, y), 1))
+		return x;
+	else if(is_num(SYM(t, x)) && is_num(SYM(t, y)))
+		return t_num(t, pow(SYM(t, x)->content.num, SYM(t, y)->content.num));
+	else
+		return t_op(t, '^', x, y);
+}
+
+static uint32_t
+t_frac(Tape *t, uint32_t x, uint32_t y)
+{
+	if(x == TAPE_NIL || y == TAPE_NIL)
+		return TAPE_NIL;
+
+	if(num_equal(SYM(t, x), 0))
+		return x;
+	else if(num_equal(SYM(t, y), 1))
+		return x;
+	else if(num_equal(SYM(t, y), 0))
+		return TAPE_NIL;
+	else if(is_num(SYM(t, y)) && is_num(SYM(t, x)))
+		return t_num(t, SYM(t, x)->content.num / SYM(t, y)->content.num);
+	else
+		return t_op(t, '/', x, y);
+}
+
+static uint32_t
+t_func(Tape *t, char *func, uint32_t x)
+{
+	if(x == TAPE_NIL)
+		return TAPE_NIL;
+	return tape_push(t, func_alloc(func), TAPE_NIL, x);
+}
+
+static uint32_t
+t_mul(Tape *t, uint32_t x, uint32_t y)
+{
+	if(x == TAPE_NIL || y == TAPE_NIL)
+		return TAPE_NIL;
+
+	if(num_equal(SYM(t, x), 1))
+		return y;
+	else if(num_equal(SYM(t, y), 1))
+		return x;
+	else if(num_equal(SYM(t, x), 0))
+		return x;
+	else if(num_equal(SYM(t, y), 0))
+		return y;
+	else if(is_num(SYM(t, y)) && is_num(SYM(t, x)))
+		return t_num(t, SYM(t, x)->content.num * SYM(t, y)->content.num);
+	else
+		return t_op(t, '*', x, y);
+}
+
+static uint32_t
+t_num(Tape *t, double num)
+{
+	return tape_push(t, num_alloc(num), TAPE_NIL, TAPE_NIL);
+}
+
+static uint32_t
+t_op(Tape *t, char op, uint32_t x, uint32_t y)
+{
+	return tape_push(t, operator_alloc(op), x, y);
+}
+
+static uint32_t
+t_sub(Tape *t, uint32_t x, uint32_t y)
+{
+	if(x == TAPE_NIL || y == TAPE_NIL)
+		return TAPE_NIL;
+
+	if(num_equal(SYM(t, x), 0))
+		return t_mul(t, t_num(t, -1), y);
+	else if(num_equal(SYM(t, y), 0))
+		return x;
+	else if(is_num(SYM(t, y)) && is_num(SYM(t, x)))
+		return t_num(t, SYM(t, x)->content.num - SYM(t, y)->content.num);
+	else
+		return t_op(t, '-', x, y);
+}
+
+static uint32_t
+t_sum(Tape *t, uint32_t x, uint32_t y)
+{
+	if(x == TAPE_NIL || y == TAPE_NIL)
+		return TAPE_NIL;
+
+	if(num_equal(SYM(t, x), 0))
+		return y;
+	else if(num_equal(SYM(t, y), 0))
+		return x;
+	else if(is_num(SYM(t, y)) && is_num(SYM(t, x)))
+		return t_num(t, SYM(t, x)->content.num + SYM(t, y)->content.num);
+	else
+		return t_op(t, '+', x, y);
+}
+
+Tape*
+tape_alloc(void)
+{
+	Tape *t;
+
+	t = emalloc(sizeof(Tape));
+	t->size = TAPE_MINSZ;
+	t->len = 0;
+	t->cells = emalloc(t->size * sizeof(Cell));
+	t->root = TAPE_NIL;
+	return t;
+}
+
+/*
+ * Differentiate t with respect to var. The result starts with a copy of t,
+ * derivative cells are appended after it.
+ */
+Tape*
+tape_dwrt(Tape *t, uint32_t var)
+{
+	uint32_t i, *d;
+	char *live;
+	Tape *diff;
+
+	diff = tape_alloc();
+	if(t->root == TAPE_NIL)
+		return diff;
+	diff->size = t->len < TAPE_MINSZ ? TAPE_MINSZ : 2 * t->len;
+	diff->cells = erealloc(diff->cells, diff->size * sizeof(Cell));
+	memcpy(diff->cells, t->cells, t->len * sizeof(Cell));
+	diff->len = t->len;
+
+	/* Cells left behind by a previous tape_dwrt are not differentiated */
+	live = ecalloc(t->len, sizeof(char));
+	live[t->root] = 1;
+	for(i = t->len; i-- > 0;) {
+		if(! live[i])
+			continue;
+		if(t->cells[i].left != TAPE_NIL)
+			live[t->cells[i].left] = 1;
+		if(t->cells[i].right != TAPE_NIL)
+			live[t->cells[i].right] = 1;
+	}
+
+	d = emalloc(t->len * sizeof(uint32_t));
+	for(i = 0; i < t->len; i++)
+		d[i] = live[i] ? t_dwrt(diff, i, d, var) : TAPE_NIL;
+	diff->root = d[t->root];
+
+	free(live);
+	free(d);
+	return diff;
+}
+
+void
+tape_free(Tape *t)
+{
+	if(t == NULL)
+		return;
+	free(t->cells);
+	free(t);
+}
+
+/*
+ * Compute the children of cells pushed in postfix order with TAPE_NIL
+ * children, as the parser does. The last cell becomes the root.
+ */
+void
+tape_link(Tape *t)
+{
+	uint32_t i, n, *stack;
+
+	stack = emalloc((t->len + 1) * sizeof(uint32_t));
+	n = 0;
+	for(i = 0; i < t->len; i++) {
+		switch(t->cells[i].sym.type) {
+		case S_OP:
+			t->cells[i].right = n > 0 ? stack[--n] : TAPE_NIL;
+			t->cells[i].left = n > 0 ? stack[--n] : TAPE_NIL;
+			break;
+		case S_FUNC:
+			t->cells[i].right = n > 0 ? stack[--n] : TAPE_NIL;
+			break;
+		default:
+			break;
+		}
+		stack[n++] = i;
+	}
+	t->root = t->len > 0 ? t->len - 1 : TAPE_NIL;
+	free(stack);
+}
+
+void
+tape_bprint(Buf *out, Tape *t)
+{
+	int paren;
+	Cell *c;
+	struct frame *f;
+	Stk s;
+
+	if(t->root == TAPE_NIL) return;
+
+	stk_init(&s, sizeof(struct frame));
+	push_frame(&s, t->root, NULL, 0);
+	while((f = stk_top(&s)) != NULL) {
+		c = &t->cells[f->i];
+		paren = paren_needed(f->previous, &c->sym, f->right);
+		switch(c->sym.type) {
+		case S_VAR:
+			buf_puts(out, var_name(c->sym.content.var));
+			break;
+		case S_NUM:
+			if(c->sym.content.num < 0)
+				buf_putc(out, '(');
+			buf_num(out, c->sym.content.num);
+			if(c->sym.content.num < 0)
+				buf_putc(out, ')');
+			break;
+		case S_FUNC:
+			if(f->stage++ == 0) {
+				buf_puts(out, bit_to_func(c->sym.content.func));
+				buf_putc(out, '(');
+				if(c->right != TAPE_NIL)
+					push_frame(&s, c->right, &c->sym, 1);
+				continue;
+			}
+			buf_putc(out, ')');
+			break;
+		case S_OP:
+			switch(f->stage++) {
+			case 0:
+				if(paren)
+					buf_putc(out, '(');
+				if(c->left != TAPE_NIL)
+					push_frame(&s, c->left, &c->sym, 0);
+				continue;
+			case 1:
+				buf_putc(out, ' ');
+				buf_putc(out, bit_to_op(c->sym.content.func));
+				buf_putc(out, ' ');
+				if(c->right != TAPE_NIL)
+					push_frame(&s, c->right, &c->sym, 1);
+				continue;
+			}
+			if(paren)
+				buf_putc(out, ')');
+			break;
+		default:
+			break;
+		}
+		stk_pop(&s);
+	}
+	stk_free(&s);
+}
+
+void
+tape_print(Tape *t)
+{
+	Buf b;
+
+	fflush(stdout);
+	buf_init(&b, STDOUT_FILENO);
+	tape_bprint(&b, t);
+	buf_flush(&b);
+	buf_free(&b);
+}
+
+/*
+ * Append a cell to t and return its index, children must already be in t
+ */
+uint32_t
+tape_push(Tape *t, Symbol sym, uint32_t left, uint32_t right)
+{
+	if(t->len == t->size) {
+		if(t->size >= TAPE_NIL / 2) {
+			fprintf(stderr, "tape_push: expression too long\n");
+			exit(1);
+		}
+		t->size *= 2;
+		t->cells = erealloc(t->cells, t->size * sizeof(Cell));
+	}
+	t->cells[t->len].sym = sym;
+	t->cells[t->len].left = left;
+	t->cells[t->len].right = right;
+	return t->len++;
+}
+
+/*
+ * Build the tree of t's root, cells reachable along several paths become
+ * shared nodes.
+ */
+Node*
+tape_to_ast(Tape *t)
+{
+	uint32_t i;
+	Node *ast, **nodes;
+	Cell *c;
+
+	if(t->root == TAPE_NIL)
+		return NULL;
+	nodes = emalloc(t->len * sizeof(Node*));
+	for(i = 0; i <= t->root; i++) {
+		c = &t->cells[i];
+		nodes[i] = ast_alloc(c->sym);
+		if(c->left != TAPE_NIL)
+			nodes[i]->left = ast_copy(nodes[c->left]);
+		if(c->right != TAPE_NIL)
+			nodes[i]->right = ast_copy(nodes[c->right]);
+	}
+	ast = nodes[t->root];
+	for(i = 0; i < t->root; i++)
+		ast_free(nodes[i]);
+	free(nodes);
+	return ast;
+}
+
+void
+tape_bprint_latex(Buf *out, Tape *t)
+{
+	int paren;
+	char op, *name;
+	Cell *c;
+	struct frame *f;
+	Stk s;
+
+	if(t->root == TAPE_NIL) return;
+
+	stk_init(&s, sizeof(struct frame));
+	push_frame(&s, t->root, NULL, 0);
+	while((f = stk_top(&s)) != NULL) {
+		c = &t->cells[f->i];
+		paren = paren_needed(f->previous, &c->sym, f->right);
+		switch(c->sym.type) {
+		case S_VAR:
+			name = var_name(c->sym.content.var);
+			if(name[1] != '\0')
+				buf_puts(out, "\\mathit{");
+			buf_puts(out, name);
+			if(name[1] != '\0')
+				buf_putc(out, '}');
+			break;
+		case S_NUM:
+			if(c->sym.content.num < 0)
+				buf_puts(out, "\\left(");
+			buf_num(out, c->sym.content.num);
+			if(c->sym.content.num < 0)
+				buf_puts(out, "\\right)");
+			break;
+		case S_FUNC:
+			if(f->stage++ == 0) {
+				buf_putc(out, '\\');
+				buf_puts(out, bit_to_func(c->sym.content.func));
+				buf_puts(out, "\\left(");
+				if(c->right != TAPE_NIL)
+					push_frame(&s, c->right, NULL, 0);
+				continue;
+			}
+			buf_puts(out, "\\right)");
+			break;
+		case S_OP:
+			op = bit_to_op(c->sym.content.func);
+			switch(f->stage++) {
+			case 0:
+				if(paren)
+					buf_puts(out, "\\left(");
+				if(op == '/')
+					buf_puts(out, "\\frac{");
+				if(c->left != TAPE_NIL)
+					push_frame(&s, c->left, op == '/' ? NULL : &c->sym, 0);
+				continue;
+			case 1:
+				if(op == '/')
+					buf_puts(out, "}{");
+				else if(op == '^')
+					buf_puts(out, "^{");
+				else
+					buf_putc(out, op);
+				if(c->right != TAPE_NIL)
+					push_frame(&s, c->right, op == '/' || op == '^' ? NULL : &c->sym, 1);
+				continue;
+			}
+			if(op == '/' || op == '^')
+				buf_putc(out, '}');
+			if(paren)
+				buf_puts(out, "\\right)");
+			break;
+		default:
+			break;
+		}
+		stk_pop(&s);
+	}
+	stk_free(&s);
+}
+
+void
+tape_to_latex(Tape *t)
+{
+	Buf b;
+
+	fflush(stdout);
+	buf_init(&b, STDOUT_FILENO);
+	tape_bprint_latex(&b, t);
+	buf_flush(&b);
+	buf_free(&b);
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../dat.h"
+#include "../fns.h"
+
+START_TEST(test_arena_alloc)
+{
+	Arena *a;
+
+	a = arena_alloc();
+	ck_assert_ptr_nonnull(a);
+	ck_assert_ptr_null(a->blocks);
+
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_arena_get_aligned)
+{
+	char *p, *q;
+	Arena *a;
+
+	a = arena_alloc();
+	p = arena_get(a, 1);
+	q = arena_get(a, 1);
+	ck_assert_ptr_nonnull(p);
+	ck_assert_ptr_nonnull(q);
+	ck_assert(q - p >= (long)sizeof(double));
+	ck_assert_uint_eq((uintptr_t)q % sizeof(double), 0);
+
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_arena_get_big)
+{
+	char *p;
+	size_t i, sz;
+	Arena *a;
+
+	a = arena_alloc();
+	sz = 1024 * 1024;
+	p = arena_get(a, sz);
+	for(i = 0; i < sz; i++)
+		p[i] = 'a';
+	ck_assert(p[sz - 1] == 'a');
+
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_arena_get_many)
+{
+	size_t i;
+	double *p;
+	Arena *a;
+
+	a = arena_alloc();
+	for(i = 0; i < 100000; i++) {
+		p = arena_get(a, sizeof(double));
+		*p = i;
+		ck_assert_double_eq(*p, i);
+	}
+
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_arena_merge)
+{
+	char *p, *q;
+	Arena *a, *b;
+
+	a = arena_alloc();
+	b = arena_alloc();
+	arena_merge(a, b);
+	ck_assert_ptr_null(a->blocks);
+
+	b = arena_alloc();
+	q = arena_get(b, 16);
+	arena_merge(a, b);
+	ck_assert((char*)a->blocks < q && q < a->end);
+
+	b = arena_alloc();
+	arena_get(b, 16);
+	arena_get(b, 1024 * 1024);
+	p = arena_get(a, 16);
+	arena_merge(a, b);
+	ck_assert_ptr_eq(arena_get(a, 16), p + 16);
+	ck_assert_ptr_nonnull(*(void**)a->blocks);
+
+	arena_free(a); /* and b's blocks */
+}
+END_TEST
+
+START_TEST(test_arena_owns)
+{
+	char *big, *p, *q;
+	Arena *a;
+
+	a = arena_alloc();
+	ck_assert(! arena_owns(a, a));
+	p = arena_get(a, 16);
+	big = arena_get(a, 1024 * 1024); /* in a block of its own */
+	q = emalloc(16);
+	ck_assert(arena_owns(a, p));
+	ck_assert(arena_owns(a, big + 1024 * 1024 - 1));
+	ck_assert(! arena_owns(a, q));
+	ck_assert(! arena_owns(NULL, p));
+
+	free(q);
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_arena_reset)
+{
+	size_t i;
+	char *p;
+	Arena *a;
+
+	a = arena_alloc();
+	arena_reset(a);
+	ck_assert_ptr_null(a->blocks);
+	for(i = 0; i < 100000; i++)
+		arena_get(a, 64);
+	ck_assert_ptr_nonnull(*(void**)a->blocks);
+
+	arena_reset(a);
+	ck_assert_ptr_null(*(void**)a->blocks);
+	p = arena_get(a, 16);
+	ck_assert(p > (char*)a->blocks && p < a->end);
+	arena_reset(a);
+	ck_assert_ptr_eq(arena_get(a, 16), p);
+
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_arena_use)
+{
+	Arena *a, *prev;
+
+	a = arena_alloc();
+	ck_assert_ptr_null(arena_cur());
+
+	prev = arena_use(a);
+	ck_assert_ptr_null(prev);
+	ck_assert_ptr_eq(arena_cur(), a);
+
+	prev = arena_use(prev);
+	ck_assert_ptr_eq(prev, a);
+	ck_assert_ptr_null(arena_cur());
+
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_amalloc_arena)
+{
+	void *p;
+	Arena *a;
+
+	a = arena_alloc();
+	arena_use(a);
+	p = amalloc(16);
+	ck_assert_ptr_nonnull(a->blocks);
+	ck_assert((char*)p >= (char*)a->blocks && (char*)p < a->end);
+	afree(p); /* no-op */
+
+	arena_free(a);
+	ck_assert_ptr_null(arena_cur());
+}
+END_TEST
+
+START_TEST(test_amalloc_heap)
+{
+	void *p;
+
+	p = amalloc(16);
+	ck_assert_ptr_nonnull(p);
+	afree(p);
+}
+END_TEST
+
+Suite*
+arena_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("arena");
+
+	tc_core = tcase_create("core");
+
+	tcase_add_test(tc_core, test_arena_alloc);
+	tcase_add_test(tc_core, test_arena_get_aligned);
+	tcase_add_test(tc_core, test_arena_get_big);
+	tcase_add_test(tc_core, test_arena_get_many);
+	tcase_add_test(tc_core, test_arena_merge);
+	tcase_add_test(tc_core, test_arena_owns);
+	tcase_add_test(tc_core, test_arena_reset);
+	tcase_add_test(tc_core, test_arena_use);
+	tcase_add_test(tc_core, test_amalloc_arena);
+	tcase_add_test(tc_core, test_amalloc_heap);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int
+main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = arena_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
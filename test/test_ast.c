@@ -25,6 +25,17 @@
 #include "../dat.h"
 #include "../fns.h"
 
+static char*
+let_string(Node *ast, int flags)
+{
+	Buf b;
+
+	buf_init(&b, -1);
+	ast_bprint_let(&b, ast, flags);
+	buf_putc(&b, '\0');
+	return b.data;
+}
+
 /* Test allocations */
 
 START_TEST(test_ast_alloc)
@@ -34,7 +45,6 @@ START_TEST(test_ast_alloc)
 	node = ast_alloc(func_alloc("sin"));
 	ck_assert_ptr_null(node->left);
 	ck_assert_ptr_null(node->right);
-	ck_assert_ptr_null(node->parent);
 
 	ast_free(node);
 }
@@ -42,71 +52,59 @@ END_TEST
 
 START_TEST(test_func_alloc)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = func_alloc("sin");
-	ck_assert(sym->type == S_FUNC);
-	ck_assert_uint_eq(sym->content.func, SIN);
-
-	symbol_free(sym);
+	ck_assert(sym.type == S_FUNC);
+	ck_assert_uint_eq(sym.content.func, SIN);
 }
 END_TEST
 
 START_TEST(test_lparen_alloc)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = lparen_alloc();
-	ck_assert(sym->type == S_LPAREN);
-
-	symbol_free(sym);
+	ck_assert(sym.type == S_LPAREN);
 }
 END_TEST
 
 START_TEST(test_num_alloc)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = num_alloc(5);
-	ck_assert(sym->type == S_NUM);
-	ck_assert_double_eq(sym->content.num, 5);
-
-	symbol_free(sym);
+	ck_assert(sym.type == S_NUM);
+	ck_assert_double_eq(sym.content.num, 5);
 }
 END_TEST
 
 START_TEST(test_operator_alloc)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = operator_alloc('+');
-	ck_assert(sym->type == S_OP);
-	ck_assert_uint_eq(sym->content.func, SUM);
-
-	symbol_free(sym);
+	ck_assert(sym.type == S_OP);
+	ck_assert_uint_eq(sym.content.func, SUM);
 }
 END_TEST
 
 START_TEST(test_rparen_alloc)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = rparen_alloc();
-	ck_assert(sym->type == S_RPAREN);
-
-	symbol_free(sym);
+	ck_assert(sym.type == S_RPAREN);
 }
 END_TEST
 
 START_TEST(test_var_alloc)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = var_alloc('x');
-	ck_assert(sym->type == S_VAR);
-	ck_assert(sym->content.var == 'x');
-
-	symbol_free(sym);
+	ck_assert(sym.type == S_VAR);
+	ck_assert(sym.content.var == 'x');
 }
 END_TEST
 
@@ -126,15 +124,16 @@ START_TEST(test_ast_copy_shallow)
 	Node *dest, *src;
 
 	src = ast_alloc(num_alloc(5));
+	ck_assert_uint_eq(src->refs, 1);
 
 	dest = ast_copy(src);
-	ck_assert(is_num(dest->sym));
-	ck_assert(num_equal(dest->sym, 5));
-	ck_assert(dest != src);
-	ck_assert_ptr_null(dest->right);
-	ck_assert_ptr_null(dest->left);
+	ck_assert_ptr_eq(dest, src);
+	ck_assert_uint_eq(src->refs, 2);
+	ck_assert(num_equal(&dest->sym, 5));
 
 	ast_free(dest);
+	ck_assert_uint_eq(src->refs, 1);
+	ck_assert(num_equal(&src->sym, 5));
 	ast_free(src);
 }
 END_TEST
@@ -149,26 +148,143 @@ START_TEST(test_ast_copy_deep)
 	src->right->right = ast_alloc(num_alloc(6));
 
 	dest = ast_copy(src);
-	ck_assert(is_operator(dest->sym));
-	ck_assert_uint_eq(dest->sym->content.func, SUM);
-	ck_assert(dest != src);
-	ck_assert_ptr_nonnull(dest->right);
-	ck_assert_ptr_nonnull(dest->left);
+	ck_assert_ptr_eq(dest, src);
+	ck_assert_uint_eq(src->refs, 2);
+	/* Children are shared through their parent */
+	ck_assert_uint_eq(src->left->refs, 1);
+	ck_assert_uint_eq(src->right->refs, 1);
 
-	ck_assert(dest->right != src->right);
-	ck_assert(dest->left != src->left);
+	ast_free(src);
+	ck_assert_uint_eq(dest->sym.content.func, SUM);
+	ck_assert(num_equal(&dest->left->sym, 5));
+	ck_assert_uint_eq(dest->right->sym.content.func, SIN);
+	ck_assert(num_equal(&dest->right->right->sym, 6));
+	ast_free(dest);
+}
+END_TEST
 
-	ck_assert(is_num(dest->left->sym));
-	ck_assert(num_equal(dest->left->sym, 5));
+START_TEST(test_ast_copy_arena)
+{
+	Arena *a;
+	Node *dest, *src;
 
-	ck_assert(is_function(dest->right->sym));
-	ck_assert_uint_eq(dest->right->sym->content.func, SIN);
+	a = arena_alloc();
+	arena_use(a);
+	src = ast_alloc(num_alloc(5));
+	ck_assert_uint_eq(src->refs, 0);
+	dest = ast_copy(src);
+	ck_assert_ptr_eq(dest, src);
+	ck_assert_uint_eq(src->refs, 0);
+	arena_use(NULL);
 
-	ck_assert_ptr_null(dest->right->left);
-	ck_assert(num_equal(dest->right->right->sym, 6));
+	ast_free(dest); /* no-op, released by arena_free */
+	arena_free(a);
+}
+END_TEST
+
+START_TEST(test_ast_unshare)
+{
+	Node *copy, *dest, *src;
+
+	src = ast_alloc(operator_alloc('*'));
+	ast_insert(src, ast_alloc(var_alloc('x')));
+	ast_insert(src, ast_alloc(num_alloc(2)));
+
+	dest = ast_unshare(src);
+	ck_assert_ptr_eq(dest, src);
+
+	copy = ast_copy(src);
+	dest = ast_unshare(copy);
+	ck_assert(dest != src);
+	ck_assert_uint_eq(src->refs, 1);
+	ck_assert_uint_eq(dest->refs, 1);
+	ck_assert_uint_eq(dest->sym.content.func, MUL);
+	ck_assert_ptr_eq(dest->left, src->left);
+	ck_assert_ptr_eq(dest->right, src->right);
+	ck_assert_uint_eq(src->left->refs, 2);
 
-	ast_free(dest);
 	ast_free(src);
+	ck_assert(num_equal(&dest->left->sym, 2));
+	ck_assert(is_same_var(&dest->right->sym, 'x'));
+	ast_free(dest);
+}
+END_TEST
+
+START_TEST(test_ast_bprint_let)
+{
+	char *str;
+	Node *ast, *sine, *sq;
+	Dag *d;
+
+	d = dag_alloc();
+	dag_use(d);
+	arena_use(d->arena);
+	/* (1 + x ^ 2) * sin(x * (1 + x ^ 2)) + sin(x * (1 + x ^ 2)) / x */
+	sq = ast_sum(ast_alloc(num_alloc(1)), ast_expt(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(2))));
+	sine = ast_sin(ast_mul(ast_alloc(var_alloc('x')), sq));
+	ast = ast_sum(ast_mul(sq, sine), ast_frac(ast_sin(ast_mul(ast_alloc(var_alloc('x')), sq)),
+		ast_alloc(var_alloc('x'))));
+	arena_use(NULL);
+	dag_use(NULL);
+
+	str = let_string(ast, 0);
+	ck_assert_str_eq(str, "t1 = 1 + x ^ 2; t2 = sin(x * t1); result = t1 * t2 + t2 / x");
+	free(str);
+	str = let_string(ast, D_LATEX);
+	ck_assert_str_eq(str, "t_{1}=1+x^{2};\\;t_{2}=\\sin\\left(x*t_{1}\\right);\\;\\mathit{result}=t_{1}*t_{2}+\\frac{t_{2}}{x}");
+	free(str);
+
+	/* Once the bindings are printed plain printing is back */
+	str = ast_sprint(ast);
+	ck_assert_str_eq(str, "(1 + x ^ 2) * sin(x * (1 + x ^ 2)) + sin(x * (1 + x ^ 2)) / x");
+	free(str);
+
+	dag_free(d);
+}
+END_TEST
+
+START_TEST(test_ast_bprint_let_tree)
+{
+	char *str;
+	Node *ast, *sine, *sq;
+
+	/* The same expression with no node shared: equal subtrees still count */
+	sq = ast_sum(ast_alloc(num_alloc(1)), ast_expt(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(2))));
+	sine = ast_sin(ast_mul(ast_alloc(var_alloc('x')), sq));
+	sq = ast_sum(ast_alloc(num_alloc(1)), ast_expt(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(2))));
+	ast = ast_mul(sq, sine);
+	sq = ast_sum(ast_alloc(num_alloc(1)), ast_expt(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(2))));
+	sine = ast_sin(ast_mul(ast_alloc(var_alloc('x')), sq));
+	ast = ast_sum(ast, ast_frac(sine, ast_alloc(var_alloc('x'))));
+
+	str = let_string(ast, 0);
+	ck_assert_str_eq(str, "t1 = 1 + x ^ 2; t2 = sin(x * t1); result = t1 * t2 + t2 / x");
+	free(str);
+
+	ast_free(ast);
+}
+END_TEST
+
+START_TEST(test_ast_bprint_let_small)
+{
+	char *str;
+	Node *ast;
+	Dag *d;
+
+	d = dag_alloc();
+	dag_use(d);
+	arena_use(d->arena);
+	/* sin(x) * sin(x), not worth a binding */
+	ast = ast_mul(ast_sin(ast_alloc(var_alloc('x'))), ast_sin(ast_alloc(var_alloc('x'))));
+	arena_use(NULL);
+	dag_use(NULL);
+	ck_assert_ptr_eq(ast->left, ast->right);
+
+	str = let_string(ast, 0);
+	ck_assert_str_eq(str, "result = sin(x) * sin(x)");
+	free(str);
+
+	dag_free(d);
 }
 END_TEST
 
@@ -199,11 +315,11 @@ START_TEST(test_ast_insert)
 
 	ast_insert(node, ast_alloc(num_alloc(42)));
 	ck_assert_ptr_nonnull(node->right);
-	ck_assert(num_equal(node->right->sym, 42));
+	ck_assert(num_equal(&node->right->sym, 42));
 
 	ast_insert(node, ast_alloc(num_alloc(55)));
 	ck_assert_ptr_nonnull(node->left);
-	ck_assert(num_equal(node->left->sym, 55));
+	ck_assert(num_equal(&node->left->sym, 55));
 
 	ast_free(node);
 }
@@ -213,57 +329,47 @@ END_TEST
 
 START_TEST(test_is_function)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = func_alloc("sin");
-	ck_assert(is_function(sym));
-
-	symbol_free(sym);
+	ck_assert(is_function(&sym));
 }
 END_TEST
 
 START_TEST(test_is_lparen)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = lparen_alloc();
-	ck_assert(is_lparen(sym));
-
-	symbol_free(sym);
+	ck_assert(is_lparen(&sym));
 }
 END_TEST
 
 START_TEST(test_is_operator)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = operator_alloc('+');
-	ck_assert(is_operator(sym));
-
-	symbol_free(sym);
+	ck_assert(is_operator(&sym));
 }
 END_TEST
 
 START_TEST(test_is_num)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = num_alloc(44);
-	ck_assert(is_num(sym));
-
-	symbol_free(sym);
+	ck_assert(is_num(&sym));
 }
 END_TEST
 
 START_TEST(test_num_equal)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = num_alloc(44);
-	ck_assert(is_num(sym));
-	ck_assert(num_equal(sym, 44));
-
-	symbol_free(sym);
+	ck_assert(is_num(&sym));
+	ck_assert(num_equal(&sym, 44));
 }
 END_TEST
 
@@ -290,6 +396,11 @@ ast_suite(void)
 	tcase_add_test(tc_ast, test_ast_copy_null);
 	tcase_add_test(tc_ast, test_ast_copy_shallow);
 	tcase_add_test(tc_ast, test_ast_copy_deep);
+	tcase_add_test(tc_ast, test_ast_copy_arena);
+	tcase_add_test(tc_ast, test_ast_unshare);
+	tcase_add_test(tc_ast, test_ast_bprint_let);
+	tcase_add_test(tc_ast, test_ast_bprint_let_tree);
+	tcase_add_test(tc_ast, test_ast_bprint_let_small);
 	tcase_add_test(tc_ast, test_ast_insert_null);
 	tcase_add_test(tc_ast, test_ast_insert_in_null);
 	tcase_add_test(tc_ast, test_ast_insert);
@@ -0,0 +1,345 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../dat.h"
+#include "../fns.h"
+
+static Parser*	reader(Buf*);
+static char*	round_trip(char*);
+static Parser*	text(char*);
+
+/*
+ * Parser over the records of b, which it takes
+ */
+static Parser*
+reader(Buf *b)
+{
+	return p_alloc_data("test", b->data, b->len);
+}
+
+/*
+ * expr parsed, written as a record, read back and printed
+ */
+static char*
+round_trip(char *expr)
+{
+	char *str;
+	Buf b;
+	Parser *p;
+
+	p = text(expr);
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	buf_init(&b, -1);
+	bin_write(&b, p->ast);
+	p_free(p);
+
+	p = reader(&b);
+	ck_assert_msg(bin_parse(p) == 0, "%s", p->err);
+	ck_assert(p->l->pos == p->l->data + p->l->len);
+	str = ast_sprint(p->ast);
+	p_free(p);
+	return str;
+}
+
+static Parser*
+text(char *expr)
+{
+	char *data;
+
+	data = emalloc(strlen(expr) + 1);
+	strcpy(data, expr);
+	return p_alloc_data("test", data, strlen(expr));
+}
+
+START_TEST(test_bin_round_trip)
+{
+	size_t i;
+	char *str;
+	char *exprs[] = {
+		"x",
+		"sin(x) * 2",
+		"tan(x ^ 3) / exp(y) - cosh(alpha * x) + 3.25",
+		"log(x - 2) ^ 2 / (1 + x) * tanh(sinh(cos(beta)))",
+		"1234567 + 0.1 * 1e+300"
+	};
+
+	for(i = 0; i < LEN(exprs); i++) {
+		str = round_trip(exprs[i]);
+		ck_assert_str_eq(str, exprs[i]);
+		free(str);
+	}
+}
+END_TEST
+
+START_TEST(test_bin_numbers)
+{
+	size_t i;
+	double nums[] = {0, -0.0, 1, -1, 63, -64, 0.1, -2.5, 9007199254740992.0,
+		-9007199254740994.0, 1e300, -4.9e-324};
+	Buf b;
+	Parser *p;
+	Node *n;
+
+	buf_init(&b, -1);
+	for(i = 0; i < LEN(nums); i++) {
+		n = ast_alloc(num_alloc(nums[i]));
+		bin_write(&b, n);
+		ast_free(n);
+	}
+	/* small integers take an opcode and a byte */
+	ck_assert_uint_eq((unsigned char)b.data[0], 0x01);
+	ck_assert_uint_eq((unsigned char)b.data[1], 3);
+
+	p = reader(&b);
+	for(i = 0; i < LEN(nums); i++) {
+		p_reset(p);
+		ck_assert_msg(bin_parse(p) == 0, "%s", p->err);
+		ck_assert(is_num(&p->ast->sym));
+		ck_assert(memcmp(&p->ast->sym.content.num, &nums[i], sizeof(double)) == 0);
+	}
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_bin_tape)
+{
+	char *a, *t;
+	Buf b;
+	Node *back;
+	Parser *p;
+
+	p = text("x ^ x * log(cos(x)) / (x - 2)");
+	ck_assert(parse(p) == 0);
+	buf_init(&b, -1);
+	bin_write(&b, p->ast);
+	a = ast_sprint(p->ast);
+	p_free(p);
+
+	p = reader(&b);
+	p->tape = tape_alloc();
+	ck_assert(bin_parse(p) == 0);
+	ck_assert_uint_eq(p->tape->root, p->tape->len - 1);
+	back = tape_to_ast(p->tape);
+	t = ast_sprint(back);
+	ck_assert_str_eq(t, a);
+
+	ast_free(back);
+	free(a);
+	free(t);
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_bin_empty)
+{
+	Buf b;
+	Parser *p;
+
+	buf_init(&b, -1);
+	bin_write(&b, NULL);
+	ck_assert_uint_eq(b.len, 3);
+	p = reader(&b);
+	ck_assert(bin_parse(p) == 0);
+	ck_assert_ptr_null(p->ast);
+	ck_assert(bin_parse(p) == 0); /* past the end */
+	ck_assert_ptr_null(p->ast);
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_bin_malformed)
+{
+	size_t i;
+	Buf b;
+	Parser *p;
+	struct {
+		char *data;
+		size_t len;
+		char *err;
+	} tests[] = {
+		{"\001\005\000\003", 4, "test: truncated record\n"},
+		{"\001\200", 2, "test: truncated record\n"},
+		{"\007\000", 2, "test: unknown record\n"},
+		{"\001\002\000\020", 4, "test: malformed record\n"}, /* no operands */
+		{"\001\003\000\003\000", 5, "test: malformed record\n"}, /* no such variable */
+		{"\001\004\000\001\001\077", 6, "test: malformed record\n"}, /* opcode */
+		{"\001\006\000\001\001\001\002\040", 8, "test: malformed record\n"}, /* two left */
+		{"\001\004\001\001\061\000", 6, "test: malformed record\n"}, /* not a letter */
+		{"\001\003\000\002\000", 5, "test: malformed record\n"}, /* short double */
+		{"\002\004oops", 6, "oops"}
+	};
+
+	for(i = 0; i < LEN(tests); i++) {
+		buf_init(&b, -1);
+		buf_write(&b, tests[i].data, tests[i].len);
+		p = reader(&b);
+		ck_assert_int_eq(bin_parse(p), -1);
+		ck_assert_str_eq(p->err, tests[i].err);
+		p_free(p);
+	}
+}
+END_TEST
+
+START_TEST(test_bin_open)
+{
+	Buf b;
+	Parser *p;
+
+	buf_init(&b, -1);
+	buf_write(&b, BIN_MAGIC, BIN_MAGICSZ);
+	p = reader(&b);
+	ck_assert(bin_open(p) == 0);
+	ck_assert(p->l->pos == p->l->data + BIN_MAGICSZ);
+	p_free(p);
+
+	p = text("sin(x)");
+	ck_assert_int_eq(bin_open(p), -1);
+	ck_assert_str_eq(p->err, "test: not a version 1 dwrt binary file\n");
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_bin_records)
+{
+	size_t len;
+	Buf b;
+	Node *n;
+
+	buf_init(&b, -1);
+	n = ast_sin(ast_alloc(var_alloc('x')));
+	bin_write(&b, n);
+	len = b.len;
+	bin_error(&b, "error\n");
+	ck_assert_uint_eq(bin_records(b.data, b.len), b.len);
+	ck_assert_uint_eq(bin_records(b.data, b.len - 1), len);
+	ck_assert_uint_eq(bin_records(b.data, len - 1), 0);
+	ck_assert_uint_eq(bin_records(b.data, 0), 0);
+
+	ast_free(n);
+	buf_free(&b);
+}
+END_TEST
+
+/*
+ * Binary derivatives of batch are read back by batch and by pool_batch
+ */
+START_TEST(test_bin_batch)
+{
+	int flags, nerr;
+	size_t i, len;
+	char *got;
+	Buf bin, want;
+	Dag *dag;
+	FILE *in, *out;
+	Parser *p;
+
+	in = tmpfile();
+	ck_assert_ptr_nonnull(in);
+	for(i = 0; i < 20000; i++) {
+		if(i % 97 == 0)
+			fprintf(in, "x $ %lu\n", (unsigned long)i);
+		else
+			fprintf(in, "sin(x * %lu) ^ 2 + x * yy\n", (unsigned long)i);
+	}
+	rewind(in);
+	got = readall(in, &len);
+	p = p_alloc_data("stdin", got, len);
+	dag = dag_alloc();
+	buf_init(&bin, -1);
+	buf_write(&bin, BIN_MAGIC, BIN_MAGICSZ);
+	ck_assert_int_eq(batch(p, dag, 'x', D_BIN_OUT, &bin), 207);
+	p_free(p);
+	fclose(in);
+
+	flags = D_BIN_IN | D_BIN_OUT;
+	buf_init(&want, -1);
+	buf_write(&want, BIN_MAGIC, BIN_MAGICSZ);
+	p = p_alloc_data("stdin", emalloc(bin.len), bin.len);
+	memcpy(p->l->data, bin.data, bin.len);
+	ck_assert(bin_open(p) == 0);
+	nerr = batch(p, dag, 'x', flags, &want);
+	ck_assert_int_eq(nerr, 207); /* the error records */
+	p_free(p);
+
+	in = tmpfile();
+	ck_assert_ptr_nonnull(in);
+	fwrite(bin.data, sizeof(char), bin.len, in);
+	rewind(in);
+	out = tmpfile();
+	ck_assert_ptr_nonnull(out);
+	ck_assert_int_eq(pool_batch(NULL, in, out, 3, 'x', flags), nerr);
+	rewind(out);
+	got = readall(out, &len);
+	ck_assert_uint_eq(len, want.len);
+	ck_assert(memcmp(got, want.data, len) == 0);
+
+	free(got);
+	fclose(in);
+	fclose(out);
+	buf_free(&bin);
+	buf_free(&want);
+	dag_free(dag);
+}
+END_TEST
+
+Suite*
+bin_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("bin");
+
+	tc_core = tcase_create("core");
+
+	tcase_add_test(tc_core, test_bin_round_trip);
+	tcase_add_test(tc_core, test_bin_numbers);
+	tcase_add_test(tc_core, test_bin_tape);
+	tcase_add_test(tc_core, test_bin_empty);
+	tcase_add_test(tc_core, test_bin_malformed);
+	tcase_add_test(tc_core, test_bin_open);
+	tcase_add_test(tc_core, test_bin_records);
+	tcase_add_test(tc_core, test_bin_batch);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int
+main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = bin_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
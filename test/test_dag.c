@@ -0,0 +1,222 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../dat.h"
+#include "../fns.h"
+
+START_TEST(test_dag_intern_shares)
+{
+	Dag *d;
+	Node *ast, *shared;
+
+	/* sin(x) * sin(x) */
+	ast = ast_alloc(operator_alloc('*'));
+	ast_insert(ast, ast_sin(ast_alloc(var_alloc('x'))));
+	ast_insert(ast, ast_sin(ast_alloc(var_alloc('x'))));
+	ck_assert(ast->left != ast->right);
+
+	d = dag_alloc();
+	shared = dag_intern(d, ast);
+	ck_assert_ptr_nonnull(shared);
+	ck_assert(shared != ast);
+	ck_assert_ptr_eq(shared->left, shared->right);
+	ck_assert_uint_eq(shared->sym.content.func, MUL);
+	ck_assert_uint_eq(shared->left->sym.content.func, SIN);
+	ck_assert(is_same_var(&shared->left->right->sym, 'x'));
+	ck_assert_ptr_eq(dag_intern(d, ast), shared);
+
+	ast_free(ast);
+	dag_free(d);
+}
+END_TEST
+
+START_TEST(test_dag_intern_distinct)
+{
+	Dag *d;
+	Node *a, *b;
+
+	a = ast_sin(ast_alloc(var_alloc('x')));
+	b = ast_sin(ast_alloc(var_alloc('y')));
+
+	d = dag_alloc();
+	ck_assert(dag_intern(d, a) != dag_intern(d, b));
+
+	ast_free(a);
+	ast_free(b);
+	dag_free(d);
+}
+END_TEST
+
+START_TEST(test_hcons)
+{
+	Dag *d, *prev;
+	Node *a, *b;
+
+	d = dag_alloc();
+	prev = dag_use(d);
+	ck_assert_ptr_null(prev);
+	ck_assert_ptr_eq(dag_cur(), d);
+	ck_assert_ptr_null(arena_cur()); /* switched by the caller */
+	arena_use(d->arena);
+
+	a = ast_cos(ast_mul(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(2))));
+	b = ast_cos(ast_mul(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(2))));
+	ck_assert_ptr_eq(a, b);
+	ck_assert_ptr_eq(ast_copy(a), a);
+
+	arena_use(NULL);
+	dag_use(prev);
+	ck_assert_ptr_null(dag_cur());
+	ck_assert_ptr_null(arena_cur());
+	dag_free(d);
+}
+END_TEST
+
+START_TEST(test_hcons_no_dag)
+{
+	Node *a, *b;
+
+	a = ast_cos(ast_alloc(var_alloc('x')));
+	b = ast_cos(ast_alloc(var_alloc('x')));
+	ck_assert(a != b);
+
+	ast_free(a);
+	ast_free(b);
+}
+END_TEST
+
+START_TEST(test_dag_dwrt_memo)
+{
+	Dag *d, *prev;
+	Node *ast, *diff;
+
+	d = dag_alloc();
+	prev = dag_use(d);
+	arena_use(d->arena);
+
+	ast = ast_tan(ast_mul(ast_alloc(var_alloc('x')), ast_alloc(var_alloc('x'))));
+	diff = ast_dwrt(ast, 'x');
+	ck_assert_ptr_nonnull(diff);
+	ck_assert_ptr_eq(dag_lookup(d, ast, 'x'), diff);
+	ck_assert_ptr_eq(ast_dwrt(ast, 'x'), diff);
+	ck_assert_ptr_null(dag_lookup(d, ast, 'y'));
+
+	arena_use(NULL);
+	dag_use(prev);
+	dag_free(d);
+}
+END_TEST
+
+START_TEST(test_dag_dwrt_deep)
+{
+	int i;
+	size_t n;
+	Dag *d, *prev;
+	Node *ast, *diff;
+
+	d = dag_alloc();
+	prev = dag_use(d);
+	arena_use(d->arena);
+
+	/* 2^64 leaves as a tree, 65 distinct nodes as a dag */
+	ast = ast_sin(ast_alloc(var_alloc('x')));
+	for(i = 0; i < 64; i++)
+		ast = ast_mul(ast, ast_copy(ast));
+	n = d->nnodes;
+	ck_assert_uint_eq(n, 65);
+
+	diff = ast_dwrt(ast, 'x');
+	ck_assert_ptr_nonnull(diff);
+	ck_assert_uint_eq(diff->sym.content.func, SUM);
+	ck_assert(d->nnodes - n < 64 * 8);
+
+	arena_use(NULL);
+	dag_use(prev);
+	dag_free(d);
+}
+END_TEST
+
+START_TEST(test_dag_intern_long)
+{
+	int i;
+	Dag *d;
+	Node *ast, *shared;
+
+	/* sin(x) - sin(x) - ... - sin(x) */
+	ast = ast_sin(ast_alloc(var_alloc('x')));
+	for(i = 1; i < 1000000; i++)
+		ast = ast_sub(ast, ast_sin(ast_alloc(var_alloc('x'))));
+
+	d = dag_alloc();
+	shared = dag_intern(d, ast);
+	ck_assert_uint_eq(shared->sym.content.func, SUB);
+	ck_assert_ptr_eq(shared->right, shared->left->right);
+	ck_assert_uint_eq(d->nnodes, 1000000 + 1);
+
+	ast_free(ast);
+	dag_free(d);
+}
+END_TEST
+
+Suite*
+dag_suite(void)
+{
+	Suite *s;
+	TCase *tc_dwrt, *tc_intern;
+
+	s = suite_create("dag");
+
+	tc_dwrt = tcase_create("dwrt");
+	tc_intern = tcase_create("intern");
+
+	tcase_add_test(tc_intern, test_dag_intern_shares);
+	tcase_add_test(tc_intern, test_dag_intern_distinct);
+	tcase_add_test(tc_intern, test_hcons);
+	tcase_add_test(tc_intern, test_hcons_no_dag);
+	tcase_add_test(tc_intern, test_dag_intern_long);
+
+	tcase_add_test(tc_dwrt, test_dag_dwrt_memo);
+	tcase_add_test(tc_dwrt, test_dag_dwrt_deep);
+
+	suite_add_tcase(s, tc_intern);
+	suite_add_tcase(s, tc_dwrt);
+
+	return s;
+}
+
+int
+main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = dag_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
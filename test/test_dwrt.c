@@ -21,9 +21,72 @@
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 
 #include "../dwrt.c"
 
+static long	maxrss(void);
+static Parser*	parse_long(int);
+static char*	print_dwrt(Node*);
+
+static char *terms[] = {"x", "(x * sin(x))", "3", "exp(2 * x)", "(y ^ x)", "(3 / cos(x))"};
+
+/*
+ * Peak resident memory of the test, in kilobytes
+ */
+static long
+maxrss(void)
+{
+	struct rusage ru;
+
+	ck_assert(getrusage(RUSAGE_SELF, &ru) == 0);
+	return ru.ru_maxrss;
+}
+
+/*
+ * Parse a constant prefix then a long sum of terms, one of which has an
+ * undefined derivative if undefined is set
+ */
+static Parser*
+parse_long(int undefined)
+{
+	size_t i;
+	char *data;
+	FILE *f;
+	Parser *p;
+
+	f = tmpfile();
+	ck_assert_ptr_nonnull(f);
+	for(i = 0; i < 3 * DWRT_GRAIN; i++)
+		fprintf(f, "%d + ", (int)(i % 7));
+	for(i = 0; i < 5 * DWRT_GRAIN; i++) {
+		fprintf(f, "%s %c ", terms[i % LEN(terms)], "+-"[i % 2]);
+		if(undefined && i == DWRT_GRAIN)
+			fprintf(f, "log(0) + ");
+	}
+	fprintf(f, "x\n");
+	rewind(f);
+	data = readall(f, NULL);
+	fclose(f);
+
+	p = p_alloc_data("test", data, strlen(data));
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	return p;
+}
+
+/*
+ * Differentiate ast in the current arena and return the printed derivative
+ */
+static char*
+print_dwrt(Node *ast)
+{
+	Node *diff;
+
+	diff = ast_dwrt(ast, 'x');
+	return diff == NULL ? NULL : ast_sprint(diff);
+}
+
 START_TEST(test_dwrt_op_expt_var_to_num)
 {
 	Node *expt, *diff;
@@ -32,19 +95,19 @@ START_TEST(test_dwrt_op_expt_var_to_num)
 	diff = ast_dwrt(expt, 'x');
 	ck_assert_ptr_nonnull(diff);
 
-	ck_assert_int_eq(diff->sym->type, S_OP);
-	ck_assert_uint_eq(diff->sym->content.func, MUL);
+	ck_assert_int_eq(diff->sym.type, S_OP);
+	ck_assert_uint_eq(diff->sym.content.func, MUL);
 
-	ck_assert(is_num(diff->left->sym));
-	ck_assert_double_eq(diff->left->sym->content.num, 7);
+	ck_assert(is_num(&diff->left->sym));
+	ck_assert_double_eq(diff->left->sym.content.num, 7);
 
-	ck_assert(is_operator(diff->right->sym));
-	ck_assert_uint_eq(diff->right->sym->content.func, EXPT);
+	ck_assert(is_operator(&diff->right->sym));
+	ck_assert_uint_eq(diff->right->sym.content.func, EXPT);
 
-	ck_assert(is_same_var(diff->right->left->sym, 'x'));
+	ck_assert(is_same_var(&diff->right->left->sym, 'x'));
 
-	ck_assert(is_num(diff->right->right->sym));
-	ck_assert_double_eq(diff->right->right->sym->content.num, 6);
+	ck_assert(is_num(&diff->right->right->sym));
+	ck_assert_double_eq(diff->right->right->sym.content.num, 6);
 
 	ast_free(expt);
 	ast_free(diff);
@@ -61,8 +124,8 @@ START_TEST(test_dwrt_op_expt_two_num)
 
 	diff = ast_dwrt(expt, 'x');
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(is_num(diff->sym));
-	ck_assert_double_eq(diff->sym->content.num, 0);
+	ck_assert(is_num(&diff->sym));
+	ck_assert_double_eq(diff->sym.content.num, 0);
 
 	ast_free(expt);
 	ast_free(diff);
@@ -83,6 +146,178 @@ START_TEST(test_dwrt_op_expt_var_to_func)
 }
 END_TEST
 
+START_TEST(test_dwrt_deep)
+{
+	int i, n;
+	Node *ast, *diff;
+
+	/* x + x + ... + x, far deeper than the C stack allows to recurse */
+	n = 1000000;
+	ast = ast_alloc(var_alloc('x'));
+	for(i = 1; i < n; i++)
+		ast = ast_sum(ast, ast_alloc(var_alloc('x')));
+
+	diff = ast_dwrt(ast, 'x');
+	ck_assert_ptr_nonnull(diff);
+	ck_assert(num_equal(&diff->sym, n));
+
+	ast_free(ast);
+	ast_free(diff);
+}
+END_TEST
+
+START_TEST(test_dwrt_jobs)
+{
+	char *par, *seq;
+	struct region *r;
+	Arena *prev;
+	Parser *p;
+	Stk regions;
+
+	p = parse_long(0);
+	stk_init(&regions, sizeof(struct region));
+	ck_assert_uint_gt(split(p->ast, &regions), 4);
+	r = (struct region*)regions.data;
+	ck_assert_ptr_eq(r[regions.len - 1].ast, p->ast);
+	ck_assert_uint_eq(r[regions.len - 1].nsub, regions.len);
+	stk_free(&regions);
+
+	prev = arena_use(p->arena);
+	seq = print_dwrt(p->ast);
+	dwrt_jobs(4);
+	par = print_dwrt(p->ast);
+	dwrt_jobs(1);
+	arena_use(prev);
+	ck_assert_ptr_nonnull(seq);
+	ck_assert_ptr_nonnull(par);
+	ck_assert_str_eq(par, seq);
+
+	free(seq);
+	free(par);
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_dwrt_jobs_undefined)
+{
+	Arena *prev;
+	Parser *p;
+
+	p = parse_long(1);
+	prev = arena_use(p->arena);
+	ck_assert_ptr_null(ast_dwrt(p->ast, 'x'));
+	dwrt_jobs(4);
+	ck_assert_ptr_null(ast_dwrt(p->ast, 'x'));
+	dwrt_jobs(1);
+	arena_use(prev);
+
+	p_free(p);
+}
+END_TEST
+
+/*
+ * Derivative of ast printed by ast_dwrt_print, NULL if it is undefined
+ */
+static char*
+stream_dwrt(Node *ast, int flags)
+{
+	Buf b;
+
+	buf_init(&b, -1);
+	if(ast_dwrt_print(&b, ast, 'x', flags) < 0) {
+		ck_assert_uint_eq(b.len, 0);
+		buf_free(&b);
+		return NULL;
+	}
+	buf_putc(&b, '\0');
+	return b.data;
+}
+
+START_TEST(test_dwrt_print)
+{
+	size_t i;
+	char *data, *got, *want;
+	Arena *prev;
+	Buf b;
+	Node *ast, *diff;
+	Parser *p;
+	static char *exprs[] = {
+		"x", "y", "3 * x ^ 2 + 2 * x + 1", "sin(2) * x", "x ^ x / log(x)",
+		"tan(x * y) - cosh(3) * exp(x)", "(x + 0) * 1 - y / 2"
+	};
+
+	for(i = 0; i < LEN(exprs); i++) {
+		data = emalloc(strlen(exprs[i]) + 1);
+		strcpy(data, exprs[i]);
+		p = p_alloc_data("test", data, strlen(data));
+		ck_assert_msg(parse(p) == 0, "%s", p->err);
+		prev = arena_use(p->arena);
+		want = print_dwrt(p->ast);
+		arena_use(prev);
+		got = stream_dwrt(p->ast, 0);
+		ck_assert_str_eq(got, want);
+		free(got);
+		free(want);
+		p_free(p);
+	}
+
+	p = parse_long(0);
+	prev = arena_use(p->arena);
+	diff = ast_dwrt(p->ast, 'x');
+	buf_init(&b, -1);
+	ast_bprint_latex(&b, diff);
+	buf_putc(&b, '\0');
+	arena_use(prev);
+	got = stream_dwrt(p->ast, D_LATEX);
+	ck_assert_str_eq(got, b.data);
+	free(got);
+	buf_free(&b);
+	p_free(p);
+
+	/* Reference counted input */
+	ast = ast_mul(ast_alloc(var_alloc('x')), ast_sin(ast_alloc(var_alloc('x'))));
+	got = stream_dwrt(ast, 0);
+	ck_assert_str_eq(got, "sin(x) + x * cos(x)");
+	ck_assert_uint_eq(ast->refs, 1);
+	free(got);
+	ast_free(ast);
+}
+END_TEST
+
+START_TEST(test_dwrt_print_undefined)
+{
+	Parser *p;
+
+	p = parse_long(1);
+	ck_assert_ptr_null(stream_dwrt(p->ast, 0));
+	p_free(p);
+}
+END_TEST
+
+/*
+ * Like dwrt -b -s on many undefined expressions, whose defined parts must
+ * be freed with the rest of the expansion
+ */
+START_TEST(test_dwrt_print_undefined_leak)
+{
+	size_t i;
+	long before;
+	char *data;
+	Parser *p;
+
+	data = emalloc(32);
+	strcpy(data, "x * log(0) + sin(x) * x");
+	p = p_alloc_data("test", data, strlen(data));
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	ck_assert_ptr_null(stream_dwrt(p->ast, 0));
+	before = maxrss();
+	for(i = 0; i < 200000; i++)
+		ck_assert_ptr_null(stream_dwrt(p->ast, 0));
+	ck_assert_msg(maxrss() - before < 2048, "grew by %ld kB", maxrss() - before);
+	p_free(p);
+}
+END_TEST
+
 START_TEST(test_dwrt_op_frac)
 {
 	Node *ast, *diff;
@@ -90,18 +325,18 @@ START_TEST(test_dwrt_op_frac)
 	ast = ast_frac(ast_alloc(num_alloc(1)), ast_alloc(var_alloc('x')));
 	diff = ast_dwrt(ast, 'x');
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_OP);
-	ck_assert_uint_eq(diff->sym->content.func, FRAC);
+	ck_assert(diff->sym.type == S_OP);
+	ck_assert_uint_eq(diff->sym.content.func, FRAC);
 
-	ck_assert(diff->left->sym->type == S_NUM);
-	ck_assert_double_eq(diff->left->sym->content.num, -1);
+	ck_assert(diff->left->sym.type == S_NUM);
+	ck_assert_double_eq(diff->left->sym.content.num, -1);
 	ck_assert(ast->left != diff->left);
 
-	ck_assert(diff->right->sym->type == S_OP);
-	ck_assert_uint_eq(diff->right->sym->content.func, EXPT);
+	ck_assert(diff->right->sym.type == S_OP);
+	ck_assert_uint_eq(diff->right->sym.content.func, EXPT);
 
-	ck_assert(is_same_var(diff->right->left->sym, 'x'));
-	ck_assert(num_equal(diff->right->right->sym, 2));
+	ck_assert(is_same_var(&diff->right->left->sym, 'x'));
+	ck_assert(num_equal(&diff->right->right->sym, 2));
 
 	ast_free(diff);
 	ast_free(ast);
@@ -116,8 +351,8 @@ START_TEST(test_dwrt_op_mul)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_NUM);
-	ck_assert_double_eq(diff->sym->content.num, 5);
+	ck_assert(diff->sym.type == S_NUM);
+	ck_assert_double_eq(diff->sym.content.num, 5);
 
 	ast_free(ast);
 	ast_free(diff);
@@ -131,8 +366,8 @@ START_TEST(test_dwrt_op_sub)
 	ast = ast_sub(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(5)));
 	diff = ast_dwrt(ast, 'x');
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_NUM);
-	ck_assert_double_eq(diff->sym->content.num, 1);
+	ck_assert(diff->sym.type == S_NUM);
+	ck_assert_double_eq(diff->sym.content.num, 1);
 
 	ast_free(ast);
 	ast_free(diff);
@@ -146,8 +381,8 @@ START_TEST(test_dwrt_op_sum)
 	ast = ast_sub(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(5)));
 	diff = ast_dwrt(ast, 'x');
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_NUM);
-	ck_assert_double_eq(diff->sym->content.num, 1);
+	ck_assert(diff->sym.type == S_NUM);
+	ck_assert_double_eq(diff->sym.content.num, 1);
 
 	ast_free(ast);
 	ast_free(diff);
@@ -163,14 +398,14 @@ START_TEST(test_dwrt_func_cos)
 
 	ck_assert_ptr_nonnull(diff);
 
-	ck_assert(diff->sym->type == S_OP);
-	ck_assert_uint_eq(diff->sym->content.func, MUL);
+	ck_assert(diff->sym.type == S_OP);
+	ck_assert_uint_eq(diff->sym.content.func, MUL);
 
-	ck_assert(diff->left->sym->type == S_NUM);
-	ck_assert_double_eq(diff->left->sym->content.num, -1);
+	ck_assert(diff->left->sym.type == S_NUM);
+	ck_assert_double_eq(diff->left->sym.content.num, -1);
 
-	ck_assert(diff->right->sym->type == S_FUNC);
-	ck_assert_uint_eq(diff->right->sym->content.func, SIN);
+	ck_assert(diff->right->sym.type == S_FUNC);
+	ck_assert_uint_eq(diff->right->sym.content.func, SIN);
 
 	ast_free(ast);
 	ast_free(diff);
@@ -186,11 +421,11 @@ START_TEST(test_dwrt_func_cosh)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_FUNC);
-	ck_assert_uint_eq(diff->sym->content.func, SINH);
+	ck_assert(diff->sym.type == S_FUNC);
+	ck_assert_uint_eq(diff->sym.content.func, SINH);
 
-	ck_assert(diff->right->sym->type == S_VAR);
-	ck_assert(diff->right->sym->content.var == 'x');
+	ck_assert(diff->right->sym.type == S_VAR);
+	ck_assert(diff->right->sym.content.var == 'x');
 
 	ast_free(ast);
 	ast_free(diff);
@@ -205,11 +440,11 @@ START_TEST(test_dwrt_func_exp)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_FUNC);
-	ck_assert_uint_eq(diff->sym->content.func, EXP);
+	ck_assert(diff->sym.type == S_FUNC);
+	ck_assert_uint_eq(diff->sym.content.func, EXP);
 
-	ck_assert(diff->right->sym->type == S_VAR);
-	ck_assert(diff->right->sym->content.var == 'x');
+	ck_assert(diff->right->sym.type == S_VAR);
+	ck_assert(diff->right->sym.content.var == 'x');
 
 	ast_free(ast);
 	ast_free(diff);
@@ -224,14 +459,14 @@ START_TEST(test_dwrt_func_log)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_OP);
-	ck_assert_uint_eq(diff->sym->content.func, FRAC);
+	ck_assert(diff->sym.type == S_OP);
+	ck_assert_uint_eq(diff->sym.content.func, FRAC);
 
-	ck_assert(is_num(diff->left->sym));
-	ck_assert(num_equal(diff->left->sym, 1));
+	ck_assert(is_num(&diff->left->sym));
+	ck_assert(num_equal(&diff->left->sym, 1));
 
-	ck_assert(diff->right->sym->type == S_VAR);
-	ck_assert(diff->right->sym->content.var == 'x');
+	ck_assert(diff->right->sym.type == S_VAR);
+	ck_assert(diff->right->sym.content.var == 'x');
 
 	ast_free(ast);
 	ast_free(diff);
@@ -246,11 +481,11 @@ START_TEST(test_dwrt_func_sin)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_FUNC);
-	ck_assert_uint_eq(diff->sym->content.func, COS);
+	ck_assert(diff->sym.type == S_FUNC);
+	ck_assert_uint_eq(diff->sym.content.func, COS);
 
-	ck_assert(diff->right->sym->type == S_VAR);
-	ck_assert(diff->right->sym->content.var == 'x');
+	ck_assert(diff->right->sym.type == S_VAR);
+	ck_assert(diff->right->sym.content.var == 'x');
 
 	ast_free(ast);
 	ast_free(diff);
@@ -265,11 +500,11 @@ START_TEST(test_dwrt_func_sinh)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_FUNC);
-	ck_assert_uint_eq(diff->sym->content.func, COSH);
+	ck_assert(diff->sym.type == S_FUNC);
+	ck_assert_uint_eq(diff->sym.content.func, COSH);
 
-	ck_assert(diff->right->sym->type == S_VAR);
-	ck_assert(diff->right->sym->content.var == 'x');
+	ck_assert(diff->right->sym.type == S_VAR);
+	ck_assert(diff->right->sym.content.var == 'x');
 
 	ast_free(ast);
 	ast_free(diff);
@@ -284,22 +519,22 @@ START_TEST(test_dwrt_func_tan)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_OP);
-	ck_assert_uint_eq(diff->sym->content.func, SUM);
+	ck_assert(diff->sym.type == S_OP);
+	ck_assert_uint_eq(diff->sym.content.func, SUM);
 
-	ck_assert(diff->left->sym->type == S_NUM);
-	ck_assert_double_eq(diff->left->sym->content.num, 1);
+	ck_assert(diff->left->sym.type == S_NUM);
+	ck_assert_double_eq(diff->left->sym.content.num, 1);
 
-	ck_assert(diff->right->sym->type == S_OP);
-	ck_assert_uint_eq(diff->right->sym->content.func, EXPT);
+	ck_assert(diff->right->sym.type == S_OP);
+	ck_assert_uint_eq(diff->right->sym.content.func, EXPT);
 
-	ck_assert(diff->right->left->sym->type == S_FUNC);
-	ck_assert_uint_eq(diff->right->left->sym->content.func, TAN);
+	ck_assert(diff->right->left->sym.type == S_FUNC);
+	ck_assert_uint_eq(diff->right->left->sym.content.func, TAN);
 
-	ck_assert(diff->right->left->right->sym->type == S_VAR);
-	ck_assert(diff->right->left->right->sym->content.var == 'x');
+	ck_assert(diff->right->left->right->sym.type == S_VAR);
+	ck_assert(diff->right->left->right->sym.content.var == 'x');
 
-	ck_assert(num_equal(diff->right->right->sym, 2));
+	ck_assert(num_equal(&diff->right->right->sym, 2));
 
 	ast_free(ast);
 	ast_free(diff);
@@ -314,22 +549,22 @@ START_TEST(test_dwrt_func_tanh)
 	diff = ast_dwrt(ast, 'x');
 
 	ck_assert_ptr_nonnull(diff);
-	ck_assert(diff->sym->type == S_OP);
-	ck_assert_uint_eq(diff->sym->content.func, SUB);
+	ck_assert(diff->sym.type == S_OP);
+	ck_assert_uint_eq(diff->sym.content.func, SUB);
 
-	ck_assert(diff->right->sym->type == S_NUM);
-	ck_assert_double_eq(diff->right->sym->content.num, 1);
+	ck_assert(diff->right->sym.type == S_NUM);
+	ck_assert_double_eq(diff->right->sym.content.num, 1);
 
-	ck_assert(diff->left->sym->type == S_OP);
-	ck_assert_uint_eq(diff->left->sym->content.func, EXPT);
+	ck_assert(diff->left->sym.type == S_OP);
+	ck_assert_uint_eq(diff->left->sym.content.func, EXPT);
 
-	ck_assert(num_equal(diff->left->right->sym, 2));
+	ck_assert(num_equal(&diff->left->right->sym, 2));
 
-	ck_assert(diff->left->left->sym->type == S_FUNC);
-	ck_assert_uint_eq(diff->left->left->sym->content.func, TANH);
+	ck_assert(diff->left->left->sym.type == S_FUNC);
+	ck_assert_uint_eq(diff->left->left->sym.content.func, TANH);
 
-	ck_assert(diff->left->left->right->sym->type == S_VAR);
-	ck_assert(diff->left->left->right->sym->content.var == 'x');
+	ck_assert(diff->left->left->right->sym.type == S_VAR);
+	ck_assert(diff->left->left->right->sym.content.var == 'x');
 
 	ast_free(ast);
 	ast_free(diff);
@@ -345,9 +580,9 @@ START_TEST(test_ast_cos)
 	ck_assert_ptr_null(ast->left);
 	ck_assert_ptr_nonnull(ast->right);
 
-	ck_assert_uint_eq(ast->sym->content.func, COS);
-	ck_assert(ast->right->sym->type == S_VAR);
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert_uint_eq(ast->sym.content.func, COS);
+	ck_assert(ast->right->sym.type == S_VAR);
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 }
@@ -373,9 +608,9 @@ START_TEST(test_ast_cosh)
 	ck_assert_ptr_null(ast->left);
 	ck_assert_ptr_nonnull(ast->right);
 
-	ck_assert_uint_eq(ast->sym->content.func, COSH);
-	ck_assert(ast->right->sym->type == S_VAR);
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert_uint_eq(ast->sym.content.func, COSH);
+	ck_assert(ast->right->sym.type == S_VAR);
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 }
@@ -399,9 +634,9 @@ START_TEST(test_ast_exp)
 	ck_assert_ptr_null(ast->left);
 	ck_assert_ptr_nonnull(ast->right);
 
-	ck_assert_uint_eq(ast->sym->content.func, EXP);
-	ck_assert(ast->right->sym->type == S_VAR);
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert_uint_eq(ast->sym.content.func, EXP);
+	ck_assert(ast->right->sym.type == S_VAR);
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 
@@ -423,8 +658,8 @@ START_TEST(test_ast_expt_left_is_one)
 
 	expt = ast_expt(ast_alloc(num_alloc(1)), ast_alloc(var_alloc('x')));
 	ck_assert_ptr_nonnull(expt);
-	ck_assert(is_num(expt->sym));
-	ck_assert_double_eq(expt->sym->content.num, 1);
+	ck_assert(is_num(&expt->sym));
+	ck_assert_double_eq(expt->sym.content.num, 1);
 
 	ast_free(expt);
 }
@@ -436,8 +671,8 @@ START_TEST(test_ast_expt_right_is_zero)
 
 	expt = ast_expt(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(0)));
 	ck_assert_ptr_nonnull(expt);
-	ck_assert(is_num(expt->sym));
-	ck_assert_double_eq(expt->sym->content.num, 1);
+	ck_assert(is_num(&expt->sym));
+	ck_assert_double_eq(expt->sym.content.num, 1);
 
 	ast_free(expt);
 }
@@ -449,8 +684,8 @@ START_TEST(test_ast_expt_two_num)
 
 	expt = ast_expt(ast_alloc(num_alloc(5)), ast_alloc(num_alloc(2)));
 	ck_assert_ptr_nonnull(expt);
-	ck_assert(is_num(expt->sym));
-	ck_assert_double_eq(expt->sym->content.num, 25);
+	ck_assert(is_num(&expt->sym));
+	ck_assert_double_eq(expt->sym.content.num, 25);
 
 	ast_free(expt);
 }
@@ -462,11 +697,11 @@ START_TEST(test_ast_expt)
 
 	expt = ast_expt(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(5)));
 	ck_assert_ptr_nonnull(expt);
-	ck_assert(is_operator(expt->sym));
-	ck_assert_uint_eq(expt->sym->content.func, EXPT);
-	ck_assert(is_same_var(expt->left->sym, 'x'));
-	ck_assert(is_num(expt->right->sym));
-	ck_assert_double_eq(expt->right->sym->content.num, 5);
+	ck_assert(is_operator(&expt->sym));
+	ck_assert_uint_eq(expt->sym.content.func, EXPT);
+	ck_assert(is_same_var(&expt->left->sym, 'x'));
+	ck_assert(is_num(&expt->right->sym));
+	ck_assert_double_eq(expt->right->sym.content.num, 5);
 
 	ast_free(expt);
 }
@@ -481,9 +716,9 @@ START_TEST(test_ast_log)
 	ck_assert_ptr_null(ast->left);
 	ck_assert_ptr_nonnull(ast->right);
 
-	ck_assert_uint_eq(ast->sym->content.func, LOG);
-	ck_assert(ast->right->sym->type == S_VAR);
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert_uint_eq(ast->sym.content.func, LOG);
+	ck_assert(ast->right->sym.type == S_VAR);
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 
@@ -508,8 +743,8 @@ START_TEST(test_ast_frac_right_is_one)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_VAR);
-	ck_assert(ast->sym->content.var == 'x');
+	ck_assert(ast->sym.type == S_VAR);
+	ck_assert(ast->sym.content.var == 'x');
 
 	ast_free(ast);
 }
@@ -533,8 +768,8 @@ START_TEST(test_ast_frac_left_is_zero)
 	ast = ast_frac(ast_alloc(num_alloc(0)) , ast_alloc(var_alloc('x')));
 
 	ck_assert_ptr_nonnull(ast);
-	ck_assert(is_num(ast->sym));
-	ck_assert_double_eq(ast->sym->content.num, 0);
+	ck_assert(is_num(&ast->sym));
+	ck_assert_double_eq(ast->sym.content.num, 0);
 
 	ast_free(ast);
 }
@@ -550,11 +785,23 @@ START_TEST(test_ast_frac_two_num)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert_double_eq(ast->sym->content.num, 10. / 2.);
+	ck_assert_double_eq(ast->sym.content.num, 10. / 2.);
 	ast_free(ast);
 }
 END_TEST
 
+START_TEST(test_ast_frac_null)
+{
+	Node *x;
+
+	/* the defined operand is released */
+	x = ast_copy(ast_alloc(var_alloc('x')));
+	ck_assert_ptr_null(ast_frac(x, NULL));
+	ck_assert_uint_eq(x->refs, 1);
+	ck_assert_ptr_null(ast_frac(NULL, x));
+}
+END_TEST
+
 START_TEST(test_ast_frac)
 {
 	Node *ast;
@@ -564,9 +811,9 @@ START_TEST(test_ast_frac)
 	ck_assert_ptr_nonnull(ast->right);
 	ck_assert_ptr_nonnull(ast->left);
 
-	ck_assert_uint_eq(ast->sym->content.func, FRAC);
-	ck_assert_double_eq(ast->left->sym->content.num, 10);
-	ck_assert(ast->right->sym->content.var == 'z');
+	ck_assert_uint_eq(ast->sym.content.func, FRAC);
+	ck_assert_double_eq(ast->left->sym.content.num, 10);
+	ck_assert(ast->right->sym.content.var == 'z');
 
 	ast_free(ast);
 }
@@ -582,8 +829,8 @@ START_TEST(test_ast_mul_left_is_one)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_VAR);
-	ck_assert(ast->sym->content.var == 'x');
+	ck_assert(ast->sym.type == S_VAR);
+	ck_assert(ast->sym.content.var == 'x');
 
 	ast_free(ast);
 }
@@ -598,8 +845,8 @@ START_TEST(test_ast_mul_left_is_zero)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_NUM);
-	ck_assert_double_eq(ast->sym->content.num, 0);
+	ck_assert(ast->sym.type == S_NUM);
+	ck_assert_double_eq(ast->sym.content.num, 0);
 
 	ast_free(ast);
 }
@@ -615,8 +862,8 @@ START_TEST(test_ast_mul_right_is_one)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_VAR);
-	ck_assert(ast->sym->content.var == 'x');
+	ck_assert(ast->sym.type == S_VAR);
+	ck_assert(ast->sym.content.var == 'x');
 
 	ast_free(ast);
 }
@@ -631,8 +878,8 @@ START_TEST(test_ast_mul_right_is_zero)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_NUM);
-	ck_assert_double_eq(ast->sym->content.num, 0);
+	ck_assert(ast->sym.type == S_NUM);
+	ck_assert_double_eq(ast->sym.content.num, 0);
 
 	ast_free(ast);
 }
@@ -647,13 +894,29 @@ START_TEST(test_ast_mul_two_num)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_NUM);
-	ck_assert_double_eq(ast->sym->content.num, 35);
+	ck_assert(ast->sym.type == S_NUM);
+	ck_assert_double_eq(ast->sym.content.num, 35);
 
 	ast_free(ast);
 }
 END_TEST
 
+START_TEST(test_ast_mul_two_num_shared)
+{
+	Node *ast, *five;
+
+	five = ast_alloc(num_alloc(5));
+	ast = ast_mul(ast_copy(five), ast_alloc(num_alloc(7)));
+	ck_assert(ast != five);
+	ck_assert_double_eq(ast->sym.content.num, 35);
+	ck_assert_double_eq(five->sym.content.num, 5);
+	ck_assert_uint_eq(five->refs, 1);
+
+	ast_free(ast);
+	ast_free(five);
+}
+END_TEST
+
 START_TEST(test_ast_mul)
 {
 	Node *ast;
@@ -663,10 +926,10 @@ START_TEST(test_ast_mul)
 	ck_assert_ptr_nonnull(ast->right);
 	ck_assert_ptr_nonnull(ast->left);
 
-	ck_assert(is_operator(ast->sym));
-	ck_assert_uint_eq(ast->sym->content.func, MUL);
-	ck_assert(ast->left->sym->content.var == 'x');
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert(is_operator(&ast->sym));
+	ck_assert_uint_eq(ast->sym.content.func, MUL);
+	ck_assert(ast->left->sym.content.var == 'x');
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 }
@@ -681,9 +944,9 @@ START_TEST(test_ast_sin)
 	ck_assert_ptr_null(ast->left);
 	ck_assert_ptr_nonnull(ast->right);
 
-	ck_assert_uint_eq(ast->sym->content.func, SIN);
-	ck_assert(ast->right->sym->type == S_VAR);
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert_uint_eq(ast->sym.content.func, SIN);
+	ck_assert(ast->right->sym.type == S_VAR);
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 }
@@ -707,9 +970,9 @@ START_TEST(test_ast_sinh)
 	ck_assert_ptr_null(ast->left);
 	ck_assert_ptr_nonnull(ast->right);
 
-	ck_assert_uint_eq(ast->sym->content.func, SINH);
-	ck_assert(ast->right->sym->type == S_VAR);
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert_uint_eq(ast->sym.content.func, SINH);
+	ck_assert(ast->right->sym.type == S_VAR);
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 }
@@ -731,14 +994,14 @@ START_TEST(test_ast_sub_left_is_zero)
 	ast = ast_sub(ast_alloc(num_alloc(0)), ast_alloc(var_alloc('x')));
 	ck_assert_ptr_nonnull(ast);
 
-	ck_assert(is_operator(ast->sym));
-	ck_assert_uint_eq(ast->sym->content.func, MUL);
+	ck_assert(is_operator(&ast->sym));
+	ck_assert_uint_eq(ast->sym.content.func, MUL);
 
-	ck_assert(is_num(ast->left->sym));
-	ck_assert(num_equal(ast->left->sym, -1));
+	ck_assert(is_num(&ast->left->sym));
+	ck_assert(num_equal(&ast->left->sym, -1));
 
-	ck_assert(ast->right->sym->type == S_VAR);
-	ck_assert(ast->right->sym->content.var == 'x');
+	ck_assert(ast->right->sym.type == S_VAR);
+	ck_assert(ast->right->sym.content.var == 'x');
 
 	ast_free(ast);
 }
@@ -753,8 +1016,8 @@ START_TEST(test_ast_sub_right_is_zero)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_VAR);
-	ck_assert(ast->sym->content.var == 'x');
+	ck_assert(ast->sym.type == S_VAR);
+	ck_assert(ast->sym.content.var == 'x');
 
 	ast_free(ast);
 }
@@ -769,13 +1032,25 @@ START_TEST(test_ast_sub_two_num)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_NUM);
-	ck_assert_double_eq(ast->sym->content.num, 2);
+	ck_assert(ast->sym.type == S_NUM);
+	ck_assert_double_eq(ast->sym.content.num, 2);
 
 	ast_free(ast);
 }
 END_TEST
 
+START_TEST(test_ast_sub_null)
+{
+	Node *x;
+
+	/* the defined operand is released */
+	x = ast_copy(ast_alloc(var_alloc('x')));
+	ck_assert_ptr_null(ast_sub(x, NULL));
+	ck_assert_uint_eq(x->refs, 1);
+	ck_assert_ptr_null(ast_sub(NULL, x));
+}
+END_TEST
+
 START_TEST(test_ast_sub)
 {
 	Node *ast;
@@ -785,10 +1060,10 @@ START_TEST(test_ast_sub)
 	ck_assert_ptr_nonnull(ast->right);
 	ck_assert_ptr_nonnull(ast->left);
 
-	ck_assert(is_operator(ast->sym));
-	ck_assert_uint_eq(ast->sym->content.func, SUB);
-	ck_assert(ast->left->sym->content.var == 'x');
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert(is_operator(&ast->sym));
+	ck_assert_uint_eq(ast->sym.content.func, SUB);
+	ck_assert(ast->left->sym.content.var == 'x');
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 }
@@ -803,8 +1078,8 @@ START_TEST(test_ast_sum_left_is_zero)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_VAR);
-	ck_assert(ast->sym->content.var == 'x');
+	ck_assert(ast->sym.type == S_VAR);
+	ck_assert(ast->sym.content.var == 'x');
 
 	ast_free(ast);
 }
@@ -819,8 +1094,8 @@ START_TEST(test_ast_sum_right_is_zero)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_VAR);
-	ck_assert(ast->sym->content.var == 'x');
+	ck_assert(ast->sym.type == S_VAR);
+	ck_assert(ast->sym.content.var == 'x');
 
 	ast_free(ast);
 }
@@ -835,13 +1110,25 @@ START_TEST(test_ast_sum_two_num)
 	ck_assert_ptr_null(ast->right);
 	ck_assert_ptr_null(ast->left);
 
-	ck_assert(ast->sym->type == S_NUM);
-	ck_assert_double_eq(ast->sym->content.num, 12);
+	ck_assert(ast->sym.type == S_NUM);
+	ck_assert_double_eq(ast->sym.content.num, 12);
 
 	ast_free(ast);
 }
 END_TEST
 
+START_TEST(test_ast_sum_null)
+{
+	Node *x;
+
+	/* the defined operand is released */
+	x = ast_copy(ast_alloc(var_alloc('x')));
+	ck_assert_ptr_null(ast_sum(x, NULL));
+	ck_assert_uint_eq(x->refs, 1);
+	ck_assert_ptr_null(ast_sum(NULL, x));
+}
+END_TEST
+
 START_TEST(test_ast_sum)
 {
 	Node *ast;
@@ -851,10 +1138,10 @@ START_TEST(test_ast_sum)
 	ck_assert_ptr_nonnull(ast->right);
 	ck_assert_ptr_nonnull(ast->left);
 
-	ck_assert(is_operator(ast->sym));
-	ck_assert_uint_eq(ast->sym->content.func, SUM);
-	ck_assert(ast->left->sym->content.var == 'x');
-	ck_assert(ast->right->sym->content.var == 'y');
+	ck_assert(is_operator(&ast->sym));
+	ck_assert_uint_eq(ast->sym.content.func, SUM);
+	ck_assert(ast->left->sym.content.var == 'x');
+	ck_assert(ast->right->sym.content.var == 'y');
 
 	ast_free(ast);
 }
@@ -862,35 +1149,30 @@ END_TEST
 
 START_TEST(test_is_same_var_fail)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = var_alloc('x');
 
-	ck_assert(! is_same_var(sym, 'y'));
-
-	symbol_free(sym);
+	ck_assert(! is_same_var(&sym, 'y'));
 }
 END_TEST
 
 START_TEST(test_is_same_var_not_var)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = num_alloc(5);
-	ck_assert(! is_same_var(sym, 'x'));
-
-	symbol_free(sym);
+	ck_assert(! is_same_var(&sym, 'x'));
 }
 END_TEST
 
 START_TEST(test_is_same_var)
 {
-	Symbol *sym;
+	Symbol sym;
 
 	sym = var_alloc('x');
 
-	ck_assert(is_same_var(sym, 'x'));
-	symbol_free(sym);
+	ck_assert(is_same_var(&sym, 'x'));
 }
 END_TEST
 
@@ -926,6 +1208,12 @@ dwrt_suite()
 	tcase_add_test(tc_dwrt, test_dwrt_op_expt_two_num);
 	tcase_add_test(tc_dwrt, test_dwrt_op_expt_var_to_num);
 	tcase_add_test(tc_dwrt, test_dwrt_op_expt_var_to_func);
+	tcase_add_test(tc_dwrt, test_dwrt_deep);
+	tcase_add_test(tc_dwrt, test_dwrt_jobs);
+	tcase_add_test(tc_dwrt, test_dwrt_jobs_undefined);
+	tcase_add_test(tc_dwrt, test_dwrt_print);
+	tcase_add_test(tc_dwrt, test_dwrt_print_undefined);
+	tcase_add_test(tc_dwrt, test_dwrt_print_undefined_leak);
 
 	tcase_add_test(tc_expt, test_ast_expt_two_num);
 	tcase_add_test(tc_expt, test_ast_expt_left_is_one);
@@ -937,6 +1225,7 @@ dwrt_suite()
 	tcase_add_test(tc_frac, test_ast_frac_right_is_one);
 	tcase_add_test(tc_frac, test_ast_frac_right_is_zero);
 	tcase_add_test(tc_frac, test_ast_frac);
+	tcase_add_test(tc_frac, test_ast_frac_null);
 
 	tcase_add_test(tc_func, test_ast_cos);
 	tcase_add_test(tc_func, test_ast_cos_null);
@@ -956,17 +1245,20 @@ dwrt_suite()
 	tcase_add_test(tc_mul, test_ast_mul_right_is_one);
 	tcase_add_test(tc_mul, test_ast_mul_right_is_zero);
 	tcase_add_test(tc_mul, test_ast_mul_two_num);
+	tcase_add_test(tc_mul, test_ast_mul_two_num_shared);
 	tcase_add_test(tc_mul, test_ast_mul);
 
 	tcase_add_test(tc_sub, test_ast_sub_left_is_zero);
 	tcase_add_test(tc_sub, test_ast_sub_right_is_zero);
 	tcase_add_test(tc_sub, test_ast_sub_two_num);
 	tcase_add_test(tc_sub, test_ast_sub);
+	tcase_add_test(tc_sub, test_ast_sub_null);
 
 	tcase_add_test(tc_sum, test_ast_sum_left_is_zero);
 	tcase_add_test(tc_sum, test_ast_sum_right_is_zero);
 	tcase_add_test(tc_sum, test_ast_sum_two_num);
 	tcase_add_test(tc_sum, test_ast_sum);
+	tcase_add_test(tc_sum, test_ast_sum_null);
 
 	tcase_add_test(tc_var, test_is_same_var_fail);
 	tcase_add_test(tc_var, test_is_same_var_not_var);
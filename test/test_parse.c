@@ -18,13 +18,106 @@
  *
  */
 
+#include <sys/stat.h>
+
 #include <check.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../dat.h"
 #include "../fns.h"
 
+#define FIFO "stream.fifo"
+
+/* Expression that test_parse_stream writes to FIFO */
+static char *stream_expr;
+
+/*
+ * Expression of at least len bytes made of terms joined by + and -, and *
+ * now and then, which the caller frees
+ */
+static char*
+long_expr(size_t len, char **terms, int nterms)
+{
+	int i;
+	size_t n;
+	char *s;
+	static char *ops[] = {" + ", " - ", "\n-\t", " * ", "+", "-"};
+
+	s = emalloc(len + 256);
+	for(i = 0, n = 0; n < len; i++) {
+		strcpy(s + n, terms[i % nterms]);
+		strcat(s + n, ops[i % 6]);
+		n += strlen(s + n);
+	}
+	strcpy(s + n, "x");
+	return s;
+}
+
+/*
+ * Write stream_expr to FIFO a few bytes at a time
+ */
+static void*
+feed(void *arg)
+{
+	size_t i, len, n;
+	FILE *f;
+
+	(void)arg;
+	f = fopen(FIFO, "w");
+	len = strlen(stream_expr);
+	for(i = 0, n = 1; i < len; i += n, n = n % 97 + 1) {
+		if(n > len - i)
+			n = len - i;
+		fwrite(stream_expr + i, 1, n, f);
+		fflush(f);
+	}
+	fclose(f);
+	return NULL;
+}
+
+static int
+lexeme_is(Lexeme *le, char *s)
+{
+	return le->len == strlen(s) && strncmp(le->lexeme, s, le->len) == 0;
+}
+
+/*
+ * Parser over a copy of expr that uses pratt rather than shunting_yard
+ */
+static Parser*
+pratt_alloc(char *expr)
+{
+	char *data;
+	size_t len;
+	Parser *p;
+
+	len = strlen(expr);
+	data = emalloc(len + 1);
+	memcpy(data, expr, len + 1);
+	p = p_alloc_data("test", data, len);
+	p->pratt = 1;
+	return p;
+}
+
+/*
+ * Parse expr with the Pratt parser and return it printed back
+ */
+static char*
+pratt_print(char *expr)
+{
+	char *s;
+	Parser *p;
+
+	p = pratt_alloc(expr);
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	s = ast_sprint(p->ast);
+	p_free(p);
+	return s;
+}
+
 START_TEST(test_l_alloc_non_exist)
 {
 	Lexer *l;
@@ -52,190 +145,208 @@ END_TEST
 
 START_TEST(test_lex_lparen)
 {
-	Lexeme *le;
+	Lexeme le;
 	Lexer *l;
 
 	l = l_alloc("files/test_lex_lparen.txt");
 
 	le = lex(l);
-	ck_assert(le->type == LE_LPAREN);
-	ck_assert_str_eq(le->lexeme, "(");
+	ck_assert(le.type == LE_LPAREN);
+	ck_assert(lexeme_is(&le, "("));
 
-	free(le);
-	free(le->lexeme);
 	l_free(l);
 }
 END_TEST
 
 START_TEST(test_lex_number)
 {
-	Lexeme *le;
+	Lexeme le;
 	Lexer *l;
 
 	l = l_alloc("files/test_lex_number.txt");
 
 	le = lex(l);
-	ck_assert(le->type == LE_NUMBER);
-	ck_assert_str_eq(le->lexeme, "5.44");
+	ck_assert(le.type == LE_NUMBER);
+	ck_assert(lexeme_is(&le, "5.44"));
+
+	l_free(l);
+}
+END_TEST
+
+START_TEST(test_lex_exponent)
+{
+	size_t i;
+	Lexeme le;
+	Lexer *l;
+	static char *want[] = {"1e-3", "2.5E+2", "3", "e", "x", "4", "e", "+", "x"};
+
+	l = l_alloc("files/test_lex_exponent.txt");
+
+	for(i = 0; i < LEN(want); i++) {
+		le = lex(l);
+		ck_assert(le.type == (i < 3 || i == 5 ? LE_NUMBER : i == 7 ? LE_OPERATOR : LE_SYMBOL));
+		ck_assert(lexeme_is(&le, want[i]));
+	}
+	le = lex(l);
+	ck_assert(le.type == LE_EOF);
+
+	l_free(l);
+}
+END_TEST
+
+START_TEST(test_lex_number_ws)
+{
+	Lexeme le;
+	Lexer *l;
+
+	l = l_alloc("files/test_lex_number_ws.txt");
+
+	le = lex(l);
+	ck_assert(le.type == LE_NUMBER);
+	ck_assert(lexeme_is(&le, "12"));
+	le = lex(l);
+	ck_assert(le.type == LE_NUMBER);
+	ck_assert(lexeme_is(&le, "34"));
+	le = lex(l);
+	ck_assert(le.type == LE_EOF);
 
-	free(le);
-	free(le->lexeme);
 	l_free(l);
 }
 END_TEST
 
 START_TEST(test_lex_operator)
 {
-	Lexeme *le;
+	Lexeme le;
 	Lexer *l;
 
 	l = l_alloc("files/test_lex_operator.txt");
 
 	le = lex(l);
-	ck_assert(le->type == LE_OPERATOR);
-	ck_assert_str_eq(le->lexeme, "*");
+	ck_assert(le.type == LE_OPERATOR);
+	ck_assert(lexeme_is(&le, "*"));
 
-	free(le);
-	free(le->lexeme);
 	l_free(l);
 }
 END_TEST
 
 START_TEST(test_lex_rparen)
 {
-	Lexeme *le;
+	Lexeme le;
 	Lexer *l;
 
 	l = l_alloc("files/test_lex_rparen.txt");
 
 	le = lex(l);
-	ck_assert(le->type == LE_RPAREN);
-	ck_assert_str_eq(le->lexeme, ")");
+	ck_assert(le.type == LE_RPAREN);
+	ck_assert(lexeme_is(&le, ")"));
 
-	free(le);
-	free(le->lexeme);
 	l_free(l);
 }
 END_TEST
 
 START_TEST(test_lex_symbol)
 {
-	Lexeme *le;
+	Lexeme le;
 	Lexer *l;
 
 	l = l_alloc("files/test_lex_symbol.txt");
 
 	le = lex(l);
-	ck_assert(le->type == LE_SYMBOL);
-	ck_assert_str_eq(le->lexeme, "sin");
+	ck_assert(le.type == LE_SYMBOL);
+	ck_assert(lexeme_is(&le, "sin"));
 
-	free(le);
-	free(le->lexeme);
 	l_free(l);
 }
 END_TEST
 
 START_TEST(test_lex_unknown)
 {
-	Lexeme *le;
+	Lexeme le;
 	Lexer *l;
 
 	l = l_alloc("files/test_lex_unknown.txt");
 
 	le = lex(l);
-	ck_assert(le->type == LE_ERROR);
+	ck_assert(le.type == LE_ERROR);
 	ck_assert_str_eq(l->err, "files/test_lex_unknown.txt: $ is garbage\n");
 
-	free(le);
-	free(le->lexeme);
 	l_free(l);
 }
 END_TEST
 
 START_TEST(test_lex_full)
 {
-	Lexeme *le;
+	Lexeme le;
 	Lexer *l;
 
 	l = l_alloc("files/test_lex_full.txt");
 
 	le = lex(l);
-	ck_assert(le->type == LE_SYMBOL);
-	ck_assert_str_eq(le->lexeme, "sin");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_SYMBOL);
+	ck_assert(lexeme_is(&le, "sin"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_LPAREN);
-	ck_assert_str_eq(le->lexeme, "(");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_LPAREN);
+	ck_assert(lexeme_is(&le, "("));
 
 	le = lex(l);
-	ck_assert(le->type == LE_SYMBOL);
-	ck_assert_str_eq(le->lexeme, "x");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_SYMBOL);
+	ck_assert(lexeme_is(&le, "x"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_OPERATOR);
-	ck_assert_str_eq(le->lexeme, "+");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_OPERATOR);
+	ck_assert(lexeme_is(&le, "+"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_NUMBER);
-	ck_assert_str_eq(le->lexeme, "3");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_NUMBER);
+	ck_assert(lexeme_is(&le, "3"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_RPAREN);
-	ck_assert_str_eq(le->lexeme, ")");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_RPAREN);
+	ck_assert(lexeme_is(&le, ")"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_OPERATOR);
-	ck_assert_str_eq(le->lexeme, "-");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_OPERATOR);
+	ck_assert(lexeme_is(&le, "-"));
 
 
 	le = lex(l);
-	ck_assert(le->type == LE_NUMBER);
-	ck_assert_str_eq(le->lexeme, "5.2");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_NUMBER);
+	ck_assert(lexeme_is(&le, "5.2"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_OPERATOR);
-	ck_assert_str_eq(le->lexeme, "*");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_OPERATOR);
+	ck_assert(lexeme_is(&le, "*"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_SYMBOL);
-	ck_assert_str_eq(le->lexeme, "y");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_SYMBOL);
+	ck_assert(lexeme_is(&le, "y"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_OPERATOR);
-	ck_assert_str_eq(le->lexeme, "/");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_OPERATOR);
+	ck_assert(lexeme_is(&le, "/"));
 
 	le = lex(l);
-	ck_assert(le->type == LE_NUMBER);
-	ck_assert_str_eq(le->lexeme, "12");
-	free(le);
-	free(le->lexeme);
+	ck_assert(le.type == LE_NUMBER);
+	ck_assert(lexeme_is(&le, "12"));
 
 	l_free(l);
 }
 END_TEST
 
+START_TEST(test_func_lookup)
+{
+	int i;
+	static char *misses[] = {"x", "co", "coss", "sinhx", "tab", "nis", "cosh2", "sqrt"};
+
+	for(i = 0; i < KNOWN_FUNCS; i++)
+		ck_assert_int_eq(func_lookup(known_funcs[i].func, strlen(known_funcs[i].func)), i);
+	for(i = 0; i < (int)(sizeof(misses) / sizeof(misses[0])); i++)
+		ck_assert_int_eq(func_lookup(misses[i], strlen(misses[i])), -1);
+	ck_assert_int_eq(func_lookup("sinh", 3), SIN);
+}
+END_TEST
+
 START_TEST(test_parse_empty)
 {
 	Parser *p;
@@ -265,15 +376,15 @@ START_TEST(test_parse_non_parenthesized)
 	p = p_alloc("files/test_parse_non_parenthesized.txt");
 	ck_assert_msg(parse(p) == 0, "%s", p->err);
 
-	ck_assert_uint_eq(p->ast->sym->content.func, FRAC);
-	ck_assert_uint_eq(p->ast->right->sym->content.func, SIN);
-	ck_assert(num_equal(p->ast->right->right->sym, 2));
+	ck_assert_uint_eq(p->ast->sym.content.func, FRAC);
+	ck_assert_uint_eq(p->ast->right->sym.content.func, SIN);
+	ck_assert(num_equal(&p->ast->right->right->sym, 2));
 	ck_assert_ptr_null(p->ast->right->left);
-	ck_assert_uint_eq(p->ast->left->sym->content.func, SUM);
-	ck_assert(num_equal(p->ast->left->right->sym, 4));
-	ck_assert_uint_eq(p->ast->left->left->sym->content.func, MUL);
-	ck_assert(p->ast->left->left->right->sym->content.var == 'x');
-	ck_assert(num_equal(p->ast->left->left->left->sym, 2));
+	ck_assert_uint_eq(p->ast->left->sym.content.func, SUM);
+	ck_assert(num_equal(&p->ast->left->right->sym, 4));
+	ck_assert_uint_eq(p->ast->left->left->sym.content.func, MUL);
+	ck_assert(p->ast->left->left->right->sym.content.var == 'x');
+	ck_assert(num_equal(&p->ast->left->left->left->sym, 2));
 
 	p_free(p);
 }
@@ -286,20 +397,186 @@ START_TEST(test_parse_parenthesized)
 	p = p_alloc("files/test_parse_parenthesized.txt");
 	ck_assert_msg(parse(p) == 0, "%s", p->err);
 
-	ck_assert_uint_eq(p->ast->sym->content.func, FRAC);
-	ck_assert_uint_eq(p->ast->right->sym->content.func, SIN);
-	ck_assert(num_equal(p->ast->right->right->sym, 2));
+	ck_assert_uint_eq(p->ast->sym.content.func, FRAC);
+	ck_assert_uint_eq(p->ast->right->sym.content.func, SIN);
+	ck_assert(num_equal(&p->ast->right->right->sym, 2));
 	ck_assert_ptr_null(p->ast->right->left);
-	ck_assert_uint_eq(p->ast->left->sym->content.func, SUM);
-	ck_assert(num_equal(p->ast->left->right->sym, 4));
-	ck_assert_uint_eq(p->ast->left->left->sym->content.func, MUL);
-	ck_assert(p->ast->left->left->right->sym->content.var == 'x');
-	ck_assert(num_equal(p->ast->left->left->left->sym, 2));
+	ck_assert_uint_eq(p->ast->left->sym.content.func, SUM);
+	ck_assert(num_equal(&p->ast->left->right->sym, 4));
+	ck_assert_uint_eq(p->ast->left->left->sym.content.func, MUL);
+	ck_assert(p->ast->left->left->right->sym.content.var == 'x');
+	ck_assert(num_equal(&p->ast->left->left->left->sym, 2));
 
 	p_free(p);
 }
 END_TEST
 
+START_TEST(test_parse_garbage)
+{
+	Parser *p;
+	p = p_alloc("files/test_parse_garbage.txt");
+
+	ck_assert_msg(parse(p) < 0, "Parser should fail but it doesn't");
+	ck_assert_str_eq(p->err, "files/test_parse_garbage.txt: $ is garbage\n");
+	ck_assert_ptr_null(p->l->err);
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_parse_reset)
+{
+	char *data;
+	Parser *p;
+
+	p = p_alloc("files/test_parse_reset.txt");
+	data = p->l->data;
+
+	l_reset(p->l, data, data + 6);
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	ck_assert_uint_eq(p->ast->sym.content.func, SIN);
+
+	p_reset(p);
+	ck_assert_ptr_null(p->ast);
+	l_reset(p->l, data + 7, data + 12);
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	ck_assert_uint_eq(p->ast->sym.content.func, MUL);
+	ck_assert(num_equal(&p->ast->right->sym, 2));
+
+	p_reset(p);
+	l_reset(p->l, data + 13, data + 15);
+	ck_assert(parse(p) < 0);
+	ck_assert_str_eq(p->err, "files/test_parse_reset.txt: unbalanced parenthesis\n");
+
+	p_reset(p);
+	ck_assert_ptr_null(p->err);
+	l_reset(p->l, data, data + 6);
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	ck_assert_uint_eq(p->ast->sym.content.func, SIN);
+
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_parse_split)
+{
+	int engine;
+	char *s, *want, *got;
+	Node *back;
+	Parser *p;
+	static char *terms[] = {"x", "(x - 2.5e-3) * sin(y + x)", "12e+2", "theta ^ 2",
+		"exp(x - (y - 1))", "log(2 * x) / cosh(1 - x)", "-x ^ 2", "sin -x", "2 * -y", "cosh(-1 - x)"};
+
+	for(engine = 0; engine <= 1; engine++) {
+		/* the shunting yard has no unary minus */
+		s = long_expr(300000, terms, engine ? 10 : 6);
+		p = pratt_alloc(s);
+		p->pratt = engine;
+		ck_assert_msg(parse(p) == 0, "%s", p->err);
+		want = ast_sprint(p->ast);
+		p_free(p);
+
+		p = pratt_alloc(s);
+		p->pratt = engine;
+		p->jobs = 4;
+		p->tape = tape_alloc();
+		ck_assert_int_eq(parse_split(p), 0);
+		got = ast_sprint(p->ast);
+		ck_assert_str_eq(got, want);
+		free(got);
+		back = tape_to_ast(p->tape);
+		got = ast_sprint(back);
+		ck_assert_str_eq(got, want);
+		ast_free(back);
+		p_free(p);
+		free(got);
+		free(want);
+		free(s);
+	}
+}
+END_TEST
+
+START_TEST(test_parse_split_fallback)
+{
+	size_t len;
+	char *s;
+	Parser *p;
+	static char *terms[] = {"x", "sin(x)"}, *bare[] = {"x", "sin x"};
+
+	/* errors are found by the sequential parser */
+	s = long_expr(300000, terms, 2);
+	len = strlen(s);
+	strcpy(s + len / 2, "* * x");
+	p = pratt_alloc(s);
+	p->jobs = 4;
+	ck_assert(parse(p) < 0);
+	ck_assert_str_eq(p->err, "test: malformed expression\n");
+	p_free(p);
+	s[len / 2] = ')';
+	p = pratt_alloc(s);
+	p->jobs = 4;
+	ck_assert_int_eq(parse_split(p), -1);
+	p_free(p);
+	free(s);
+
+	/* and so are functions without parentheses, for the shunting yard */
+	s = long_expr(300000, bare, 2);
+	p = pratt_alloc(s);
+	p->pratt = 0;
+	p->jobs = 4;
+	ck_assert_int_eq(parse_split(p), -1);
+	p->pratt = 1;
+	ck_assert_int_eq(parse_split(p), 0);
+	p_free(p);
+	free(s);
+}
+END_TEST
+
+START_TEST(test_parse_stream)
+{
+	int engine, i;
+	size_t len;
+	char *s, *want, *got;
+	pthread_t writer;
+	Parser *p;
+	static char *terms[] = {"x", "sin (x)", "12345.678e-3", "2.5E+2 * theta",
+		"foo", "cosh(x) ^ 2", "7e1"};
+
+	/* terms and a name longer than the lexer's buffer cross reads */
+	s = emalloc(100000 + 64 + 70000 + 8);
+	for(i = 0, len = 0; len < 100000; i++) {
+		strcpy(s + len, terms[i % 7]);
+		strcat(s + len, i % 3 ? " + " : "\t*\n");
+		len += strlen(s + len);
+	}
+	memset(s + len, 'q', 70000);
+	strcpy(s + len + 70000, " - x");
+	stream_expr = s;
+
+	for(engine = 0; engine <= 1; engine++) {
+		p = pratt_alloc(s);
+		p->pratt = engine;
+		ck_assert_msg(parse(p) == 0, "%s", p->err);
+		want = ast_sprint(p->ast);
+		p_free(p);
+
+		ck_assert_int_eq(mkfifo(FIFO, 0600), 0);
+		pthread_create(&writer, NULL, feed, NULL);
+		p = p_alloc_stream(FIFO);
+		unlink(FIFO);
+		p->pratt = engine;
+		ck_assert_msg(parse(p) == 0, "%s", p->err);
+		ck_assert_uint_lt(p->l->len, 4 * 70000);
+		got = ast_sprint(p->ast);
+		pthread_join(writer, NULL);
+		ck_assert_str_eq(got, want);
+		p_free(p);
+		free(got);
+		free(want);
+	}
+	free(s);
+}
+END_TEST
+
 START_TEST(test_parse_unbalanced_left_parenthesis)
 {
 	Parser *p;
@@ -333,6 +610,124 @@ START_TEST(test_parse_unknown_func)
 }
 END_TEST
 
+START_TEST(test_parse_var_names)
+{
+	int engine;
+	Parser *p;
+
+	for(engine = 0; engine <= 1; engine++) {
+		p = pratt_alloc("theta * x + sinx");
+		p->pratt = engine;
+		ck_assert_msg(parse(p) == 0, "%s", p->err);
+		ck_assert_uint_eq(p->ast->sym.content.func, SUM);
+		ck_assert(is_same_var(&p->ast->left->left->sym, var_intern("theta", 5)));
+		ck_assert(is_same_var(&p->ast->left->right->sym, 'x'));
+		ck_assert(is_same_var(&p->ast->right->sym, var_intern("sinx", 4)));
+		p_free(p);
+	}
+}
+END_TEST
+
+START_TEST(test_pratt_errors)
+{
+	size_t i;
+	Parser *p;
+	static char *cases[][2] = {
+		{"x +", "test: malformed expression\n"},
+		{"(x", "test: unbalanced parenthesis\n"},
+		{"x)", "test: unbalanced parenthesis\n"},
+		{"x y", "test: malformed expression\n"},
+		{"stupidfunc(x)", "test: unknown function stupidfunc\n"},
+		{"x $", "test: $ is garbage\n"},
+	};
+
+	for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		p = pratt_alloc(cases[i][0]);
+		ck_assert_msg(parse(p) < 0, "%s should not parse", cases[i][0]);
+		ck_assert_str_eq(p->err, cases[i][1]);
+		p_free(p);
+	}
+}
+END_TEST
+
+START_TEST(test_pratt_expt)
+{
+	char *s;
+
+	s = pratt_print("x ^ 2 ^ 3");
+	ck_assert_str_eq(s, "x ^ (2 ^ 3)");
+	free(s);
+	s = pratt_print("(x ^ 2) ^ 3");
+	ck_assert_str_eq(s, "(x ^ 2) ^ 3");
+	free(s);
+	s = pratt_print("sin x ^ 2");
+	ck_assert_str_eq(s, "sin(x ^ 2)");
+	free(s);
+	s = pratt_print("sin(x) ^ 2");
+	ck_assert_str_eq(s, "sin(x) ^ 2");
+	free(s);
+}
+END_TEST
+
+START_TEST(test_pratt_precedence)
+{
+	char *s;
+
+	s = pratt_print("2 * x + 4 / sin(2)");
+	ck_assert_str_eq(s, "2 * x + 4 / sin(2)");
+	free(s);
+	s = pratt_print("x - y - z");
+	ck_assert_str_eq(s, "x - y - z");
+	free(s);
+	s = pratt_print("x - (y - z)");
+	ck_assert_str_eq(s, "x - (y - z)");
+	free(s);
+	s = pratt_print("(2 * x + 4) / sin(2)");
+	ck_assert_str_eq(s, "(2 * x + 4) / sin(2)");
+	free(s);
+}
+END_TEST
+
+START_TEST(test_pratt_tape)
+{
+	Node *back;
+	Parser *p;
+
+	p = pratt_alloc("-x ^ 2 + cos(3 * x) / 2");
+	p->tape = tape_alloc();
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+	ck_assert_uint_eq(p->tape->root, p->tape->len - 1);
+	back = tape_to_ast(p->tape);
+	ck_assert_uint_eq(back->sym.content.func, SUM);
+	ck_assert_uint_eq(back->left->sym.content.func, MUL);
+	ck_assert(num_equal(&back->left->left->sym, -1));
+	ck_assert_uint_eq(back->left->right->sym.content.func, EXPT);
+	ck_assert_uint_eq(back->right->sym.content.func, FRAC);
+
+	ast_free(back);
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_pratt_unary_minus)
+{
+	char *s;
+
+	s = pratt_print("-x ^ 2");
+	ck_assert_str_eq(s, "(-1) * x ^ 2");
+	free(s);
+	s = pratt_print("-2 * x");
+	ck_assert_str_eq(s, "(-2) * x");
+	free(s);
+	s = pratt_print("2 - -x");
+	ck_assert_str_eq(s, "2 - (-1) * x");
+	free(s);
+	s = pratt_print("2 ^ -x");
+	ck_assert_str_eq(s, "2 ^ ((-1) * x)");
+	free(s);
+}
+END_TEST
+
 /* START_TEST(test_parse_function_application) */
 /* { */
 /* } */
@@ -358,19 +753,33 @@ parse_suite(void)
 	tcase_add_test(tc_lex, test_l_alloc_exist);
 	tcase_add_test(tc_lex, test_lex_full);
 	tcase_add_test(tc_lex, test_lex_lparen);
+	tcase_add_test(tc_lex, test_lex_exponent);
 	tcase_add_test(tc_lex, test_lex_number);
+	tcase_add_test(tc_lex, test_lex_number_ws);
 	tcase_add_test(tc_lex, test_lex_operator);
 	tcase_add_test(tc_lex, test_lex_rparen);
 	tcase_add_test(tc_lex, test_lex_symbol);
 	tcase_add_test(tc_lex, test_lex_unknown);
 
+	tcase_add_test(tc_parse, test_func_lookup);
 	tcase_add_test(tc_parse, test_parse_empty);
+	tcase_add_test(tc_parse, test_parse_garbage);
 	tcase_add_test(tc_parse, test_parse_malformed_expression);
 	tcase_add_test(tc_parse, test_parse_non_parenthesized);
 	tcase_add_test(tc_parse, test_parse_parenthesized);
+	tcase_add_test(tc_parse, test_parse_reset);
+	tcase_add_test(tc_parse, test_parse_split);
+	tcase_add_test(tc_parse, test_parse_split_fallback);
+	tcase_add_test(tc_parse, test_parse_stream);
 	tcase_add_test(tc_parse, test_parse_unbalanced_left_parenthesis);
 	tcase_add_test(tc_parse, test_parse_unbalanced_right_parenthesis);
 	tcase_add_test(tc_parse, test_parse_unknown_func);
+	tcase_add_test(tc_parse, test_parse_var_names);
+	tcase_add_test(tc_parse, test_pratt_errors);
+	tcase_add_test(tc_parse, test_pratt_expt);
+	tcase_add_test(tc_parse, test_pratt_precedence);
+	tcase_add_test(tc_parse, test_pratt_tape);
+	tcase_add_test(tc_parse, test_pratt_unary_minus);
 
 	suite_add_tcase(s, tc_lex);
 	suite_add_tcase(s, tc_parse);
@@ -0,0 +1,261 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../dat.h"
+#include "../fns.h"
+
+static char*	batch_string(FILE*, int, int*);
+static void	check_pool(FILE*, int, int);
+static FILE*	records(size_t);
+
+/*
+ * Output of the sequential batch on in, its number of errors in nerr
+ */
+static char*
+batch_string(FILE *in, int flags, int *nerr)
+{
+	char *data;
+	Buf buf;
+	Dag *dag;
+	Parser *p;
+
+	rewind(in);
+	data = readall(in, NULL);
+	p = p_alloc_data("stdin", data, strlen(data));
+	if(flags & D_TAPE)
+		p->tape = tape_alloc();
+	dag = dag_alloc();
+	buf_init(&buf, -1);
+	*nerr = batch(p, dag, 'x', flags, &buf);
+	buf_putc(&buf, '\0');
+	dag_free(dag);
+	p_free(p);
+	return buf.data;
+}
+
+/*
+ * Compare pool_batch on in with nworkers against the sequential batch
+ */
+static void
+check_pool(FILE *in, int nworkers, int flags)
+{
+	int nerr;
+	char *got, *want;
+	FILE *out;
+
+	want = batch_string(in, flags, &nerr);
+	rewind(in);
+	out = tmpfile();
+	ck_assert_ptr_nonnull(out);
+	ck_assert_int_eq(pool_batch(NULL, in, out, nworkers, 'x', flags), nerr);
+	rewind(out);
+	got = readall(out, NULL);
+	fclose(out);
+	ck_assert_str_eq(got, want);
+
+	free(got);
+	free(want);
+}
+
+/*
+ * n records over several pool chunks, some of them malformed
+ */
+static FILE*
+records(size_t n)
+{
+	size_t i;
+	FILE *f;
+
+	f = tmpfile();
+	ck_assert_ptr_nonnull(f);
+	for(i = 0; i < n; i++) {
+		if(i % 97 == 0)
+			fprintf(f, "x $ %lu\n", (unsigned long)i);
+		else if(i % 13 == 0)
+			fprintf(f, "log(x) / (x - x);");
+		else
+			fprintf(f, "sin(x * %lu) ^ 2 + x\n", (unsigned long)i);
+	}
+	return f;
+}
+
+START_TEST(test_pool_batch)
+{
+	FILE *in;
+
+	in = records(20000);
+	check_pool(in, 1, 0);
+	check_pool(in, 3, 0);
+	check_pool(in, 8, 0);
+	fclose(in);
+}
+END_TEST
+
+START_TEST(test_pool_batch_flags)
+{
+	FILE *in;
+
+	in = records(10000);
+	check_pool(in, 4, D_TAPE);
+	check_pool(in, 4, D_LATEX);
+	check_pool(in, 4, D_TAPE | D_LATEX);
+	check_pool(in, 4, D_DAG);
+	check_pool(in, 4, D_DAG | D_LET);
+	fclose(in);
+}
+END_TEST
+
+START_TEST(test_batch_dag)
+{
+	int nerr, nerrdag;
+	char *dag, *tree;
+	FILE *in;
+
+	/* Hash-consing only changes how the derivative is computed */
+	in = records(2000);
+	tree = batch_string(in, D_LET, &nerr);
+	dag = batch_string(in, D_DAG | D_LET, &nerrdag);
+	ck_assert_int_eq(nerrdag, nerr);
+	ck_assert_str_eq(dag, tree);
+	free(dag);
+	free(tree);
+	tree = batch_string(in, 0, &nerr);
+	dag = batch_string(in, D_DAG, &nerrdag);
+	ck_assert_int_eq(nerrdag, nerr);
+	ck_assert_str_eq(dag, tree);
+	free(dag);
+	free(tree);
+	fclose(in);
+}
+END_TEST
+
+START_TEST(test_pool_batch_empty)
+{
+	FILE *in;
+
+	in = tmpfile();
+	ck_assert_ptr_nonnull(in);
+	check_pool(in, 4, 0);
+	fprintf(in, "\n;;  \n");
+	check_pool(in, 4, 0);
+	fclose(in);
+}
+END_TEST
+
+START_TEST(test_pool_batch_long_record)
+{
+	size_t i;
+	FILE *in;
+
+	/* longer than a chunk, without a final newline */
+	in = tmpfile();
+	ck_assert_ptr_nonnull(in);
+	fprintf(in, "exp(x)\n");
+	for(i = 0; i < 50000; i++)
+		fprintf(in, "x + ");
+	fprintf(in, "x");
+	check_pool(in, 2, 0);
+	fclose(in);
+}
+END_TEST
+
+START_TEST(test_pool_batch_bad_magic)
+{
+	FILE *in, *out;
+
+	/* no header for the output of a bad input */
+	in = tmpfile();
+	out = tmpfile();
+	ck_assert_ptr_nonnull(in);
+	ck_assert_ptr_nonnull(out);
+	fprintf(in, "x\n");
+	rewind(in);
+	ck_assert_int_eq(pool_batch(NULL, in, out, 2, 'x', D_BIN_IN | D_BIN_OUT), 1);
+	ck_assert_int_eq(ftell(out), 0);
+	fclose(in);
+	fclose(out);
+}
+END_TEST
+
+START_TEST(test_pool_batch_write_error)
+{
+	int nerr;
+	FILE *in, *out;
+
+	in = records(1000);
+	out = tmpfile();
+	ck_assert_ptr_nonnull(out);
+	rewind(in);
+	nerr = pool_batch(NULL, in, out, 2, 'x', 0);
+	fclose(out);
+
+	/* one more error for the output */
+	out = fopen("/dev/null", "r");
+	ck_assert_ptr_nonnull(out);
+	rewind(in);
+	ck_assert_int_eq(pool_batch(NULL, in, out, 2, 'x', 0), nerr + 1);
+	fclose(in);
+	fclose(out);
+}
+END_TEST
+
+Suite*
+pool_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("pool");
+
+	tc_core = tcase_create("core");
+
+	tcase_add_test(tc_core, test_pool_batch);
+	tcase_add_test(tc_core, test_pool_batch_flags);
+	tcase_add_test(tc_core, test_batch_dag);
+	tcase_add_test(tc_core, test_pool_batch_empty);
+	tcase_add_test(tc_core, test_pool_batch_long_record);
+	tcase_add_test(tc_core, test_pool_batch_bad_magic);
+	tcase_add_test(tc_core, test_pool_batch_write_error);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int
+main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = pool_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
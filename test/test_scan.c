@@ -0,0 +1,131 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../dat.h"
+#include "../fns.h"
+
+/* Characters of every run and some that end them, including non ASCII */
+static char alphabet[] = " \t\n\r\v\f09.5azAZqQ+(@[`{/\x80\xff\x08\x0e";
+
+START_TEST(test_scan_end)
+{
+	int impl;
+	char buf[100];
+
+	memset(buf, ' ', sizeof(buf));
+	for(impl = SCAN_PLAIN; impl <= SCAN_AVX2; impl++) {
+		if(scan_use(impl) != impl)
+			continue;
+		ck_assert_ptr_eq(scan(buf, buf + 70, SCAN_WS), buf + 70);
+		ck_assert_ptr_eq(scan(buf + 3, buf + 3, SCAN_WS), buf + 3);
+		ck_assert_ptr_eq(scan(buf, buf + 70, SCAN_SYMBOL), buf);
+	}
+	scan_use(SCAN_AUTO);
+}
+END_TEST
+
+START_TEST(test_scan_impls)
+{
+	int impl, run;
+	size_t i, j;
+	char buf[512], *want;
+
+	srand(42);
+	for(i = 0; i < sizeof(buf);) { /* runs of similar characters */
+		run = rand() % (sizeof(alphabet) - 1);
+		for(j = 1 + rand() % 40; j > 0 && i < sizeof(buf); j--)
+			buf[i++] = alphabet[(run + rand() % 4) % (sizeof(alphabet) - 1)];
+	}
+	for(run = SCAN_WS; run <= SCAN_SYMBOL; run++)
+		for(i = 0; i < sizeof(buf); i++) {
+			scan_use(SCAN_PLAIN);
+			want = scan(buf + i, buf + sizeof(buf), run);
+			for(impl = SCAN_SSE2; impl <= SCAN_AVX2; impl++)
+				if(scan_use(impl) == impl)
+					ck_assert_ptr_eq(scan(buf + i, buf + sizeof(buf), run), want);
+		}
+	scan_use(SCAN_AUTO);
+}
+END_TEST
+
+START_TEST(test_scan_runs)
+{
+	int impl;
+	char *s;
+
+	s = " \t\n\v\f\r  \t                               x12.5.3 sinhXY(";
+	for(impl = SCAN_PLAIN; impl <= SCAN_AVX2; impl++) {
+		if(scan_use(impl) != impl)
+			continue;
+		ck_assert_ptr_eq(scan(s, s + strlen(s), SCAN_WS), strchr(s, 'x'));
+		ck_assert_ptr_eq(scan(strchr(s, '1'), s + strlen(s), SCAN_NUMBER), strstr(s, " sinh"));
+		ck_assert_ptr_eq(scan(strchr(s, 's'), s + strlen(s), SCAN_SYMBOL), strchr(s, '('));
+	}
+	scan_use(SCAN_AUTO);
+}
+END_TEST
+
+START_TEST(test_scan_use)
+{
+	ck_assert_int_eq(scan_use(SCAN_PLAIN), SCAN_PLAIN);
+	ck_assert_int_ne(scan_use(SCAN_AUTO), SCAN_AUTO);
+}
+END_TEST
+
+Suite*
+scan_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("scan");
+
+	tc_core = tcase_create("core");
+
+	tcase_add_test(tc_core, test_scan_end);
+	tcase_add_test(tc_core, test_scan_impls);
+	tcase_add_test(tc_core, test_scan_runs);
+	tcase_add_test(tc_core, test_scan_use);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int
+main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = scan_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../dat.h"
+#include "../fns.h"
+
+static int
+ast_equal(Node *a, Node *b)
+{
+	if(a == NULL || b == NULL)
+		return a == b;
+	if(a->sym.type != b->sym.type)
+		return 0;
+	switch(a->sym.type) {
+	case S_NUM:
+		if(! num_equal(&a->sym, b->sym.content.num))
+			return 0;
+		break;
+	case S_VAR:
+		if(a->sym.content.var != b->sym.content.var)
+			return 0;
+		break;
+	default:
+		if(a->sym.content.func != b->sym.content.func)
+			return 0;
+	}
+	return ast_equal(a->left, b->left) && ast_equal(a->right, b->right);
+}
+
+START_TEST(test_ast_to_tape)
+{
+	Node *ast;
+	Tape *t;
+
+	/* sin(x) * 2 */
+	ast = ast_mul(ast_sin(ast_alloc(var_alloc('x'))), ast_alloc(num_alloc(2)));
+	t = ast_to_tape(ast);
+	ck_assert_uint_eq(t->len, 4);
+	ck_assert_uint_eq(t->root, 3);
+	ck_assert(is_same_var(&t->cells[0].sym, 'x'));
+	ck_assert_uint_eq(t->cells[1].sym.content.func, SIN);
+	ck_assert_uint_eq(t->cells[1].left, TAPE_NIL);
+	ck_assert_uint_eq(t->cells[1].right, 0);
+	ck_assert(num_equal(&t->cells[2].sym, 2));
+	ck_assert_uint_eq(t->cells[3].sym.content.func, MUL);
+	ck_assert_uint_eq(t->cells[3].left, 1);
+	ck_assert_uint_eq(t->cells[3].right, 2);
+
+	ast_free(ast);
+	tape_free(t);
+}
+END_TEST
+
+START_TEST(test_tape_empty)
+{
+	Tape *t, *diff;
+
+	t = ast_to_tape(NULL);
+	ck_assert_uint_eq(t->len, 0);
+	ck_assert_uint_eq(t->root, TAPE_NIL);
+	ck_assert_ptr_null(tape_to_ast(t));
+
+	diff = tape_dwrt(t, 'x');
+	ck_assert_uint_eq(diff->root, TAPE_NIL);
+
+	tape_free(t);
+	tape_free(diff);
+}
+END_TEST
+
+START_TEST(test_tape_to_ast)
+{
+	Node *ast, *back;
+	Tape *t;
+
+	/* tan(x ^ 3) / exp(y) */
+	ast = ast_frac(ast_tan(ast_expt(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(3)))),
+		ast_exp(ast_alloc(var_alloc('y'))));
+	t = ast_to_tape(ast);
+	back = tape_to_ast(t);
+	ck_assert(back != ast);
+	ck_assert(ast_equal(ast, back));
+
+	ast_free(ast);
+	ast_free(back);
+	tape_free(t);
+}
+END_TEST
+
+START_TEST(test_tape_dwrt)
+{
+	Node *ast, *diff, *tdiff;
+	Tape *t, *td;
+
+	/* x ^ x * log(cos(x)) / (x - 2) */
+	ast = ast_frac(ast_mul(ast_expt(ast_alloc(var_alloc('x')), ast_alloc(var_alloc('x'))),
+			ast_log(ast_cos(ast_alloc(var_alloc('x'))))),
+		ast_sub(ast_alloc(var_alloc('x')), ast_alloc(num_alloc(2))));
+	diff = ast_dwrt(ast, 'x');
+
+	t = ast_to_tape(ast);
+	td = tape_dwrt(t, 'x');
+	ck_assert(td->len > t->len);
+	tdiff = tape_to_ast(td);
+	ck_assert(ast_equal(diff, tdiff));
+
+	ast_free(ast);
+	ast_free(diff);
+	ast_free(tdiff);
+	tape_free(t);
+	tape_free(td);
+}
+END_TEST
+
+START_TEST(test_tape_dwrt_twice)
+{
+	Node *ast, *diff, *ddiff, *tdiff;
+	Tape *t, *td, *tdd;
+
+	/* sin(x * x) */
+	ast = ast_sin(ast_mul(ast_alloc(var_alloc('x')), ast_alloc(var_alloc('x'))));
+	diff = ast_dwrt(ast, 'x');
+	ddiff = ast_dwrt(diff, 'x');
+
+	t = ast_to_tape(ast);
+	td = tape_dwrt(t, 'x');
+	tdd = tape_dwrt(td, 'x');
+	tdiff = tape_to_ast(tdd);
+	ck_assert(ast_equal(ddiff, tdiff));
+
+	ast_free(ast);
+	ast_free(diff);
+	ast_free(ddiff);
+	ast_free(tdiff);
+	tape_free(t);
+	tape_free(td);
+	tape_free(tdd);
+}
+END_TEST
+
+START_TEST(test_tape_parse)
+{
+	Node *back;
+	Parser *p;
+	Tape *t;
+
+	p = p_alloc("files/test_parse_parenthesized.txt");
+	p->tape = tape_alloc();
+	ck_assert_msg(parse(p) == 0, "%s", p->err);
+
+	t = p->tape;
+	ck_assert_uint_eq(t->root, t->len - 1);
+	back = tape_to_ast(t);
+	ck_assert(ast_equal(p->ast, back));
+
+	ast_free(back);
+	p_free(p);
+}
+END_TEST
+
+START_TEST(test_tape_push_grow)
+{
+	uint32_t i;
+	Tape *t;
+
+	t = tape_alloc();
+	tape_push(t, var_alloc('x'), TAPE_NIL, TAPE_NIL);
+	for(i = 1; i < 10000; i++)
+		ck_assert_uint_eq(tape_push(t, func_alloc("sin"), TAPE_NIL, i - 1), i);
+	tape_link(t);
+	ck_assert_uint_eq(t->root, 9999);
+	ck_assert_uint_eq(t->cells[9999].right, 9998);
+	ck_assert(is_same_var(&t->cells[0].sym, 'x'));
+
+	tape_free(t);
+}
+END_TEST
+
+Suite*
+tape_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("tape");
+
+	tc_core = tcase_create("core");
+
+	tcase_add_test(tc_core, test_ast_to_tape);
+	tcase_add_test(tc_core, test_tape_empty);
+	tcase_add_test(tc_core, test_tape_to_ast);
+	tcase_add_test(tc_core, test_tape_dwrt);
+	tcase_add_test(tc_core, test_tape_dwrt_twice);
+	tcase_add_test(tc_core, test_tape_parse);
+	tcase_add_test(tc_core, test_tape_push_grow);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int
+main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = tape_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -18,13 +18,196 @@
  *
  */
 
+#include <sys/mman.h>
+
 #include <check.h>
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "../dat.h"
 #include "../fns.h"
 
+START_TEST(test_buf_fd)
+{
+	size_t i, len;
+	char *big, *data;
+	Buf b;
+	FILE *f;
+
+	f = tmpfile();
+	ck_assert_ptr_nonnull(f);
+	big = emalloc(200000);
+	memset(big, 'b', 200000);
+
+	buf_init(&b, fileno(f));
+	for(i = 0; i < 100000; i++)
+		buf_putc(&b, 'a');
+	ck_assert(b.len < 100000); /* already written in part */
+	buf_write(&b, big, 200000);
+	buf_num(&b, -1.5);
+	ck_assert_int_eq(buf_flush(&b), 0);
+	ck_assert_uint_eq(b.len, 0);
+	buf_free(&b);
+
+	rewind(f);
+	data = readall(f, &len);
+	ck_assert_uint_eq(len, 300004);
+	ck_assert(data[99999] == 'a' && data[100000] == 'b');
+	ck_assert(data[299999] == 'b');
+	ck_assert_str_eq(data + 300000, "-1.5");
+
+	free(data);
+	free(big);
+	fclose(f);
+}
+END_TEST
+
+START_TEST(test_buf_memory)
+{
+	size_t i;
+	Buf b;
+
+	buf_init(&b, -1);
+	buf_puts(&b, "sin(");
+	buf_num(&b, 1e300);
+	buf_putc(&b, ')');
+	ck_assert_uint_eq(b.len, 11);
+	ck_assert_int_eq(buf_flush(&b), 0);
+	ck_assert_uint_eq(b.len, 11); /* nowhere to flush to */
+	for(i = 0; i < 100000; i++)
+		buf_putc(&b, 'x');
+	buf_putc(&b, '\0');
+	ck_assert(strncmp(b.data, "sin(1e+300)x", 12) == 0);
+	ck_assert(b.data[100010] == 'x');
+	ck_assert_uint_eq(strlen(b.data), 100011);
+
+	buf_free(&b);
+	ck_assert_ptr_null(b.data);
+}
+END_TEST
+
+START_TEST(test_buf_write_error)
+{
+	int fds[2];
+	Buf b;
+
+	ck_assert_int_eq(pipe(fds), 0);
+	close(fds[0]);
+	signal(SIGPIPE, SIG_IGN);
+
+	buf_init(&b, fds[1]);
+	buf_puts(&b, "x + y");
+	ck_assert_int_eq(buf_flush(&b), -1);
+	ck_assert_int_eq(buf_flush(&b), -1); /* and it stays failed */
+
+	buf_free(&b);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_decimal)
+{
+	size_t i;
+	static char *nums[] = {
+		"0", "7", "5.44", "0.1", "000.0025", "123456789012345", "1e-3",
+		"2.5E+2", "6.02214076e23", "9007199254740993", "0.3e-22",
+		"2.2250738585072014e-308", "4.9e-324", "1.7976931348623157e308",
+		"123456789012345678901234567890", "0.000000000000000000000000000001",
+		"1.00000000000000011102230246251565404236316680908203125"
+	};
+
+	for(i = 0; i < LEN(nums); i++)
+		ck_assert_msg(decimal(nums[i], strlen(nums[i])) == strtod(nums[i], NULL),
+			"%s", nums[i]);
+}
+END_TEST
+
+START_TEST(test_decimal_span)
+{
+	ck_assert(decimal("1.5x", 4) == 1.5);
+	ck_assert(decimal("1.2.3", 5) == 1.2);
+	ck_assert(decimal("12345", 3) == 123);
+	ck_assert(decimal("2e", 2) == 2);
+	ck_assert(decimal("2e+", 3) == 2);
+	ck_assert(decimal("1e5", 2) == 1);
+	ck_assert(decimal("1e400", 5) == strtod("1e400", NULL));
+	ck_assert(decimal("1e-400", 6) == 0);
+}
+END_TEST
+
+START_TEST(test_numfmt)
+{
+	size_t i;
+	char s[NUMSZ];
+	static struct {
+		double num;
+		int digits;
+		char *want;
+	} nums[] = {
+		{0, 0, "0"}, {2, 0, "2"}, {-2.5, 0, "-2.5"}, {0.001, 0, "0.001"},
+		{0.1 + 0.2, 0, "0.30000000000000004"}, {1.0 / 3, 0, "0.3333333333333333"},
+		{123456.789, 0, "123456.789"}, {1e21, 0, "1e+21"},
+		{9007199254740993.0, 0, "9007199254740992"}, {1e300, 0, "1e+300"},
+		{1e-30, 0, "1e-30"}, {5e-324, 0, "5e-324"}, {0.1 + 0.2, 3, "0.3"},
+		{123456.789, 3, "1.23e+05"}, {-1.0 / 3, 2, "-0.33"}
+	};
+
+	for(i = 0; i < LEN(nums); i++) {
+		ck_assert_int_eq(numfmt(s, nums[i].num, nums[i].digits), strlen(nums[i].want));
+		ck_assert_str_eq(s, nums[i].want);
+	}
+}
+END_TEST
+
+START_TEST(test_numfmt_nonfinite)
+{
+	char s[NUMSZ];
+	double inf, nan;
+
+	inf = HUGE_VAL;
+	nan = inf - inf;
+	ck_assert_int_eq(numfmt(s, inf, 0), 3);
+	ck_assert_str_eq(s, "inf");
+	ck_assert_int_eq(numfmt(s, -inf, 3), 4);
+	ck_assert_str_eq(s, "-inf");
+	ck_assert_int_eq(numfmt(s, nan, 0), 3);
+	ck_assert_str_eq(s, "nan");
+	ck_assert_int_eq(numfmt(s, -nan, 2), 3);
+	ck_assert_str_eq(s, "nan");
+}
+END_TEST
+
+START_TEST(test_numfmt_round_trip)
+{
+	int i, len;
+	uint64_t bits;
+	char s[NUMSZ];
+	double num;
+
+	srand(1);
+	for(i = 0; i < 100000; i++) {
+		if(i % 2 == 0) {
+			num = (double)(rand() % 100000) / (1 + rand() % 1000);
+		} else {
+			bits = (uint64_t)rand() << 42 ^ (uint64_t)rand() << 21 ^ rand();
+			memcpy(&num, &bits, sizeof(double));
+			if(num != num || num - num != 0)
+				continue; /* NaN or infinity */
+		}
+		len = numfmt(s, num, 0);
+		ck_assert(len < NUMSZ);
+		if(num < 0)
+			ck_assert_double_eq(-decimal(s + 1, len - 1), num);
+		else
+			ck_assert_double_eq(decimal(s, len), num);
+	}
+}
+END_TEST
+
 START_TEST(test_readall_short)
 {
 	char *buf;
@@ -33,7 +216,7 @@ START_TEST(test_readall_short)
 	f = fopen("files/test_readall_short.txt", "r");
 	ck_assert(f != NULL);
 
-	buf = readall(f);
+	buf = readall(f, NULL);
 	ck_assert_str_eq(buf, "abcde\n");
 	free(buf);
 }
@@ -49,12 +232,55 @@ START_TEST(test_readall_long)
 
 /* Ansi C requires strings shorter than 509 and BUFSZ is 512  */
 #define BUFSZ 20
-	buf = readall(f);
+	buf = readall(f, NULL);
 	ck_assert_str_eq(buf, "12345678901234567890123\n");
 	free(buf);
 }
 END_TEST
 
+START_TEST(test_readall_len)
+{
+	size_t len;
+	char *buf;
+	FILE *f;
+
+	f = tmpfile();
+	ck_assert(f != NULL);
+	fwrite("ab\0cd", sizeof(char), 5, f);
+	rewind(f);
+
+	buf = readall(f, &len);
+	ck_assert_uint_eq(len, 5);
+	ck_assert(memcmp(buf, "ab\0cd", 6) == 0);
+	free(buf);
+	fclose(f);
+}
+END_TEST
+
+START_TEST(test_mapall)
+{
+	size_t len;
+	char *data;
+	FILE *f;
+
+	f = fopen("files/test_readall_long.txt", "r");
+	ck_assert(f != NULL);
+	data = mapall(f, &len);
+	ck_assert_ptr_nonnull(data);
+	ck_assert_uint_eq(len, 24);
+	ck_assert(memcmp(data, "12345678901234567890123\n", len) == 0);
+	munmap(data, len);
+
+	/* Already read from, or not a regular file */
+	fgetc(f);
+	ck_assert_ptr_null(mapall(f, &len));
+	fclose(f);
+	f = tmpfile();
+	ck_assert_ptr_null(mapall(f, &len));
+	fclose(f);
+}
+END_TEST
+
 START_TEST(test_strappend_no_realloc)
 {
 	char *buf;
@@ -66,7 +292,7 @@ START_TEST(test_strappend_no_realloc)
 
 	buf = strcpy(buf, "abcdefg");
 
-	strappend(buf, 'h', 7, len);
+	strappend(&buf, 'h', 7, len);
 	ck_assert_str_eq(buf, "abcdefgh");
 
 	free(buf);
@@ -83,19 +309,40 @@ START_TEST(test_strappend_with_realloc)
 	buf = calloc(len + 1, sizeof(char));
 	ck_assert(buf != NULL);
 
-	len = strappend(buf, 'a', offset++, len);
+	len = strappend(&buf, 'a', offset++, len);
 	ck_assert_str_eq(buf, "a");
-	len = strappend(buf, 'b', offset++, len);
+	len = strappend(&buf, 'b', offset++, len);
 	ck_assert_str_eq(buf, "ab");
-	len = strappend(buf, 'c', offset++, len);
+	len = strappend(&buf, 'c', offset++, len);
 	ck_assert_str_eq(buf, "abc");
-	len = strappend(buf, 'd', offset++, len);
+	len = strappend(&buf, 'd', offset++, len);
 	ck_assert_str_eq(buf, "abcd");
 
 	free(buf);
 }
 END_TEST
 
+START_TEST(test_stk)
+{
+	int i, *p;
+	Stk s;
+
+	stk_init(&s, sizeof(int));
+	ck_assert_ptr_null(stk_top(&s));
+	ck_assert_ptr_null(stk_pop(&s));
+	for(i = 0; i < 1000; i++)
+		*(int*)stk_push(&s) = i;
+	ck_assert_uint_eq(s.len, 1000);
+	ck_assert_int_eq(*(int*)stk_top(&s), 999);
+	for(i = 999; (p = stk_pop(&s)) != NULL; i--)
+		ck_assert_int_eq(*p, i);
+	ck_assert_int_eq(i, -1);
+
+	stk_free(&s);
+	ck_assert_ptr_null(s.data);
+}
+END_TEST
+
 Suite*
 util_suite(void)
 {
@@ -106,10 +353,21 @@ util_suite(void)
 
 	tc_core = tcase_create("core");
 
+	tcase_add_test(tc_core, test_buf_fd);
+	tcase_add_test(tc_core, test_buf_memory);
+	tcase_add_test(tc_core, test_buf_write_error);
+	tcase_add_test(tc_core, test_decimal);
+	tcase_add_test(tc_core, test_decimal_span);
+	tcase_add_test(tc_core, test_numfmt);
+	tcase_add_test(tc_core, test_numfmt_nonfinite);
+	tcase_add_test(tc_core, test_numfmt_round_trip);
 	tcase_add_test(tc_core, test_readall_short);
 	tcase_add_test(tc_core, test_readall_long);
+	tcase_add_test(tc_core, test_readall_len);
+	tcase_add_test(tc_core, test_mapall);
 	tcase_add_test(tc_core, test_strappend_with_realloc);
 	tcase_add_test(tc_core, test_strappend_no_realloc);
+	tcase_add_test(tc_core, test_stk);
 	suite_add_tcase(s, tc_core);
 
 	return s;
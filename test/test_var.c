@@ -0,0 +1,125 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../dat.h"
+#include "../fns.h"
+
+#define NTHREADS 4
+#define NVARS 5000
+
+static void*
+intern_many(void *arg)
+{
+	int i;
+	char name[16];
+	uint32_t *ids;
+
+	ids = arg;
+	for(i = 0; i < NVARS; i++) {
+		sprintf(name, "v%c%c%c", 'a' + i % 26, 'a' + i / 26 % 26, 'a' + i / 676 % 26);
+		ids[i] = var_intern(name, strlen(name));
+	}
+	return NULL;
+}
+
+START_TEST(test_var_intern)
+{
+	uint32_t a, b;
+
+	ck_assert_uint_eq(var_intern("x", 1), 'x');
+	a = var_intern("alpha", 5);
+	b = var_intern("alphabet", 5);
+	ck_assert_uint_eq(a, b);
+	ck_assert_uint_gt(a, 255);
+	ck_assert_uint_ne(var_intern("alphabet", 8), a);
+	ck_assert_uint_ne(var_intern("al", 2), a);
+}
+END_TEST
+
+START_TEST(test_var_name)
+{
+	uint32_t id;
+
+	ck_assert_str_eq(var_name('y'), "y");
+	id = var_intern("theta", 5);
+	ck_assert_str_eq(var_name(id), "theta");
+}
+END_TEST
+
+START_TEST(test_var_threads)
+{
+	int i, t;
+	pthread_t threads[NTHREADS];
+	static uint32_t ids[NTHREADS][NVARS];
+
+	for(t = 0; t < NTHREADS; t++)
+		pthread_create(&threads[t], NULL, intern_many, ids[t]);
+	for(t = 0; t < NTHREADS; t++)
+		pthread_join(threads[t], NULL);
+	for(i = 0; i < NVARS; i++) {
+		for(t = 1; t < NTHREADS; t++)
+			ck_assert_uint_eq(ids[t][i], ids[0][i]);
+		if(i > 0)
+			ck_assert_uint_ne(ids[0][i], ids[0][i - 1]);
+	}
+	ck_assert_str_eq(var_name(ids[0][27]), "vbba");
+}
+END_TEST
+
+Suite*
+var_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("var");
+
+	tc_core = tcase_create("core");
+
+	tcase_add_test(tc_core, test_var_intern);
+	tcase_add_test(tc_core, test_var_name);
+	tcase_add_test(tc_core, test_var_threads);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int
+main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = var_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -18,14 +18,257 @@
  *
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <float.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "dat.h"
 #include "fns.h"
 
 #define BUFSZ 512
+#define DIGITS_MAX 19 /* decimal digits that always fit in a uint64_t */
+#define EXP_MAX 99999 /* beyond any double, either way */
+#define EXACT_MAX 9007199254740992.0 /* 2^53, smaller integers are exact doubles */
+#define OUTSZ (64 * 1024) /* bytes a Buf gathers before writing them */
+#define STK_MINSZ 64
+
+/* Powers of ten that are exact doubles */
+static const double exact10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static void	buf_room(Buf*, size_t);
+static void	buf_writeall(Buf*, char*, size_t);
+
+/* Significant digits buf_num prints, 0 for as many as needed */
+static int ndigits = 0;
+
+/* Held by the first thread that dies, the others block in die forever */
+static pthread_mutex_t dying = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Make buf_num round numbers to n significant digits from now on, 0 prints
+ * the fewest that read back as the same double. Return the previous n.
+ */
+int
+buf_digits(int n)
+{
+	int prev;
+
+	prev = ndigits;
+	ndigits = n;
+	return prev;
+}
+
+/*
+ * Output buffers: the printers append to a Buf, which goes to its fd in
+ * writes of OUTSZ bytes, or keeps growing in memory when fd is -1. A failed
+ * write is remembered and reported by buf_flush.
+ */
+int
+buf_flush(Buf *b)
+{
+	if(b->fd >= 0) {
+		buf_writeall(b, b->data, b->len);
+		b->len = 0;
+	}
+	return b->err ? -1 : 0;
+}
+
+/*
+ * Release the memory of b, without flushing it
+ */
+void
+buf_free(Buf *b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = b->size = 0;
+}
+
+void
+buf_init(Buf *b, int fd)
+{
+	b->data = NULL;
+	b->len = b->size = 0;
+	b->fd = fd;
+	b->err = 0;
+}
+
+/*
+ * Append num the way expressions are printed, see buf_digits
+ */
+void
+buf_num(Buf *b, double num)
+{
+	buf_room(b, NUMSZ);
+	b->len += numfmt(b->data + b->len, num, ndigits);
+}
+
+void
+buf_putc(Buf *b, char c)
+{
+	if(b->len == b->size)
+		buf_room(b, 1);
+	b->data[b->len++] = c;
+}
+
+void
+buf_puts(Buf *b, char *s)
+{
+	buf_write(b, s, strlen(s));
+}
+
+/*
+ * Make room for n more bytes, flushing b or growing it
+ */
+static void
+buf_room(Buf *b, size_t n)
+{
+	if(b->size - b->len >= n)
+		return;
+	if(b->fd >= 0)
+		buf_flush(b);
+	if(b->size - b->len >= n)
+		return;
+	if(b->size == 0)
+		b->size = OUTSZ;
+	while(b->size - b->len < n)
+		b->size *= 2;
+	b->data = erealloc(b->data, b->size);
+}
+
+void
+buf_write(Buf *b, char *s, size_t n)
+{
+	if(n == 0)
+		return; /* s may be the NULL data of an empty Buf */
+	if(b->fd >= 0 && n >= OUTSZ) {
+		/* Not worth copying */
+		buf_flush(b);
+		buf_writeall(b, s, n);
+		return;
+	}
+	buf_room(b, n);
+	memcpy(b->data + b->len, s, n);
+	b->len += n;
+}
+
+/*
+ * Write the n bytes at s to b's fd, unless a write already failed
+ */
+static void
+buf_writeall(Buf *b, char *s, size_t n)
+{
+	ssize_t w;
+
+	while(! b->err && n > 0) {
+		if((w = write(b->fd, s, n)) < 0) {
+			b->err = errno != EINTR;
+			continue;
+		}
+		s += w;
+		n -= w;
+	}
+}
+
+/*
+ * Value of the decimal number in the len bytes at s, which need not be NUL
+ * terminated: digits, an optional fraction after a '.' and an optional
+ * exponent after an 'e' or 'E', like atof stopping at the first character
+ * that does not fit. The result is correctly rounded and does not depend on
+ * the locale.
+ */
+double
+decimal(char *s, size_t len)
+{
+	int dot, exp, neg, nd, shift, trunc;
+	uint64_t m;
+	char buf[64], *digits, *p, *end, *mark;
+	double num;
+
+	/* Up to DIGITS_MAX significant digits in m, the value is m * 10^shift */
+	end = s + len;
+	m = 0;
+	nd = shift = trunc = dot = 0;
+	for(p = s; p < end; p++) {
+		if(*p == '.' && ! dot) {
+			dot = 1;
+			continue;
+		}
+		if(*p < '0' || *p > '9')
+			break;
+		if(nd < DIGITS_MAX) {
+			m = m * 10 + (*p - '0');
+			nd += m != 0; /* leading zeros are not significant */
+			shift -= dot;
+		} else {
+			trunc |= *p != '0';
+			shift += ! dot;
+		}
+	}
+	mark = p;
+
+	exp = neg = 0;
+	if(p + 1 < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		if(*p == '+' || *p == '-')
+			neg = *p++ == '-';
+		for(; p < end && *p >= '0' && *p <= '9'; p++)
+			exp = exp < EXP_MAX ? exp * 10 + (*p - '0') : EXP_MAX;
+	}
+	exp = neg ? -exp : exp;
+
+	if(m == 0)
+		return 0;
+	/* Exact operands and a single rounding */
+	if(! trunc && m <= (uint64_t)1 << 53 && shift + exp >= -22 && shift + exp <= 22)
+		return shift + exp < 0 ? (double)m / exact10[-(shift + exp)]
+			: (double)m * exact10[shift + exp];
+
+	/*
+	 * Leave long mantissas to strtod, spelt out as digits and an exponent
+	 * without a decimal point so that the locale cannot get in the way
+	 */
+	digits = len + 16 <= sizeof(buf) ? buf : emalloc(len + 16);
+	nd = shift = dot = 0;
+	for(p = s; p < mark; p++) {
+		if(*p == '.')
+			dot = 1;
+		else {
+			shift -= dot;
+			if(nd > 0 || *p != '0')
+				digits[nd++] = *p;
+		}
+	}
+	sprintf(digits + nd, "e%d", shift + exp);
+	num = strtod(digits, NULL);
+	if(digits != buf)
+		free(digits);
+	return num;
+}
+
+/*
+ * Report the failure of f and exit. Only one thread at a time may run exit,
+ * so that the pool workers cannot race each other on stdio and atexit.
+ */
+void
+die(char *f)
+{
+	pthread_mutex_lock(&dying);
+	perror(f);
+	exit(1);
+}
 
 void*
 ecalloc(long nelem, size_t size)
@@ -33,10 +276,8 @@ ecalloc(long nelem, size_t size)
 	void *p;
 	p = calloc(nelem, size);
 
-	if(p == NULL) {
-		perror("ecalloc");
-		exit(1);
-	}
+	if(p == NULL)
+		die("ecalloc");
 	return p;
 }
 
@@ -46,40 +287,199 @@ emalloc(size_t size)
 	void *p;
 	p = malloc(size);
 
-	if(p == NULL) {
-		perror("emalloc");
-		exit(1);
-	}
+	if(p == NULL)
+		die("emalloc");
+	return p;
+}
+
+void*
+erealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+
+	if(p == NULL)
+		die("erealloc");
 	return p;
 }
 
+/*
+ * Map the contents of f read-only, for a sequential scan. Return NULL, and
+ * leave f alone, if it is not a regular file, it is empty or it was already
+ * read from, then readall it instead. Release the contents with munmap.
+ */
+char*
+mapall(FILE *f, size_t *len)
+{
+	int fd;
+	void *data;
+	struct stat st;
+
+	fd = fileno(f);
+	if(fstat(fd, &st) < 0 || ! S_ISREG(st.st_mode) || st.st_size == 0
+	   || lseek(fd, 0, SEEK_CUR) != 0)
+		return NULL;
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED)
+		return NULL;
+	posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+	*len = st.st_size;
+	return data;
+}
+
+/*
+ * Write num to s, which holds NUMSZ bytes, as the shortest decimal that
+ * decimal reads back as the same double, or rounded to digits significant
+ * digits if digits > 0. NaN is written as nan and infinities as inf and
+ * -inf, which do not read back. Return the length of s.
+ */
+int
+numfmt(char *s, double num, int digits)
+{
+	int k, len, n;
+	uint64_t m;
+	char *p, rev[NUMSZ];
+	double a;
+
+	if(num != num)
+		return sprintf(s, "nan"); /* whatever its sign bit */
+	p = s;
+	if(num < 0) {
+		*p++ = '-';
+		num = -num;
+	}
+	if(num > DBL_MAX)
+		return p - s + sprintf(p, "inf");
+	/*
+	 * m / 10^k is correctly rounded, like decimal, when both are exact:
+	 * the first k that gives back num has the fewest digits
+	 */
+	for(k = 0; digits == 0 && k < (int)LEN(exact10); k++) {
+		if((a = num * exact10[k]) >= EXACT_MAX)
+			break;
+		m = (uint64_t)(a + 0.5);
+		if((double)m / exact10[k] != num)
+			continue;
+		n = 0;
+		do
+			rev[n++] = '0' + m % 10;
+		while((m /= 10) > 0);
+		if(n <= k) {
+			*p++ = '0';
+			*p++ = '.';
+			for(len = n; len < k; len++)
+				*p++ = '0';
+		}
+		for(len = n; len > 0; len--) {
+			if(len == k && n > k)
+				*p++ = '.';
+			*p++ = rev[len - 1];
+		}
+		*p = '\0';
+		return p - s;
+	}
+	/*
+	 * Huge, tiny or long numbers. Between 1e-5 and 2^53
+	 * the loop above tried every decimal of DBL_DIG digits or less.
+	 */
+	if(digits > 0)
+		return p - s + sprintf(p, "%.*g", digits, num);
+	n = num >= 1e-5 && num < EXACT_MAX ? DBL_DIG : 1;
+	for(; n < DBL_DIG + 2; n++) {
+		len = sprintf(p, "%.*g", n, num);
+		if(decimal(p, len) == num)
+			return p - s + len;
+	}
+	return p - s + sprintf(p, "%.*g", DBL_DIG + 2, num); /* always exact */
+}
+
+/*
+ * Read f until its end into a NUL terminated buffer, store its length in len
+ * if not NULL
+ */
 char*
-readall(FILE *f)
+readall(FILE *f, size_t *len)
 {
-	size_t bufsz, sz;
+	size_t bufsz, n, sz;
 	char *data;
 
 	bufsz = BUFSZ;
-	data = ecalloc(bufsz, sizeof(char));
-	while((sz = fread(data, sizeof(char), BUFSZ, f)) > 0) {
-		if(sz == bufsz - 1) {
+	n = 0;
+	data = emalloc(bufsz);
+	while((sz = fread(data + n, sizeof(char), bufsz - n - 1, f)) > 0) {
+		n += sz;
+		if(n == bufsz - 1) {
 			bufsz *= 2;
-			data = realloc(data, bufsz);
+			data = erealloc(data, bufsz);
 		}
 	}
-	data[bufsz - 1] = '\0';
+	data[n] = '\0';
+	if(len != NULL)
+		*len = n;
 	return data;
 }
 
+/*
+ * Growable stacks of fixed size elements, used by the tree walks so that
+ * their depth is bounded by memory instead of the C stack. An empty Stk owns
+ * no memory.
+ */
+void
+stk_free(Stk *s)
+{
+	free(s->data);
+	s->data = NULL;
+	s->len = s->size = 0;
+}
+
+void
+stk_init(Stk *s, size_t elsz)
+{
+	s->data = NULL;
+	s->elsz = elsz;
+	s->len = s->size = 0;
+}
+
+/*
+ * Pop the top element, the pointer stays valid until the next stk_push
+ */
+void*
+stk_pop(Stk *s)
+{
+	return s->len == 0 ? NULL : s->data + --s->len * s->elsz;
+}
+
+/*
+ * Make room for one more element and return a pointer to it
+ */
+void*
+stk_push(Stk *s)
+{
+	if(s->len == s->size) {
+		s->size = s->size == 0 ? STK_MINSZ : 2 * s->size;
+		s->data = erealloc(s->data, s->size * s->elsz);
+	}
+	return s->data + s->len++ * s->elsz;
+}
+
+void*
+stk_top(Stk *s)
+{
+	return s->len == 0 ? NULL : s->data + (s->len - 1) * s->elsz;
+}
+
+/*
+ * Store c at offset in the len bytes *str, growing it when c and the NUL
+ * after it do not fit. Return the new size of *str.
+ */
 size_t
-strappend(char *str, char c, size_t offset, size_t len)
+strappend(char **str, char c, size_t offset, size_t len)
 {
-	if(offset >= len) {
-		len *= 2;
-		str = realloc(str, len);
+	if(offset + 1 >= len) {
+		len = 2 * (offset + 1);
+		*str = erealloc(*str, len);
 	}
 
-	str[offset] = c;
-	str[offset + 1] = '\0';
+	(*str)[offset] = c;
+	(*str)[offset + 1] = '\0';
 	return len;
 }
@@ -0,0 +1,171 @@
+/*
+ * Copyright ©️ 2022 Mario Forzanini <mf@marioforzanini.com>
+ *
+ * This file is part of dwrt.
+ *
+ * Dwrt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Dwrt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwrt. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat.h"
+#include "fns.h"
+
+/*
+ * Variable names. A single character is its own id, longer names are
+ * interned and numbered from VAR_FIRST on, so nodes hold a small integer
+ * and comparing variables is comparing integers. The table is shared by
+ * every thread and only grows.
+ */
+
+#define VAR_FIRST 256
+#define VAR_MINSZ 64
+
+static void	var_grow(void);
+static size_t	var_hash(char*, size_t);
+static void	var_init(void);
+static uint32_t	var_probe(char*, size_t, size_t*);
+
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static char **names = NULL; /* names[id - VAR_FIRST] */
+static uint32_t nnames = 0;
+static char single[VAR_FIRST][2];
+static uint32_t *slots = NULL; /* ids by hash, 0 when free */
+static size_t slotsz = 0;
+
+static void
+var_grow(void)
+{
+	size_t i;
+	uint32_t id;
+
+	free(slots);
+	slotsz = slotsz == 0 ? VAR_MINSZ : 2 * slotsz;
+	slots = ecalloc(slotsz, sizeof(uint32_t));
+	names = erealloc(names, slotsz / 2 * sizeof(char*));
+	for(id = VAR_FIRST; id < VAR_FIRST + nnames; id++) {
+		var_probe(names[id - VAR_FIRST], strlen(names[id - VAR_FIRST]), &i);
+		slots[i] = id;
+	}
+}
+
+static size_t
+var_hash(char *name, size_t len)
+{
+	size_t h, i;
+
+	h = 2166136261UL;
+	for(i = 0; i < len; i++)
+		h = (h ^ (unsigned char)name[i]) * 0x01000193UL;
+	return h ^ (h >> 16);
+}
+
+static void
+var_init(void)
+{
+	int c;
+
+	for(c = 0; c < VAR_FIRST; c++) {
+		single[c][0] = c;
+		single[c][1] = '\0';
+	}
+}
+
+/*
+ * Id of the variable named by the len bytes at name, the single character
+ * ones included. Longer names are added to the table the first time they
+ * are seen.
+ */
+uint32_t
+var_intern(char *name, size_t len)
+{
+	size_t i;
+	uint32_t id;
+	char *s;
+
+	if(len == 1)
+		return (unsigned char)name[0];
+	pthread_rwlock_rdlock(&lock);
+	id = var_probe(name, len, &i);
+	pthread_rwlock_unlock(&lock);
+	if(id != 0)
+		return id;
+
+	pthread_rwlock_wrlock(&lock);
+	/* another thread may have added it in between */
+	if((id = var_probe(name, len, &i)) == 0) {
+		if(2 * (nnames + 1) > slotsz) {
+			var_grow();
+			var_probe(name, len, &i);
+		}
+		s = emalloc(len + 1);
+		memcpy(s, name, len);
+		s[len] = '\0';
+		id = VAR_FIRST + nnames;
+		names[nnames++] = s;
+		slots[i] = id;
+	}
+	pthread_rwlock_unlock(&lock);
+	return id;
+}
+
+/*
+ * Printable name of variable id, valid for as long as the program runs
+ */
+char*
+var_name(uint32_t id)
+{
+	char *s;
+
+	if(id < VAR_FIRST) {
+		pthread_once(&once, var_init);
+		return single[id];
+	}
+	pthread_rwlock_rdlock(&lock);
+	s = id - VAR_FIRST < nnames ? names[id - VAR_FIRST] : "";
+	pthread_rwlock_unlock(&lock);
+	return s;
+}
+
+/*
+ * Id of the interned name, 0 if there is none, and in *slot where it is
+ * or would go. Called with lock held.
+ */
+static uint32_t
+var_probe(char *name, size_t len, size_t *slot)
+{
+	size_t i;
+	uint32_t id;
+	char *s;
+
+	if(slotsz == 0) {
+		*slot = 0;
+		return 0;
+	}
+	i = var_hash(name, len) & (slotsz - 1);
+	for(; (id = slots[i]) != 0; i = (i + 1) & (slotsz - 1)) {
+		s = names[id - VAR_FIRST];
+		if(strncmp(s, name, len) == 0 && s[len] == '\0')
+			break;
+	}
+	*slot = i;
+	return id;
+}